@@ -139,13 +139,16 @@
 
        
         ray_origin = u_localcamera_position;
-        ray_direction = normalize(v_world_position - u_localcamera_position);
+        ray_direction = normalize(v_position - u_localcamera_position);
 
    
         vec2 tHit = intersectAABB(ray_origin, ray_direction, u_box_min, u_box_max);
         float tb = tHit.y;  
         float ta = tHit.x;
 
+        //the fragment is on the proxy hull, nothing to integrate between the box and it
+        ta = max(ta, dot(v_position - ray_origin, ray_direction));
+
         vec4 final_color = u_background; 
 
         if(u_volume_type == 0){
@@ -131,7 +131,7 @@ void main() {
    
     vec3 ray_origin = u_localcamera_position;
     
-    vec3 ray_direction = normalize(v_world_position - u_localcamera_position);
+    vec3 ray_direction = normalize(v_position - u_localcamera_position);
 
     vec4 accumulated_color = vec4(0.0);
     vec4 emitted_radiance = vec4(0.0);
@@ -140,6 +140,9 @@ void main() {
     float tb = tHit.y;  
     float ta = tHit.x;
 
+    //the fragment is on the proxy hull, nothing to integrate between the box and it
+    ta = max(ta, dot(v_position - ray_origin, ray_direction));
+
     vec4 final_color = u_background; 
     
     if(u_volume_type == 0){
@@ -1,49 +1,98 @@
 #version 450 core
 
-// Uniforms for user-controlled parameters
-uniform vec3 u_backgroundColor;      // Background color B
-uniform float u_absorptionCoefficient; // Absorption coefficient μa
+#define LIGHT_DIRECTIONAL 0
+#define LIGHT_POINT 1
+#define LIGHT_SPOT 2
 
-// Input for ray parameters (assuming you already calculate these)
-in vec3 v_rayOrigin;  // Make sure to declare this in the vertex shader too
-in vec3 v_rayDirection; // Make sure to declare this in the vertex shader too
+in vec3 v_position;
+in vec3 v_world_position;
+in vec3 v_normal;
+in vec2 v_uv;
 
-// Output color for each fragment
-out vec4 FragColor; // Correctly declare the output color
+uniform vec4 u_color;
+uniform vec4 u_ambient_light;
+uniform vec3 u_camera_position;
 
-// Function to compute the intersection points (e.g., with a box)
-bool intersectVolume(vec3 origin, vec3 direction, out float tEnter, out float tExit) {
-    // Calculate intersection points with volume geometry (a cube or sphere, for example)
-    // Example of a unit box [-1,1] for simplicity.
-    vec3 tMin = (vec3(-1.0) - origin) / direction;
-    vec3 tMax = (vec3(1.0) - origin) / direction;
+#ifdef USE_CLUSTERED_LIGHTING
+//filled by LightClusters, the directional lights are the first u_num_global_lights
+struct sLight
+{
+	vec4 position; //w is the type
+	vec4 color; //a is the intensity
+	vec4 direction; //w is the shininess
+	vec4 params; //x is the max distance
+};
+layout(std430, binding = 0) readonly buffer LightBuffer { sLight lights[]; };
+layout(std430, binding = 1) readonly buffer ClusterBuffer { uvec2 clusters[]; }; //offset and count in light_indices
+layout(std430, binding = 2) readonly buffer LightIndexBuffer { uint light_indices[]; };
 
-    vec3 t1 = min(tMin, tMax);
-    vec3 t2 = max(tMin, tMax);
+uniform mat4 u_view;
+uniform ivec3 u_cluster_grid;
+uniform vec2 u_cluster_depth; //slice = log(depth) * x + y
+uniform vec4 u_viewport;
+uniform int u_num_global_lights;
+#else
+//one light per pass (see StandardMaterial::render)
+uniform int u_light_type;
+uniform float u_light_intensity;
+uniform float u_light_shininess;
+uniform vec4 u_light_color;
+uniform vec3 u_light_direction;
+uniform vec3 u_light_position;
+uniform float u_light_max_distance;
+#endif
 
-    tEnter = max(max(t1.x, t1.y), t1.z);
-    tExit = min(min(t2.x, t2.y), t2.z);
+out vec4 FragColor;
 
-    return tEnter < tExit && tExit > 0.0;
+//phong with a smooth falloff that reaches zero at max_distance
+vec3 shadeLight(int type, vec3 light_position, vec3 light_direction, vec3 light_color, float max_distance, float shininess, vec3 N, vec3 V)
+{
+	vec3 L = normalize(light_direction);
+	float attenuation = 1.0;
+	if (type != LIGHT_DIRECTIONAL)
+	{
+		vec3 to_light = light_position - v_world_position;
+		float dist = length(to_light);
+		L = to_light / max(dist, 0.0001);
+		float falloff = clamp(1.0 - dist / max_distance, 0.0, 1.0);
+		attenuation = falloff * falloff;
+	}
+
+	float NdotL = max(dot(N, L), 0.0);
+	vec3 R = reflect(-L, N);
+	float specular = NdotL > 0.0 ? pow(max(dot(R, V), 0.0), shininess) : 0.0;
+	return light_color * attenuation * (NdotL * u_color.xyz + specular);
 }
 
-void main() {
-    float tEnter, tExit;
-    if (intersectVolume(v_rayOrigin, v_rayDirection, tEnter, tExit)) {
-        // Calculate the optical thickness
-        float pathLength = tExit - tEnter;
-        float opticalThickness = pathLength * u_absorptionCoefficient;
-
-        // Compute the transmittance using Beer-Lambert law
-        float transmittance = exp(-opticalThickness);
-
-        // Calculate the final color by scaling the background color
-        vec3 radiance = u_backgroundColor * transmittance;
-
-        // Output the color as vec4
-        FragColor = vec4(radiance, 1.0);
-    } else {
-        // If no intersection, set color to background
-        FragColor = vec4(u_backgroundColor, 1.0);
-    }
+void main()
+{
+	vec3 N = normalize(v_normal);
+	vec3 V = normalize(u_camera_position - v_world_position);
+	vec3 color = u_ambient_light.xyz * u_color.xyz;
+
+#ifdef USE_CLUSTERED_LIGHTING
+	for (int i = 0; i < u_num_global_lights; ++i)
+	{
+		sLight light = lights[i];
+		color += shadeLight(LIGHT_DIRECTIONAL, light.position.xyz, light.direction.xyz, light.color.xyz * light.color.a, light.params.x, light.direction.w, N, V);
+	}
+
+	//only the lights assigned to the froxel of this fragment
+	float depth = -(u_view * vec4(v_world_position, 1.0)).z;
+	ivec3 cell;
+	cell.xy = ivec2((gl_FragCoord.xy - u_viewport.xy) / u_viewport.zw * vec2(u_cluster_grid.xy));
+	cell.z = int(log(max(depth, 0.0001)) * u_cluster_depth.x + u_cluster_depth.y);
+	cell = clamp(cell, ivec3(0), u_cluster_grid - 1);
+	uvec2 cluster = clusters[cell.x + cell.y * u_cluster_grid.x + cell.z * u_cluster_grid.x * u_cluster_grid.y];
+
+	for (uint i = 0; i < cluster.y; ++i)
+	{
+		sLight light = lights[light_indices[cluster.x + i]];
+		color += shadeLight(int(light.position.w), light.position.xyz, light.direction.xyz, light.color.xyz * light.color.a, light.params.x, light.direction.w, N, V);
+	}
+#else
+	color += shadeLight(u_light_type, u_light_position, u_light_direction, u_light_color.xyz * u_light_intensity, u_light_max_distance, u_light_shininess, N, V);
+#endif
+
+	FragColor = vec4(color, u_color.a);
 }
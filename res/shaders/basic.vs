@@ -5,10 +5,23 @@ in vec3 a_normal;
 in vec2 a_uv;
 in vec4 a_color;
 
+#ifdef USE_INSTANCING
+//one per instance (see Mesh::renderInstanced)
+in mat4 u_model;
+in vec4 a_instance_color;
+out vec4 v_instance_color;
+#else
 uniform mat4 u_model;
+#endif
 uniform mat4 u_viewprojection;
 uniform vec3 u_camera_position;
 
+//meshes in the compact vertex format store the positions normalized inside their bounding box
+//and the normals with the octahedral encoding (see Mesh::quantizeBuffers)
+uniform vec3 u_position_offset;
+uniform vec3 u_position_scale;
+uniform bool u_octahedral_normals;
+
 //this will store the color for the pixel shader
 out vec3 v_position;
 out vec3 v_world_position;
@@ -16,18 +29,33 @@ out vec3 v_normal;
 out vec2 v_uv;
 out vec4 v_color;
 
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
 void main()
 {	
+	vec3 normal = u_octahedral_normals ? decodeOctahedral(a_normal.xy) : a_normal;
+
 	//calcule the normal in camera space (the NormalMatrix is like ViewMatrix but without traslation)
-	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
+	v_normal = (u_model * vec4( normal, 0.0) ).xyz;
 	
 	//calcule the vertex in object space
-	v_position = a_vertex;
+	v_position = u_position_offset + a_vertex * u_position_scale;
 	v_world_position = (u_model * vec4( v_position, 1.0) ).xyz;
 	
 	//store the color in the varying var to use it from the pixel shader
 	v_color = a_color;
 
+#ifdef USE_INSTANCING
+	v_instance_color = a_instance_color;
+#endif
+
 	//store the texture coordinates
 	v_uv = a_uv;
 
@@ -1,6 +1,11 @@
 #version 450 core
 
+#ifdef USE_INSTANCING
+in vec4 v_instance_color; //u_color of every instance
+#define u_color v_instance_color
+#else
 uniform vec4 u_color;
+#endif
 
 out vec4 FragColor;
 
@@ -17,11 +17,11 @@ uniform vec4 u_emission_color;
 uniform float u_emission_intensity;
 uniform int u_num_step;
 
-//LIGTH 
-uniform vec3 u_light_position;
-uniform vec4 u_light_color;
-uniform float u_light_intensity;
-uniform float u_light_shininess;
+//LIGHTS touching the volume box, in local space (see setVolumeLights in material.cpp)
+#define MAX_VOLUME_LIGHTS 16
+uniform int u_num_lights;
+uniform vec4 u_light_positions[MAX_VOLUME_LIGHTS]; //w = 0: xyz is the direction to the light (directional), w = 1: position
+uniform vec4 u_light_colors[MAX_VOLUME_LIGHTS]; //rgb * intensity, a = max distance
 
 uniform float u_step_length; //STEP LENGHT 
 
@@ -133,18 +133,34 @@ float sampleDensity(vec3 position) {
     return 0.0;
 }
 
+//TRANSMITTANCE FROM A SAMPLE TO THE LIGHT (or to the box exit)
+float lightTransmittance(vec3 sample_position, vec3 light_direction, float t_end) {
+    float step = t_end / float(max(u_num_step, 1));
+    float light_accumulated_optical_thickness = 0.0;
+    for (float t_light = 0.0; t_light < t_end; t_light += step) {
+        vec3 light_sample_position = sample_position + t_light * light_direction;                            //current position along the light 
+        float light_density = sampleDensity(light_sample_position);                                          //sample the density of the light 
+        float light_total_coefficient = (u_absorption_coefficient + u_scatter_coefficient) * light_density;  //the total coefficient (absorption + scatter) of the light 
+        light_accumulated_optical_thickness += light_total_coefficient * step;                               //accumulate optical thickness of the light 
+    }
+    return exp(-light_accumulated_optical_thickness);
+}
+
 //MAIN
 void main() {
 
     //initialize the ray 
     vec3 ray_origin = u_localcamera_position;
-    vec3 ray_direction = normalize(v_world_position - u_localcamera_position);
+    vec3 ray_direction = normalize(v_position - u_localcamera_position);
 
     //find the intersection with the auxiliarity mesh
     vec2 tHit = intersectAABB(ray_origin, ray_direction, u_box_min, u_box_max);
     float tb = tHit.y; //tmax
     float ta = tHit.x; //tmin
 
+    //the fragment is on the proxy hull, nothing to integrate between the box and it
+    ta = max(ta, dot(v_position - ray_origin, ray_direction));
+
     vec4 final_color = u_background;
     vec4 radiance = vec4(0.0);
 
@@ -176,43 +192,29 @@ void main() {
 
                 vec4 Le = u_emission_color * u_emission_intensity; //emitted radiance
 
-                //COMPUTATION OF THE Ls (IN-SCATTER COLOR)
-
-                vec3 light_direction = normalize(u_light_position - sample_position); //Calculate the direction from the current sample position to the light source.
-                float distance_light = length(u_light_position - sample_position); //Calculate the distance between the current sample and the light source
-                // Compute the cosine of the scattering angle
-                float cos_theta = dot(-ray_direction, light_direction);
-
-                // Henyey-Greenstein phase function formula
-                float fx = (1.0 - u_g * u_g) / (4.0 * 3.14159265359 * pow(1.0 + u_g * u_g - 2.0 * u_g * cos_theta, 1.5));
-
-                //initialize the optical thickness and transmittance of the light
-                float light_accumulated_optical_thickness = 0.0;
-
-                //Computed the Ray-Marching from the current sample position to the light source 
-                float t_light = 0.0;
-
-                vec2 tHit2 = intersectAABB(sample_position, light_direction, u_box_min, u_box_max);
-                float tb2 = tHit2.y; //tmax
-                float ta2 = tHit2.x; //tmin
-
-                float step = distance_light/u_num_step;
-
-                while (t_light < tb2) {
-                    vec3 light_sample_position = sample_position + t_light * light_direction;                            //current position along the light 
-                    float light_density = sampleDensity(light_sample_position);                                          //sample the density of the light 
-                    float light_total_coefficient = (u_absorption_coefficient + u_scatter_coefficient) * light_density;  //the total coefficient (absorption + scatter) of the light 
-
-                    light_accumulated_optical_thickness += (light_total_coefficient) * step;                               //accumulate optical thickness of the light 
-                    // light_transmittance *= exp(-light_total_coefficient * u_step_length);                                //trasmittance of the light
-
-                    t_light += step;                                                                            //update the step of the light
+                //COMPUTATION OF THE Ls (IN-SCATTER COLOR), sum of every light
+                vec4 Ls = vec4(0.0);
+                for (int i = 0; i < u_num_lights; ++i) {
+                    vec3 light_direction = normalize(u_light_positions[i].xyz);
+                    float distance_light = 1e10;
+                    if (u_light_positions[i].w != 0.0) {
+                        vec3 to_light = u_light_positions[i].xyz - sample_position;
+                        distance_light = length(to_light); //Calculate the distance between the current sample and the light source
+                        if (distance_light >= u_light_colors[i].a)
+                            continue; //too far, no need to march towards it
+                        light_direction = to_light / distance_light; //Calculate the direction from the current sample position to the light source.
+                    }
+                    float t_end = min(intersectAABB(sample_position, light_direction, u_box_min, u_box_max).y, distance_light);
+
+                    // Compute the cosine of the scattering angle
+                    float cos_theta = dot(-ray_direction, light_direction);
+
+                    // Henyey-Greenstein phase function formula
+                    float fx = (1.0 - u_g * u_g) / (4.0 * 3.14159265359 * pow(1.0 + u_g * u_g - 2.0 * u_g * cos_theta, 1.5));
+
+                    Ls += fx * lightTransmittance(sample_position, light_direction, t_end) * vec4(u_light_colors[i].rgb, 1.0); // Scatter radiance
                 }
 
-                float light_transmittance = exp(-light_accumulated_optical_thickness);
-
-                vec4 Ls = fx * light_transmittance * u_light_color * u_light_intensity; // Scatter radiance
-
                 //Riemann sum: integral of T(t', t) [coeff_t(t') * Le(t') + coeff_s(t) * Ls(t')]
                 radiance += ((Le * local_coefficient + local_scatter_coefficient * Ls) * accumulated_transmittance); 
                 
@@ -44,6 +44,17 @@ uniform vec3 u_box_max;
 uniform bool u_jittering; //0:don't use jittering, 1:use jittering
 uniform float u_threshold; //threshold 
 
+//DISTANCE FIELD (see DistanceField::bake), distance to the surface in local units, negative inside
+uniform bool u_use_distance_field;
+uniform sampler3D u_distance_texture;
+#define MAX_TRACE_STEPS 128
+#define HIT_DISTANCE 0.002
+#define REFINE_STEPS 6
+
+//REFINEMENT of the fixed step march, 0 keeps the first sample inside
+uniform int u_refine_steps;
+#define HIT_COLOR vec3(1.0, 0.0, 1.0)
+
 out vec4 FragColor; //FINAL COLOR 
 
 //FUNCTION TO KNOW THE INTERECTIONS 
@@ -143,12 +154,73 @@ float random (vec2 st) {
         43758.5453123);
 }
 
+//SECANT (regula falsi) between the last sample outside (a) and the first inside (b)
+float refineHit(vec3 ray_origin, vec3 ray_direction, float a, float b) {
+    float fa = sampleDensity(ray_origin + a * ray_direction) - u_threshold;
+    float fb = sampleDensity(ray_origin + b * ray_direction) - u_threshold;
+    for (int i = 0; i < u_refine_steps; ++i) {
+        float m = fb != fa ? a + (b - a) * fa / (fa - fb) : (a + b) * 0.5;
+        float fm = sampleDensity(ray_origin + m * ray_direction) - u_threshold;
+        if (fm > 0.0) {
+            b = m;
+            fb = fm;
+        }
+        else {
+            a = m;
+            fa = fm;
+        }
+    }
+    return fb != fa ? a + (b - a) * fa / (fa - fb) : b;
+}
+
+//SHADING with the normal from central differences of the density, lit from the camera
+vec4 shadeHit(vec3 position, vec3 ray_direction) {
+    float h = 0.01;
+    vec3 gradient = vec3(
+        sampleDensity(position + vec3(h, 0.0, 0.0)) - sampleDensity(position - vec3(h, 0.0, 0.0)),
+        sampleDensity(position + vec3(0.0, h, 0.0)) - sampleDensity(position - vec3(0.0, h, 0.0)),
+        sampleDensity(position + vec3(0.0, 0.0, h)) - sampleDensity(position - vec3(0.0, 0.0, h)));
+    vec3 normal = length(gradient) > 0.0 ? -normalize(gradient) : -ray_direction;
+    float diffuse = max(dot(normal, -ray_direction), 0.0);
+    return vec4(HIT_COLOR * (0.3 + 0.7 * diffuse), 1.0);
+}
+
+//SPHERE TRACING: every step is as long as the distance to the surface, the hit is refined with bisection on the density
+bool traceDistanceField(vec3 ray_origin, vec3 ray_direction, float ta, float tb, out float t_hit) {
+    float t = ta;
+    float t_prev = ta;
+    for (int i = 0; i < MAX_TRACE_STEPS && t < tb; ++i) {
+        vec3 sample_position = ray_origin + t * ray_direction;
+        float distance = texture(u_distance_texture, (sample_position + vec3(1.0)) / 2.0).r;
+        if (distance < HIT_DISTANCE) {
+            //the crossing is between the previous step and a bit after this one
+            float a = t_prev;
+            float b = min(t + 2.0 * HIT_DISTANCE, tb);
+            t_hit = t;
+            if (sampleDensity(ray_origin + b * ray_direction) > u_threshold) {
+                for (int j = 0; j < REFINE_STEPS; ++j) {
+                    float m = (a + b) * 0.5;
+                    if (sampleDensity(ray_origin + m * ray_direction) > u_threshold)
+                        b = m;
+                    else
+                        a = m;
+                }
+                t_hit = b;
+            }
+            return true;
+        }
+        t_prev = t;
+        t += max(distance, HIT_DISTANCE);
+    }
+    return false;
+}
+
 //MAIN
 void main() {
 
     //initialize the ray 
     vec3 ray_origin = u_localcamera_position;
-    vec3 ray_direction = normalize(v_world_position - u_localcamera_position);
+    vec3 ray_direction = normalize(v_position - u_localcamera_position);
 
     float jitterOffset = random(gl_FragCoord.xy);
 
@@ -159,6 +231,9 @@ void main() {
     float tb = tHit.y; //tmax
     float ta = tHit.x + jittered_ta; // tmin with jittered offset
 
+    //the fragment is on the proxy hull, nothing to cross between the box and it
+    ta = max(ta, dot(v_position - ray_origin, ray_direction) + jittered_ta);
+
     vec4 final_color = u_background;
     vec4 radiance = vec4(0.0);
 
@@ -171,8 +246,14 @@ void main() {
     
     } else if (u_volume_type != 0) {
         //float fx = 1/(4 * 3.14); //phase function (isotropic)
-        if (ta <= tb && tb > 0.0) {
+        if (ta <= tb && tb > 0.0 && u_use_distance_field) {
+            float t_hit;
+            if (traceDistanceField(ray_origin, ray_direction, max(ta, 0.0), tb, t_hit))
+                final_color = shadeHit(ray_origin + t_hit * ray_direction, ray_direction);
+        }
+        else if (ta <= tb && tb > 0.0) {
             float t = ta; //
+            float t_prev = ta; //last sample outside
             float accumulated_optical_thickness = 0.0; //T(0, tmax)
             float accumulated_transmittance = 1.0; 
 
@@ -182,10 +263,12 @@ void main() {
 
                 //if the density higher than threshold, paint
                 if (density > u_threshold) {
-                    final_color = vec4(1.0,0.0,1.0,1.0);
+                    float t_hit = u_refine_steps > 0 && t > ta ? refineHit(ray_origin, ray_direction, t_prev, t) : t;
+                    final_color = shadeHit(ray_origin + t_hit * ray_direction, ray_direction);
                     break;
                 }
                 
+                t_prev = t;
                 t += u_step_length; // update the t
             }
         }
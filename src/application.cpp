@@ -1,10 +1,16 @@
 #include "application.h"
+#include "framework/gpuprofiler.h"
+#include "framework/profiler.h"
+#include "graphics/glstate.h"
+#include "graphics/lightclusters.h"
 
 bool render_wireframe = false;
 Camera* Application::camera = nullptr;
 
 void Application::init(GLFWwindow* window)
 {
+    PROFILE_FUNCTION();
+
     this->instance = this;
     glfwGetFramebufferSize(window, &this->window_width, &this->window_height);
 
@@ -22,6 +28,11 @@ void Application::init(GLFWwindow* window)
 
     this->ambient_light = glm::vec4(0.89f, 0.93f, 0.95f, 1.f);
 
+    // Submit every shader the materials can switch to, the driver links them while the scene loads
+    const char* fragment_shaders[] = { "flat.fs", "basic.fs", "normal.fs", "absorption.fs", "absorption_emission.fs", "fullvolume.fs", "isosurface.fs" };
+    for (const char* fs : fragment_shaders)
+        Shader::Get("res/shaders/basic.vs", (std::string("res/shaders/") + fs).c_str());
+
     /* ADD NODES TO THE SCENE */
     //SceneNode* example = new SceneNode();
     //example->mesh = Mesh::Get("res/meshes/sphere.obj");
@@ -29,7 +40,7 @@ void Application::init(GLFWwindow* window)
     //this->node_list.push_back(example);
 
     VolumeNode* bunny_vol = new VolumeNode();
-    bunny_vol->model = glm::mat4(glm::vec4(1.0, 0.0, 0.0, 0.0), glm::vec4(1.0, 0.0, 0.0, 0.0), glm::vec4(1.0, 0.0, 0.0, 0.0), glm::vec4(2.0, 0.0, 0.0, 0.0));
+    TransformSystem::setPosition(bunny_vol->transform, glm::vec3(2.f, 0.f, 0.f));
     bunny_vol->mesh = Mesh::Get("res/meshes/cube.obj");
     bunny_vol->material = new VolumeMaterial();
     dynamic_cast<VolumeMaterial*>(bunny_vol->material)->loadVDB("res/volumes/bunny_cloud.vdb");
@@ -51,6 +62,8 @@ void Application::init(GLFWwindow* window)
 
 void Application::update(float dt)
 {
+    PROFILE_FUNCTION();
+
     // mouse update
     glm::vec2 delta = this->lastMousePosition - this->mousePosition;
     if (this->dragging) {
@@ -61,27 +74,48 @@ void Application::update(float dt)
 
 void Application::render()
 {
+    PROFILE_FUNCTION();
+
     // set the clear color (the background color)
     glClearColor(this->ambient_light.x, this->ambient_light.y, this->ambient_light.z, 1.0);
 
     // Clear the window and the depth buffer
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    // ImGui changed the state after the last frame, start with an empty cache
+    GLState::invalidate();
+
     // set flags
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
+    GLState::setEnabled(GL_DEPTH_TEST, true);
+    GLState::setEnabled(GL_CULL_FACE, true);
 
-    
+    // world matrices of the nodes that moved (and their children)
+    TransformSystem::update();
 
-    for (unsigned int i = 0; i < this->node_list.size(); i++)
-    {
-        this->node_list[i]->render(this->camera);
+    // lights of every froxel for the single pass materials
+    LightClusters::update(this->camera, this->light_list);
 
-        if (this->flag_wireframe) this->node_list[i]->renderWireframe(this->camera);
+    // only the nodes touching the frustum are sent to the queue
+    this->scene_culler.update(this->node_list);
+    this->scene_culler.cull(this->camera, this->node_list, this->visible_nodes);
+
+    // nodes sharing mesh and material are drawn with a single instanced call
+    this->render_queue.clear();
+    for (unsigned int i = 0; i < this->visible_nodes.size(); i++)
+        this->render_queue.add(this->visible_nodes[i]);
+    this->render_queue.render(this->camera);
+
+    if (this->flag_wireframe) {
+        GPU_PROFILE_SCOPE("Wireframe");
+        for (unsigned int i = 0; i < this->visible_nodes.size(); i++)
+            this->visible_nodes[i]->renderWireframe(this->camera);
     }
 
     // Draw the floor grid
-    if (this->flag_grid) drawGrid();
+    if (this->flag_grid) {
+        GPU_PROFILE_SCOPE("Grid");
+        drawGrid();
+    }
 }
 
 void Application::renderGUI()
@@ -95,6 +129,27 @@ void Application::renderGUI()
             ImGui::TreePop();
         }
 
+        if (ImGui::TreeNode("Render queue")) {
+            this->render_queue.renderInMenu();
+            GLState::renderInMenu();
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Lighting")) {
+            LightClusters::renderInMenu();
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Transforms")) {
+            TransformSystem::renderInMenu();
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Culling")) {
+            this->scene_culler.renderInMenu();
+            ImGui::TreePop();
+        }
+
         unsigned int count = 0;
         std::stringstream ss;
         for (auto& node : this->node_list) {
@@ -5,6 +5,8 @@
 #include "framework/scenenode.h"
 #include "framework/light.h"
 #include "graphics/material.h"
+#include "graphics/renderqueue.h"
+#include "framework/culling.h"
 
 #include <glm/vec2.hpp>
 
@@ -18,6 +20,9 @@ public:
 	glm::vec4 ambient_light;
 	//glm::vec4 background_color;
 	std::vector<Light*> light_list;
+	RenderQueue render_queue; //rebuilt every frame from node_list
+	SceneCuller scene_culler;
+	std::vector<SceneNode*> visible_nodes; //nodes of node_list touching the frustum
 
 
 	int window_width;
@@ -0,0 +1,331 @@
+#include "aabbtree.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include <glm/common.hpp>
+
+#include "camera.h"
+#include "workqueue.h"
+#include "profiler.h"
+
+float AABBTree::margin = 0.1f;
+
+//cost of a box for the insertion heuristic
+static float getArea(const glm::vec3& box_min, const glm::vec3& box_max)
+{
+	glm::vec3 size = box_max - box_min;
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static void setUnion(AABBTree::sNode& node, const AABBTree::sNode& a, const AABBTree::sNode& b)
+{
+	node.box_min = glm::min(a.box_min, b.box_min);
+	node.box_max = glm::max(a.box_max, b.box_max);
+}
+
+int AABBTree::allocateNode()
+{
+	int id = free_list;
+	if (id == -1)
+	{
+		id = (int)nodes.size();
+		nodes.push_back(sNode());
+	}
+	else
+		free_list = nodes[id].parent;
+
+	sNode& node = nodes[id];
+	node.parent = node.child1 = node.child2 = -1;
+	node.height = 0;
+	node.data = NULL;
+	return id;
+}
+
+void AABBTree::freeNode(int id)
+{
+	nodes[id].parent = free_list;
+	nodes[id].height = -1;
+	nodes[id].data = NULL;
+	free_list = id;
+}
+
+int AABBTree::insert(const glm::vec3& box_min, const glm::vec3& box_max, void* data)
+{
+	int leaf = allocateNode();
+	sNode& node = nodes[leaf];
+	node.box_min = box_min - glm::vec3(margin);
+	node.box_max = box_max + glm::vec3(margin);
+	node.data = data;
+	insertLeaf(leaf);
+	num_leaves++;
+	return leaf;
+}
+
+void AABBTree::remove(int leaf)
+{
+	assert(isLeaf(leaf));
+	removeLeaf(leaf);
+	freeNode(leaf);
+	num_leaves--;
+}
+
+bool AABBTree::move(int leaf, const glm::vec3& box_min, const glm::vec3& box_max)
+{
+	assert(isLeaf(leaf));
+	sNode& node = nodes[leaf];
+	if (box_min.x >= node.box_min.x && box_min.y >= node.box_min.y && box_min.z >= node.box_min.z &&
+		box_max.x <= node.box_max.x && box_max.y <= node.box_max.y && box_max.z <= node.box_max.z)
+		return false; //still inside its fat box
+
+	removeLeaf(leaf);
+	nodes[leaf].box_min = box_min - glm::vec3(margin);
+	nodes[leaf].box_max = box_max + glm::vec3(margin);
+	insertLeaf(leaf);
+	return true;
+}
+
+void AABBTree::clear()
+{
+	nodes.clear();
+	root = -1;
+	free_list = -1;
+	num_leaves = 0;
+}
+
+void AABBTree::insertLeaf(int leaf)
+{
+	if (root == -1)
+	{
+		root = leaf;
+		nodes[leaf].parent = -1;
+		return;
+	}
+
+	//go down to the sibling that grows the total area the least (surface area heuristic)
+	glm::vec3 leaf_min = nodes[leaf].box_min;
+	glm::vec3 leaf_max = nodes[leaf].box_max;
+	int index = root;
+	while (!nodes[index].isLeaf())
+	{
+		const sNode& node = nodes[index];
+		float area = getArea(node.box_min, node.box_max);
+		float combined_area = getArea(glm::min(node.box_min, leaf_min), glm::max(node.box_max, leaf_max));
+
+		float cost = 2.0f * combined_area; //new parent for this node and the leaf
+		float inheritance_cost = 2.0f * (combined_area - area); //minimum cost of going down
+
+		float child_costs[2];
+		int children[2] = { node.child1, node.child2 };
+		for (int i = 0; i < 2; ++i)
+		{
+			const sNode& child = nodes[children[i]];
+			float child_area = getArea(glm::min(child.box_min, leaf_min), glm::max(child.box_max, leaf_max));
+			child_costs[i] = (child.isLeaf() ? child_area : child_area - getArea(child.box_min, child.box_max)) + inheritance_cost;
+		}
+
+		if (cost < child_costs[0] && cost < child_costs[1])
+			break;
+		index = child_costs[0] < child_costs[1] ? children[0] : children[1];
+	}
+
+	//new parent for the sibling and the leaf (allocating may move the nodes, only indices from here)
+	int sibling = index;
+	int old_parent = nodes[sibling].parent;
+	int new_parent = allocateNode();
+	nodes[new_parent].parent = old_parent;
+	nodes[new_parent].height = nodes[sibling].height + 1;
+	setUnion(nodes[new_parent], nodes[leaf], nodes[sibling]);
+
+	if (old_parent != -1)
+	{
+		if (nodes[old_parent].child1 == sibling)
+			nodes[old_parent].child1 = new_parent;
+		else
+			nodes[old_parent].child2 = new_parent;
+	}
+	else
+		root = new_parent;
+
+	nodes[new_parent].child1 = sibling;
+	nodes[new_parent].child2 = leaf;
+	nodes[sibling].parent = new_parent;
+	nodes[leaf].parent = new_parent;
+
+	refit(nodes[leaf].parent);
+}
+
+void AABBTree::removeLeaf(int leaf)
+{
+	if (leaf == root)
+	{
+		root = -1;
+		return;
+	}
+
+	int parent = nodes[leaf].parent;
+	int grand_parent = nodes[parent].parent;
+	int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+	//the sibling takes the place of the parent
+	if (grand_parent != -1)
+	{
+		if (nodes[grand_parent].child1 == parent)
+			nodes[grand_parent].child1 = sibling;
+		else
+			nodes[grand_parent].child2 = sibling;
+		nodes[sibling].parent = grand_parent;
+		freeNode(parent);
+		refit(grand_parent);
+	}
+	else
+	{
+		root = sibling;
+		nodes[sibling].parent = -1;
+		freeNode(parent);
+	}
+}
+
+void AABBTree::refit(int id)
+{
+	while (id != -1)
+	{
+		id = balance(id);
+		sNode& node = nodes[id];
+		node.height = 1 + std::max(nodes[node.child1].height, nodes[node.child2].height);
+		setUnion(node, nodes[node.child1], nodes[node.child2]);
+		id = node.parent;
+	}
+}
+
+//if a child is more than one level taller than the other it is rotated up, returns the node now in the place of id
+int AABBTree::balance(int id_a)
+{
+	sNode& a = nodes[id_a];
+	if (a.isLeaf() || a.height < 2)
+		return id_a;
+
+	int id_b = a.child1;
+	int id_c = a.child2;
+	sNode& b = nodes[id_b];
+	sNode& c = nodes[id_c];
+	int difference = c.height - b.height;
+	if (difference >= -1 && difference <= 1)
+		return id_a;
+
+	//the tall child goes up, a takes its shortest grandchild
+	int id_up = difference > 1 ? id_c : id_b;
+	sNode& up = nodes[id_up];
+	sNode& other = difference > 1 ? b : c;
+	int id_f = up.child1;
+	int id_g = up.child2;
+	sNode& f = nodes[id_f];
+	sNode& g = nodes[id_g];
+
+	up.child1 = id_a;
+	up.parent = a.parent;
+	a.parent = id_up;
+	if (up.parent != -1)
+	{
+		if (nodes[up.parent].child1 == id_a)
+			nodes[up.parent].child1 = id_up;
+		else
+			nodes[up.parent].child2 = id_up;
+	}
+	else
+		root = id_up;
+
+	int id_keep = f.height > g.height ? id_f : id_g; //stays under up
+	int id_move = f.height > g.height ? id_g : id_f; //goes under a
+	up.child2 = id_keep;
+	if (difference > 1)
+		a.child2 = id_move;
+	else
+		a.child1 = id_move;
+	nodes[id_move].parent = id_a;
+
+	setUnion(a, other, nodes[id_move]);
+	setUnion(up, a, nodes[id_keep]);
+	a.height = 1 + std::max(other.height, nodes[id_move].height);
+	up.height = 1 + std::max(a.height, nodes[id_keep].height);
+	return id_up;
+}
+
+void AABBTree::queryFrustum(const Camera* camera, int start, bool inside, std::vector<void*>& result) const
+{
+	//inside: the parent was completely inside, no need to test anything below
+	std::vector<std::pair<int, bool>> stack;
+	stack.push_back({ start, inside });
+	while (!stack.empty())
+	{
+		int id = stack.back().first;
+		bool node_inside = stack.back().second;
+		stack.pop_back();
+
+		const sNode& node = nodes[id];
+		if (!node_inside)
+		{
+			eClipResult clip = camera->testBoxInFrustum(node.box_min, node.box_max);
+			if (clip == CLIP_OUTSIDE)
+				continue;
+			node_inside = clip == CLIP_INSIDE;
+		}
+
+		if (node.isLeaf())
+			result.push_back(node.data);
+		else
+		{
+			stack.push_back({ node.child2, node_inside });
+			stack.push_back({ node.child1, node_inside });
+		}
+	}
+}
+
+void AABBTree::queryFrustum(const Camera* camera, std::vector<void*>& result, bool multithread) const
+{
+	PROFILE_FUNCTION();
+
+	if (root == -1)
+		return;
+
+	int num_tasks = multithread ? WorkQueue::getNumThreads() * 4 : 0;
+	if (num_tasks <= 1 || num_leaves < 1024)
+	{
+		queryFrustum(camera, root, false, result);
+		return;
+	}
+
+	//the top of the tree is tested here until there are enough subtrees for the workers
+	std::vector<std::pair<int, bool>> subtrees;
+	subtrees.push_back({ root, false });
+	for (size_t i = 0; i < subtrees.size() && (int)subtrees.size() < num_tasks;)
+	{
+		int id = subtrees[i].first;
+		bool inside = subtrees[i].second;
+		const sNode& node = nodes[id];
+		if (node.isLeaf())
+		{
+			++i;
+			continue;
+		}
+		if (!inside)
+		{
+			eClipResult clip = camera->testBoxInFrustum(node.box_min, node.box_max);
+			if (clip == CLIP_OUTSIDE)
+			{
+				subtrees.erase(subtrees.begin() + i);
+				continue;
+			}
+			inside = clip == CLIP_INSIDE;
+		}
+		subtrees[i] = { node.child1, inside };
+		subtrees.push_back({ node.child2, inside });
+	}
+
+	std::vector<std::vector<void*>> results(subtrees.size());
+	WorkQueue::parallelFor((int)subtrees.size(), [&](int i) {
+		queryFrustum(camera, subtrees[i].first, subtrees[i].second, results[i]);
+	});
+	for (const std::vector<void*>& partial : results)
+		result.insert(result.end(), partial.begin(), partial.end());
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+class Camera;
+
+//dynamic bounding volume hierarchy, leaves can be inserted, removed and moved at any time and the tree
+//is kept balanced with rotations. The leaves store a box a bit bigger (margin) than the one given,
+//objects that move inside it don't touch the tree
+class AABBTree
+{
+public:
+	struct sNode
+	{
+		glm::vec3 box_min;
+		glm::vec3 box_max;
+		int parent; //next free node when it is in the free list
+		int child1;
+		int child2; //-1 in the leaves
+		int height; //0 in the leaves, -1 if free
+		void* data;
+
+		bool isLeaf() const { return child1 == -1; }
+	};
+
+	static float margin;
+
+	std::vector<sNode> nodes;
+	int root = -1;
+	int free_list = -1;
+	int num_leaves = 0;
+
+	int insert(const glm::vec3& box_min, const glm::vec3& box_max, void* data); //returns the id of the leaf
+	void remove(int leaf);
+	bool move(int leaf, const glm::vec3& box_min, const glm::vec3& box_max); //true if it had to be reinserted
+	void clear();
+
+	bool isLeaf(int id) const { return id >= 0 && id < (int)nodes.size() && nodes[id].height == 0; }
+	int getHeight() const { return root == -1 ? 0 : nodes[root].height; }
+
+	//appends the data of the leaves that touch the frustum of the camera, the subtrees are split between the workers if multithread
+	void queryFrustum(const Camera* camera, std::vector<void*>& result, bool multithread = false) const;
+
+private:
+	int allocateNode();
+	void freeNode(int id);
+	void insertLeaf(int leaf);
+	void removeLeaf(int leaf);
+	int balance(int id);
+	void refit(int id); //from this node to the root
+	void queryFrustum(const Camera* camera, int start, bool inside, std::vector<void*>& result) const;
+};
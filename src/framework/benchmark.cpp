@@ -0,0 +1,166 @@
+#include "benchmark.h"
+
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cmath>
+
+#include "includes.h"
+#include "profiler.h"
+#include "workqueue.h"
+#include "../application.h"
+#include "../graphics/fbo.h"
+#include "../graphics/shader.h"
+#include "../graphics/streambuffer.h"
+
+#include <glm/gtx/transform.hpp>
+
+#define BENCHMARK_DT (1.0f / 60.0f) //fixed step so every run updates the same way
+
+int Benchmark::num_frames = 600;
+int Benchmark::warmup_frames = 30;
+int Benchmark::width = 1600;
+int Benchmark::height = 900;
+std::string Benchmark::output_filename = "benchmark.json";
+
+struct sBenchmarkStats
+{
+	double min, median, p99, mean, max;
+
+	void compute(std::vector<double> values)
+	{
+		min = median = p99 = mean = max = 0.0;
+		if (values.empty())
+			return;
+		std::sort(values.begin(), values.end());
+		size_t n = values.size();
+		min = values[0];
+		max = values[n - 1];
+		median = values[n / 2];
+		p99 = values[std::min(n - 1, (size_t)std::ceil(0.99 * n) - 1)];
+		for (double v : values)
+			mean += v;
+		mean /= n;
+	}
+
+	void write(std::ofstream& file, const char* name) const
+	{
+		file << "\t\"" << name << "\": { \"min\": " << min << ", \"median\": " << median << ", \"p99\": " << p99
+			<< ", \"mean\": " << mean << ", \"max\": " << max << " },\n";
+	}
+};
+
+bool Benchmark::run(Application* app)
+{
+	FBO fbo;
+	if (!fbo.create(width, height))
+		return false;
+
+	bool gpu_timers = glfwExtensionSupported("GL_ARB_timer_query");
+	if (!gpu_timers)
+		std::cout << "[WARN] GL_ARB_timer_query not supported, only CPU times will be measured" << std::endl;
+
+	std::vector<GLuint> queries;
+	if (gpu_timers) {
+		queries.resize(num_frames * 2);
+		glGenQueries((GLsizei)queries.size(), queries.data());
+	}
+
+	std::vector<double> cpu_ms(num_frames);
+	std::vector<double> gpu_ms;
+
+	//the orbit starts where the application placed the camera
+	Camera* camera = app->camera;
+	glm::vec3 center = camera->center;
+	glm::vec3 up = camera->up;
+	glm::vec3 offset = camera->eye - center;
+	camera->setAspectRatio(width / (float)height);
+	camera->updateProjectionMatrix();
+	app->window_width = width;
+	app->window_height = height;
+
+	std::cout << "[INFO] Benchmark: " << warmup_frames << " warmup + " << num_frames << " frames at " << width << "x" << height << std::endl;
+
+	fbo.bind();
+	for (int i = 0; i < warmup_frames + num_frames; ++i)
+	{
+		int frame = i - warmup_frames; //negative while warming up
+
+		float angle = frame > 0 ? 2.0f * 3.14159265359f * frame / num_frames : 0.0f;
+		camera->lookAt(center + glm::vec3(glm::rotate(angle, up) * glm::vec4(offset, 0.0f)), center, up);
+
+		if (frame >= 0 && gpu_timers)
+			glQueryCounter(queries[frame * 2], GL_TIMESTAMP);
+		uint64_t start_ns = Profiler::getTimeNs();
+
+		{
+			PROFILE_SCOPE("Frame");
+			app->update(BENCHMARK_DT);
+			WorkQueue::flushMainThread();
+			Shader::UpdatePending();
+			app->render();
+		}
+
+		uint64_t end_ns = Profiler::getTimeNs();
+		if (frame >= 0) {
+			cpu_ms[frame] = (end_ns - start_ns) * 1e-6;
+			if (gpu_timers)
+				glQueryCounter(queries[frame * 2 + 1], GL_TIMESTAMP);
+		}
+
+		glFlush(); //what the swap would do
+		StreamBuffer::endFrame();
+	}
+	fbo.unbind();
+	glFinish();
+
+	//read the queries at the end so the measured frames never wait for the GPU
+	if (gpu_timers) {
+		gpu_ms.resize(num_frames);
+		for (int i = 0; i < num_frames; ++i)
+		{
+			GLuint64 begin_time = 0, end_time = 0;
+			glGetQueryObjectui64v(queries[i * 2], GL_QUERY_RESULT, &begin_time);
+			glGetQueryObjectui64v(queries[i * 2 + 1], GL_QUERY_RESULT, &end_time);
+			gpu_ms[i] = (end_time - begin_time) * 1e-6;
+		}
+		glDeleteQueries((GLsizei)queries.size(), queries.data());
+	}
+
+	sBenchmarkStats cpu_stats, gpu_stats;
+	cpu_stats.compute(cpu_ms);
+	gpu_stats.compute(gpu_ms);
+
+	std::ofstream file(output_filename);
+	if (!file.is_open()) {
+		std::cout << "[ERROR] Cannot write benchmark results to " << output_filename << std::endl;
+		return false;
+	}
+
+	file << "{\n";
+	file << "\t\"renderer\": \"" << (const char*)glGetString(GL_RENDERER) << "\",\n";
+	file << "\t\"version\": \"" << (const char*)glGetString(GL_VERSION) << "\",\n";
+	file << "\t\"width\": " << width << ",\n";
+	file << "\t\"height\": " << height << ",\n";
+	file << "\t\"warmup_frames\": " << warmup_frames << ",\n";
+	file << "\t\"frames\": " << num_frames << ",\n";
+	cpu_stats.write(file, "cpu_ms");
+	if (gpu_timers)
+		gpu_stats.write(file, "gpu_ms");
+	file << "\t\"frame_times\": [\n";
+	for (int i = 0; i < num_frames; ++i)
+	{
+		file << "\t\t{ \"cpu_ms\": " << cpu_ms[i];
+		if (gpu_timers)
+			file << ", \"gpu_ms\": " << gpu_ms[i];
+		file << " }" << (i + 1 < num_frames ? ",\n" : "\n");
+	}
+	file << "\t]\n}\n";
+
+	std::cout << "[INFO] Benchmark CPU ms: min " << cpu_stats.min << " median " << cpu_stats.median << " p99 " << cpu_stats.p99 << std::endl;
+	if (gpu_timers)
+		std::cout << "[INFO] Benchmark GPU ms: min " << gpu_stats.min << " median " << gpu_stats.median << " p99 " << gpu_stats.p99 << std::endl;
+	std::cout << "[INFO] Benchmark results saved in " << output_filename << std::endl;
+	return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+
+class Application;
+
+//renders a fixed number of frames offscreen while the camera orbits the scene (no input, no vsync, no GUI)
+//the CPU and GPU time of every frame is saved in a json with the min/median/p99 so runs can be compared
+class Benchmark
+{
+public:
+	static int num_frames; //measured frames, the camera does a full turn
+	static int warmup_frames; //rendered before measuring
+	static int width;
+	static int height;
+	static std::string output_filename;
+
+	static bool run(Application* app);
+};
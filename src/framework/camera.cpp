@@ -235,6 +235,46 @@ void Camera::updateProjectionMatrix()
 void Camera::updateViewProjectionMatrix()
 {
 	viewprojection_matrix = projection_matrix * view_matrix;
+	extractFrustumPlanes();
+}
+
+// Gribb-Hartmann: every plane is the sum or difference of the last row of the matrix and one of the others
+void Camera::extractFrustumPlanes()
+{
+	const glm::mat4& m = viewprojection_matrix;
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	frustum_planes[0] = row3 + row0; // left
+	frustum_planes[1] = row3 - row0; // right
+	frustum_planes[2] = row3 + row1; // bottom
+	frustum_planes[3] = row3 - row1; // top
+	frustum_planes[4] = row3 + row2; // near
+	frustum_planes[5] = row3 - row2; // far
+
+	for (int i = 0; i < 6; ++i)
+		frustum_planes[i] /= glm::length(glm::vec3(frustum_planes[i]));
+}
+
+eClipResult Camera::testBoxInFrustum(const glm::vec3& box_min, const glm::vec3& box_max) const
+{
+	glm::vec3 center = (box_min + box_max) * 0.5f;
+	glm::vec3 halfsize = (box_max - box_min) * 0.5f;
+
+	eClipResult result = CLIP_INSIDE;
+	for (int i = 0; i < 6; ++i)
+	{
+		const glm::vec4& plane = frustum_planes[i];
+		float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+		float extent = glm::dot(glm::abs(glm::vec3(plane)), halfsize); // projection of the box on the normal
+		if (distance < -extent)
+			return CLIP_OUTSIDE;
+		if (distance < extent)
+			result = CLIP_INTERSECT;
+	}
+	return result;
 }
 
 glm::mat4 Camera::getViewProjectionMatrix()
@@ -6,6 +6,8 @@
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtx/transform.hpp>
 
+enum eClipResult { CLIP_OUTSIDE, CLIP_INTERSECT, CLIP_INSIDE };
+
 class Camera
 {
 public:
@@ -36,6 +38,9 @@ public:
 	glm::mat4 projection_matrix;
 	glm::mat4 viewprojection_matrix;
 
+	// Planes of the frustum in world space (normal pointing inside, normalized), updated with the viewprojection
+	glm::vec4 frustum_planes[6];
+
 	Camera();
 
 	// Setters
@@ -68,5 +73,9 @@ public:
 
 	glm::mat4 getViewProjectionMatrix();
 
+	// Frustum culling
+	void extractFrustumPlanes();
+	eClipResult testBoxInFrustum(const glm::vec3& box_min, const glm::vec3& box_max) const;
+
 	void renderInMenu();
 };
\ No newline at end of file
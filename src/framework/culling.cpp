@@ -0,0 +1,113 @@
+#include "culling.h"
+
+#include "scenenode.h"
+#include "camera.h"
+#include "workqueue.h"
+#include "profiler.h"
+#include "includes.h"
+
+#define CULLING_CHUNK_SIZE 512 //nodes per job when computing the bounds
+
+bool SceneCuller::enabled = true;
+bool SceneCuller::multithread = true;
+
+void SceneCuller::update(const std::vector<SceneNode*>& nodes)
+{
+	PROFILE_FUNCTION();
+
+	int count = (int)nodes.size();
+	world_min.resize(count);
+	world_max.resize(count);
+	has_bounds.resize(count);
+
+	//world bounds of every node, the models may have changed anywhere
+	auto computeBounds = [&](int chunk) {
+		int end = std::min(count, (chunk + 1) * CULLING_CHUNK_SIZE);
+		for (int i = chunk * CULLING_CHUNK_SIZE; i < end; ++i)
+		{
+			SceneNode* node = nodes[i];
+			node->in_frustum = false;
+			has_bounds[i] = node->mesh && !node->mesh->loading && !node->mesh->load_failed;
+			if (!has_bounds[i])
+				continue;
+			BoundingBox box = transformBoundingBox(node->getModel(), node->mesh->box);
+			world_min[i] = box.center - box.halfsize;
+			world_max[i] = box.center + box.halfsize;
+		}
+	};
+	int num_chunks = (count + CULLING_CHUNK_SIZE - 1) / CULLING_CHUNK_SIZE;
+	if (multithread && num_chunks > 1)
+		WorkQueue::parallelFor(num_chunks, computeBounds);
+	else
+		for (int i = 0; i < num_chunks; ++i)
+			computeBounds(i);
+
+	//the tree is only touched by the nodes that left their fat box
+	alive.assign(tree.nodes.size(), 0);
+	for (int i = 0; i < count; ++i)
+	{
+		SceneNode* node = nodes[i];
+		int proxy = node->cull_proxy;
+		bool in_tree = tree.isLeaf(proxy) && tree.nodes[proxy].data == node;
+		if (!has_bounds[i])
+		{
+			if (in_tree)
+				tree.remove(proxy);
+			node->cull_proxy = -1;
+			continue;
+		}
+
+		if (in_tree)
+			tree.move(proxy, world_min[i], world_max[i]);
+		else
+			node->cull_proxy = proxy = tree.insert(world_min[i], world_max[i], node);
+		if (proxy >= (int)alive.size())
+			alive.resize(proxy + 1, 0);
+		alive[proxy] = 1;
+	}
+
+	//nodes removed from the list
+	for (int id = 0; id < (int)alive.size(); ++id)
+		if (!alive[id] && tree.isLeaf(id))
+			tree.remove(id);
+}
+
+void SceneCuller::cull(Camera* camera, const std::vector<SceneNode*>& nodes, std::vector<SceneNode*>& visible)
+{
+	PROFILE_FUNCTION();
+
+	visible.clear();
+	if (!enabled)
+	{
+		visible = nodes;
+		num_visible = (int)nodes.size();
+		num_culled = 0;
+		return;
+	}
+
+	query_result.clear();
+	tree.queryFrustum(camera, query_result, multithread);
+	for (void* data : query_result)
+		((SceneNode*)data)->in_frustum = true;
+
+	num_culled = 0;
+	for (int i = 0; i < (int)nodes.size(); ++i)
+	{
+		if (has_bounds[i] && !nodes[i]->in_frustum)
+		{
+			num_culled++;
+			continue;
+		}
+		nodes[i]->in_frustum = true;
+		visible.push_back(nodes[i]);
+	}
+	num_visible = (int)visible.size();
+}
+
+void SceneCuller::renderInMenu()
+{
+	ImGui::Checkbox("Frustum culling", &enabled);
+	ImGui::Checkbox("Multithread", &multithread);
+	ImGui::Text("%d visible, %d culled", num_visible, num_culled);
+	ImGui::Text("Tree: %d leaves, height %d", tree.num_leaves, tree.getHeight());
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+
+#include "aabbtree.h"
+
+class SceneNode;
+class Camera;
+
+//keeps the world bounds of the nodes in an AABBTree and returns the ones that touch the camera frustum
+//nodes without bounds (no mesh or still loading) are always visible
+class SceneCuller
+{
+public:
+	static bool enabled;
+	static bool multithread; //bounds and tree query in the workers
+
+	AABBTree tree;
+
+	//stats of the last cull
+	int num_visible = 0;
+	int num_culled = 0;
+
+	void update(const std::vector<SceneNode*>& nodes); //call it after moving the nodes, before cull
+	void cull(Camera* camera, const std::vector<SceneNode*>& nodes, std::vector<SceneNode*>& visible); //keeps the order of nodes
+	void renderInMenu();
+
+private:
+	std::vector<glm::vec3> world_min;
+	std::vector<glm::vec3> world_max;
+	std::vector<char> has_bounds;
+	std::vector<char> alive; //by tree node, the leaves not found in the list are removed
+	std::vector<void*> query_result;
+};
@@ -0,0 +1,191 @@
+#include "filewatcher.h"
+
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <filesystem>
+#include <iostream>
+
+#ifdef __linux__
+	#include <sys/inotify.h>
+	#include <unistd.h>
+	#include <limits.h>
+#endif
+
+#include "includes.h"
+
+bool FileWatcher::enabled = true;
+
+struct sWatchedFile
+{
+	std::string path; //absolute, to match the inotify events
+	void* owner;
+	FileWatcher::Callback callback;
+	std::filesystem::file_time_type last_write; //only used when polling
+	unsigned int version;
+};
+
+static std::vector<sWatchedFile> s_files;
+static unsigned int s_version_counter = 0;
+static std::mutex s_files_mutex; //owners can be destroyed in workers (e.g. meshes that failed to load)
+
+static std::string absolutePath(const std::string& filename)
+{
+	std::error_code error;
+	std::filesystem::path path = std::filesystem::weakly_canonical(std::filesystem::absolute(filename, error), error);
+	return path.lexically_normal().string();
+}
+
+#ifdef __linux__
+
+//inotify watches folders, editors usually save by writing a new file and renaming it
+//only finished files count, IN_CREATE would fire before the new file has any content
+static int s_inotify_fd = -1;
+static std::map<int, std::string> s_watched_folders; //watch descriptor -> folder
+
+static void watchFolder(const std::string& folder)
+{
+	for (auto& it : s_watched_folders)
+		if (it.second == folder)
+			return;
+
+	if (s_inotify_fd == -1)
+	{
+		s_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (s_inotify_fd == -1)
+		{
+			std::cout << "[ERROR] inotify not available, files wont be reloaded" << std::endl;
+			return;
+		}
+	}
+
+	int wd = inotify_add_watch(s_inotify_fd, folder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (wd == -1)
+	{
+		std::cout << "[ERROR] cannot watch folder: " << folder << std::endl;
+		return;
+	}
+	s_watched_folders[wd] = folder;
+}
+
+static void getChangedFiles(std::set<std::string>& changed)
+{
+	if (s_inotify_fd == -1)
+		return;
+
+	alignas(inotify_event) char buffer[4096];
+	while (true)
+	{
+		ssize_t len = read(s_inotify_fd, buffer, sizeof(buffer));
+		if (len <= 0) //EAGAIN, nothing else pending
+			break;
+
+		for (char* ptr = buffer; ptr < buffer + len; )
+		{
+			inotify_event* event = (inotify_event*)ptr;
+			auto it = s_watched_folders.find(event->wd);
+			if (event->len && it != s_watched_folders.end())
+				changed.insert((std::filesystem::path(it->second) / event->name).string());
+			ptr += sizeof(inotify_event) + event->len;
+		}
+	}
+}
+
+#else
+
+static double s_last_poll = 0;
+
+static std::filesystem::file_time_type getLastWriteTime(const std::string& path)
+{
+	std::error_code error;
+	return std::filesystem::last_write_time(path, error);
+}
+
+static void getChangedFiles(std::set<std::string>& changed)
+{
+	//no need to check the disk every frame
+	double now = glfwGetTime();
+	if (now - s_last_poll < 0.5)
+		return;
+	s_last_poll = now;
+
+	for (size_t i = 0; i < s_files.size(); ++i)
+	{
+		sWatchedFile& file = s_files[i];
+		std::filesystem::file_time_type time = getLastWriteTime(file.path);
+		if (time == file.last_write)
+			continue;
+		file.last_write = time;
+		changed.insert(file.path);
+	}
+}
+
+#endif
+
+void FileWatcher::watch(const std::string& filename, void* owner, Callback callback)
+{
+	std::string path = absolutePath(filename);
+	std::lock_guard<std::mutex> lock(s_files_mutex);
+	for (size_t i = 0; i < s_files.size(); ++i)
+		if (s_files[i].path == path && s_files[i].owner == owner)
+			return;
+
+	sWatchedFile file;
+	file.path = path;
+	file.owner = owner;
+	file.callback = callback;
+	file.version = ++s_version_counter;
+#ifdef __linux__
+	watchFolder(std::filesystem::path(path).parent_path().string());
+#else
+	file.last_write = getLastWriteTime(path);
+#endif
+	s_files.push_back(file);
+}
+
+void FileWatcher::unwatch(void* owner)
+{
+	std::lock_guard<std::mutex> lock(s_files_mutex);
+	for (size_t i = 0; i < s_files.size();)
+	{
+		if (s_files[i].owner == owner)
+			s_files.erase(s_files.begin() + i);
+		else
+			++i;
+	}
+}
+
+unsigned int FileWatcher::getVersion(const std::string& filename, void* owner)
+{
+	std::string path = absolutePath(filename);
+	std::lock_guard<std::mutex> lock(s_files_mutex);
+	for (size_t i = 0; i < s_files.size(); ++i)
+		if (s_files[i].path == path && s_files[i].owner == owner)
+			return s_files[i].version;
+	return 0;
+}
+
+void FileWatcher::update()
+{
+	//copy them first, the callbacks can watch new files
+	std::vector<Callback> callbacks;
+	{
+		std::lock_guard<std::mutex> lock(s_files_mutex);
+		std::set<std::string> changed;
+		getChangedFiles(changed);
+		if (!enabled || changed.empty())
+			return;
+
+		for (size_t i = 0; i < s_files.size(); ++i)
+			if (changed.count(s_files[i].path))
+			{
+				std::cout << " * File changed: " << s_files[i].path << std::endl;
+				s_files[i].version = ++s_version_counter;
+				callbacks.push_back(s_files[i].callback);
+			}
+	}
+
+	for (size_t i = 0; i < callbacks.size(); ++i)
+		callbacks[i]();
+}
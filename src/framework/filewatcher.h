@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <functional>
+
+//tells when a file changes in disk (inotify in linux, polling the modification time elsewhere)
+//the callbacks are always called from the main thread, inside update
+class FileWatcher
+{
+public:
+	typedef std::function<void()> Callback;
+
+	static bool enabled;
+
+	static void watch(const std::string& filename, void* owner, Callback callback); //once per file and owner
+	static void unwatch(void* owner);
+
+	//changes every time the file changes and is 0 once the owner is unwatched, never repeats
+	//reloads done in workers compare it in the main thread to skip owners destroyed or files changed again meanwhile
+	static unsigned int getVersion(const std::string& filename, void* owner);
+	static void update(); //call it once per frame
+};
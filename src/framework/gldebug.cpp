@@ -0,0 +1,110 @@
+#include "gldebug.h"
+
+#include <atomic>
+#include <iostream>
+
+#include "includes.h"
+
+eGLDebugMode GLDebug::mode = GLDEBUG_OFF;
+bool GLDebug::available = false;
+int GLDebug::frame_counts[GLDebug::NUM_MESSAGE_TYPES] = { 0 };
+
+//in async mode the driver can call us from its own threads
+static std::atomic<unsigned int> s_counts[GLDebug::NUM_MESSAGE_TYPES];
+static std::atomic<unsigned int> s_unchecked_errors(0);
+static unsigned int s_total_errors = 0;
+
+static const char* getSourceName(GLenum source)
+{
+	switch (source)
+	{
+	case GL_DEBUG_SOURCE_API: return "API";
+	case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "WINDOW";
+	case GL_DEBUG_SOURCE_SHADER_COMPILER: return "SHADER";
+	case GL_DEBUG_SOURCE_THIRD_PARTY: return "THIRD PARTY";
+	case GL_DEBUG_SOURCE_APPLICATION: return "APP";
+	default: return "OTHER";
+	}
+}
+
+static void APIENTRY onDebugMessage(GLenum source, GLenum type, GLuint id, GLenum /*severity*/, GLsizei /*length*/, const GLchar* message, const void* /*user_param*/)
+{
+	GLDebug::eMessageType message_type = GLDebug::OTHERS;
+	if (type == GL_DEBUG_TYPE_ERROR)
+		message_type = GLDebug::ERRORS;
+	else if (type == GL_DEBUG_TYPE_PERFORMANCE)
+		message_type = GLDebug::PERFORMANCE;
+	else if (type == GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR || type == GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR || type == GL_DEBUG_TYPE_PORTABILITY)
+		message_type = GLDebug::WARNINGS;
+
+	s_counts[message_type]++;
+	if (message_type != GLDebug::ERRORS)
+		return;
+
+	//only the errors are printed, the rest would flood the console every frame
+	s_unchecked_errors++;
+	std::cerr << "[GL ERROR] (" << getSourceName(source) << " " << id << ") " << message << std::endl;
+}
+
+bool GLDebug::init(eGLDebugMode mode)
+{
+	available = glfwExtensionSupported("GL_KHR_debug") && glDebugMessageCallback != 0;
+	if (!available)
+	{
+		std::cout << "[WARN] KHR_debug not supported, using glGetError" << std::endl;
+		return false;
+	}
+
+	glDebugMessageCallback(onDebugMessage, NULL);
+
+	//notifications are just noise (buffer placements, etc)
+	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, NULL, GL_FALSE);
+
+	setMode(mode);
+	return true;
+}
+
+void GLDebug::setMode(eGLDebugMode mode)
+{
+	GLDebug::mode = mode;
+	if (!available)
+		return;
+
+	if (mode == GLDEBUG_OFF)
+		glDisable(GL_DEBUG_OUTPUT);
+	else
+		glEnable(GL_DEBUG_OUTPUT);
+
+	if (mode == GLDEBUG_SYNC)
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	else
+		glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+}
+
+unsigned int GLDebug::consumeErrors()
+{
+	return s_unchecked_errors.exchange(0);
+}
+
+void GLDebug::newFrame()
+{
+	for (int i = 0; i < NUM_MESSAGE_TYPES; ++i)
+		frame_counts[i] = (int)s_counts[i].exchange(0);
+	s_total_errors += frame_counts[ERRORS];
+}
+
+void GLDebug::renderInMenu()
+{
+	if (!available)
+	{
+		ImGui::Text("KHR_debug not supported");
+		return;
+	}
+
+	int current_mode = (int)mode;
+	if (ImGui::Combo("Mode", &current_mode, "Off\0Async\0Sync\0"))
+		setMode((eGLDebugMode)current_mode);
+
+	ImGui::Text("Errors: %d (total %u)", frame_counts[ERRORS], s_total_errors);
+	ImGui::Text("Warnings: %d  Performance: %d  Others: %d", frame_counts[WARNINGS], frame_counts[PERFORMANCE], frame_counts[OTHERS]);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+//errors and warnings reported by the driver through KHR_debug (glDebugMessageCallback)
+//so we dont need to call glGetError after every GL call, which syncs with the driver
+enum eGLDebugMode {
+	GLDEBUG_OFF,
+	GLDEBUG_ASYNC, //messages may arrive later and from other threads, no overhead
+	GLDEBUG_SYNC //the callback is called inside the GL call that failed, put a breakpoint there
+};
+
+class GLDebug
+{
+public:
+	enum eMessageType { ERRORS, WARNINGS, PERFORMANCE, OTHERS, NUM_MESSAGE_TYPES };
+
+	static eGLDebugMode mode;
+	static bool available; //KHR_debug supported by the context
+	static int frame_counts[NUM_MESSAGE_TYPES]; //messages received during the last frame
+
+	static bool init(eGLDebugMode mode); //call after creating the context
+	static void setMode(eGLDebugMode mode);
+	static bool isActive() { return available && mode != GLDEBUG_OFF; }
+
+	static unsigned int consumeErrors(); //errors since the last call
+	static void newFrame(); //call once per frame to aggregate the counters
+	static void renderInMenu();
+};
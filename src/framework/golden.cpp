@@ -0,0 +1,353 @@
+#include "golden.h"
+
+#include <vector>
+#include <map>
+#include <functional>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cmath>
+#include <filesystem>
+
+#include "includes.h"
+#include "profiler.h"
+#include "../application.h"
+#include "../graphics/fbo.h"
+#include "../graphics/texture.h"
+#include "../graphics/shader.h"
+#include "../graphics/streambuffer.h"
+
+#define GOLDEN_MAX_PSNR 100.0f //identical images
+#define GOLDEN_SSIM_WINDOW 8
+#define GOLDEN_SSIM_STRIDE 4
+
+std::string Golden::folder = "res/golden";
+bool Golden::update_references = false;
+int Golden::width = 640;
+int Golden::height = 360;
+int Golden::timing_frames = 30;
+float Golden::min_psnr = 35.0f;
+float Golden::min_ssim = 0.98f;
+
+struct sGoldenScene
+{
+	const char* name;
+	std::function<bool(Application*)> setup; //false if the scene cannot be rendered (e.g. the vdb is not there)
+};
+
+template<typename T> static SceneNode* findNode(Application* app)
+{
+	for (SceneNode* node : app->node_list)
+		if (dynamic_cast<T*>(node->material))
+			return node;
+	return NULL;
+}
+
+//leaves visible only the node with the material T and returns its material
+template<typename T> static T* isolate(Application* app)
+{
+	SceneNode* target = findNode<T>(app);
+	for (SceneNode* node : app->node_list)
+		if (node->type != NODE_LIGHT)
+			node->visible = (node == target);
+	if (!target)
+		return NULL;
+	target->setModel(glm::mat4(1.f));
+	return dynamic_cast<T*>(target->material);
+}
+
+//every field the render uses is set, so a scene doesnt depend on the ones before it
+static VolumeMaterial* setupVolume(Application* app, ShaderType type, const char* fs)
+{
+	VolumeMaterial* material = isolate<VolumeMaterial>(app);
+	if (!material)
+		return NULL;
+	material->shaderType = type;
+	material->shader = Shader::Get("res/shaders/basic.vs", fs);
+	material->volumeType = HETEROGENEOUS;
+	material->densitySource = VDB_DENSITY;
+	material->densityScale = 1.0f;
+	material->absorptionCoefficient = 1.0f;
+	material->stepLength = 0.01f;
+	material->noiseScale = 2.0f;
+	material->noiseDetail = 2;
+	material->emissiveColor = glm::vec4(0.f, 0.f, 0.f, 1.f);
+	material->emissiveIntensity = 0.0f;
+	material->scatterCoefficient = 0.01f;
+	material->gValue = 0.0f;
+	material->numSteps = 1;
+	material->threshold = 0.5f;
+	material->flag_jittering = false;
+	material->use_proxy = true;
+	return material;
+}
+
+static IsosurfaceMaterial* setupIsosurface(Application* app)
+{
+	IsosurfaceMaterial* material = isolate<IsosurfaceMaterial>(app);
+	if (!material)
+		return NULL;
+	material->shader = Shader::Get("res/shaders/basic.vs", "res/shaders/isosurface.fs");
+	material->volumeType = HETEROGENEOUS;
+	material->densitySource = VDB_DENSITY;
+	material->densityScale = 1.0f;
+	material->stepLength = 0.01f;
+	material->noiseScale = 2.0f;
+	material->threshold = 0.5f;
+	material->refine_steps = 4;
+	material->flag_jittering = false;
+	material->use_distance_field = false;
+	material->use_proxy = true;
+	material->extract_mesh = false;
+	return material;
+}
+
+static const std::vector<sGoldenScene>& getScenes()
+{
+	static std::vector<sGoldenScene> scenes = {
+		{ "absorption", [](Application* app) {
+			VolumeMaterial* material = setupVolume(app, ABSORPTION, "res/shaders/absorption.fs");
+			if (!material) return false;
+			material->volumeType = HOMOGENEOUS;
+			material->densitySource = CONSTANT_DENSITY;
+			return true;
+		} },
+		{ "fullvolume_noise", [](Application* app) {
+			VolumeMaterial* material = setupVolume(app, FULL_VOLUME, "res/shaders/fullvolume.fs");
+			if (!material) return false;
+			material->densitySource = NOISE_DENSITY;
+			return true;
+		} },
+		{ "isosurface_noise", [](Application* app) {
+			IsosurfaceMaterial* material = setupIsosurface(app);
+			if (!material) return false;
+			material->densitySource = NOISE_DENSITY;
+			return true;
+		} },
+		{ "absorption_emission", [](Application* app) {
+			VolumeMaterial* material = setupVolume(app, ABSORPTION_EMISSION, "res/shaders/absorption_emission.fs");
+			if (!material || !material->texture) return false;
+			material->emissiveColor = glm::vec4(1.f, 0.5f, 0.2f, 1.f);
+			material->emissiveIntensity = 0.5f;
+			return true;
+		} },
+		{ "fullvolume", [](Application* app) {
+			VolumeMaterial* material = setupVolume(app, FULL_VOLUME, "res/shaders/fullvolume.fs");
+			return material && material->texture;
+		} },
+		{ "isosurface", [](Application* app) {
+			IsosurfaceMaterial* material = setupIsosurface(app);
+			return material && material->texture;
+		} },
+	};
+	return scenes;
+}
+
+//PSNR of the RGB channels, both images must have the same size and 4 bytes per pixel
+static float computePSNR(const Image& a, const Image& b)
+{
+	double error = 0.0;
+	int num_pixels = a.width * a.height;
+	for (int i = 0; i < num_pixels; ++i)
+		for (int c = 0; c < 3; ++c)
+		{
+			double d = (double)a.data[i * 4 + c] - (double)b.data[i * 4 + c];
+			error += d * d;
+		}
+	double mse = error / (num_pixels * 3.0);
+	if (mse == 0.0)
+		return GOLDEN_MAX_PSNR;
+	return std::min(GOLDEN_MAX_PSNR, (float)(10.0 * std::log10(255.0 * 255.0 / mse)));
+}
+
+//mean SSIM of the luminance over overlapping windows
+static float computeSSIM(const Image& a, const Image& b)
+{
+	const double C1 = (0.01 * 255) * (0.01 * 255);
+	const double C2 = (0.03 * 255) * (0.03 * 255);
+	const int N = GOLDEN_SSIM_WINDOW * GOLDEN_SSIM_WINDOW;
+
+	auto luminance = [](const Image& img, int x, int y) {
+		const uint8_t* p = img.data + (y * img.width + x) * 4;
+		return 0.299 * p[0] + 0.587 * p[1] + 0.114 * p[2];
+	};
+
+	double sum = 0.0;
+	int num_windows = 0;
+	for (int y = 0; y + GOLDEN_SSIM_WINDOW <= a.height; y += GOLDEN_SSIM_STRIDE)
+		for (int x = 0; x + GOLDEN_SSIM_WINDOW <= a.width; x += GOLDEN_SSIM_STRIDE)
+		{
+			double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+			for (int j = 0; j < GOLDEN_SSIM_WINDOW; ++j)
+				for (int i = 0; i < GOLDEN_SSIM_WINDOW; ++i)
+				{
+					double la = luminance(a, x + i, y + j);
+					double lb = luminance(b, x + i, y + j);
+					sa += la; sb += lb;
+					saa += la * la; sbb += lb * lb; sab += la * lb;
+				}
+			double ma = sa / N, mb = sb / N;
+			double va = saa / N - ma * ma, vb = sbb / N - mb * mb, cov = sab / N - ma * mb;
+			sum += ((2 * ma * mb + C1) * (2 * cov + C2)) / ((ma * ma + mb * mb + C1) * (va + vb + C2));
+			num_windows++;
+		}
+	return num_windows ? (float)(sum / num_windows) : 1.0f;
+}
+
+static std::map<std::string, float> loadTimes(const std::string& filename)
+{
+	std::map<std::string, float> times;
+	std::ifstream file(filename);
+	std::string name;
+	float ms;
+	while (file >> name >> ms)
+		times[name] = ms;
+	return times;
+}
+
+//renders the scene several times and returns the median time in ms (GPU if timer queries are available)
+static float measureScene(Application* app, int frames)
+{
+	bool gpu_timers = glfwExtensionSupported("GL_ARB_timer_query");
+	std::vector<float> times;
+
+	GLuint queries[2];
+	if (gpu_timers)
+		glGenQueries(2, queries);
+
+	for (int i = 0; i < frames; ++i)
+	{
+		glFinish();
+		uint64_t start_ns = Profiler::getTimeNs();
+		if (gpu_timers)
+			glQueryCounter(queries[0], GL_TIMESTAMP);
+
+		app->render();
+
+		if (gpu_timers)
+			glQueryCounter(queries[1], GL_TIMESTAMP);
+		glFinish();
+		StreamBuffer::endFrame();
+
+		if (gpu_timers) {
+			GLuint64 begin_time = 0, end_time = 0;
+			glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &begin_time);
+			glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &end_time);
+			times.push_back((float)((end_time - begin_time) * 1e-6));
+		}
+		else
+			times.push_back((float)((Profiler::getTimeNs() - start_ns) * 1e-6));
+	}
+
+	if (gpu_timers)
+		glDeleteQueries(2, queries);
+
+	std::sort(times.begin(), times.end());
+	return times.size() ? times[times.size() / 2] : 0.0f;
+}
+
+bool Golden::run(Application* app)
+{
+	FBO fbo;
+	if (!fbo.create(width, height))
+		return false;
+
+	std::map<std::string, float> reference_times = loadTimes(folder + "/times.txt");
+	std::map<std::string, float> times;
+
+	//same view and background for every scene
+	Camera* camera = app->camera;
+	camera->lookAt(glm::vec3(1.f, 1.5f, 4.f), glm::vec3(0.f, 0.0f, 0.f), glm::vec3(0.f, 1.f, 0.f));
+	camera->setPerspective(60.f, width / (float)height, 0.1f, 500.f);
+	app->window_width = width;
+	app->window_height = height;
+	app->ambient_light = glm::vec4(0.1f, 0.1f, 0.1f, 1.f);
+	app->flag_grid = false;
+	app->flag_wireframe = false;
+
+	bool passed = true;
+	std::ofstream report;
+	if (update_references)
+		std::filesystem::create_directories(folder);
+	else
+		report.open(folder + "/report.txt");
+
+	char line[256];
+	snprintf(line, sizeof(line), "%-22s %10s %8s %10s %10s %8s  %s", "scene", "PSNR(dB)", "SSIM", "ref(ms)", "now(ms)", "delta", "result");
+	std::cout << line << std::endl;
+	report << line << std::endl;
+
+	fbo.bind();
+	for (const sGoldenScene& scene : getScenes())
+	{
+		if (!scene.setup(app))
+		{
+			snprintf(line, sizeof(line), "%-22s %10s %8s %10s %10s %8s  %s", scene.name, "-", "-", "-", "-", "-", "SKIPPED (no vdb)");
+			std::cout << line << std::endl;
+			report << line << std::endl;
+			continue;
+		}
+		Shader::UpdatePending();
+
+		float ms = measureScene(app, std::max(1, timing_frames));
+		times[scene.name] = ms;
+
+		Image image;
+		image.fromScreen(width, height);
+
+		std::string filename = folder + "/" + scene.name + ".tga";
+		if (update_references) {
+			if (!image.saveTGA(filename.c_str()))
+				std::cout << "[ERROR] Cannot write " << filename << std::endl;
+			continue;
+		}
+
+		Image reference;
+		bool has_reference = reference.loadTGA(filename.c_str()) && reference.width == width && reference.height == height;
+		if (has_reference && reference.bytes_per_pixel != 4) //compare always RGBA
+		{
+			Image rgba(reference.width, reference.height, 4);
+			for (int i = 0; i < reference.width * reference.height; ++i)
+				for (int c = 0; c < 4; ++c)
+					rgba.data[i * 4 + c] = c < 3 ? reference.data[i * 3 + c] : 255;
+			std::swap(reference.data, rgba.data);
+			reference.bytes_per_pixel = 4;
+		}
+
+		float psnr = has_reference ? computePSNR(image, reference) : 0.0f;
+		float ssim = has_reference ? computeSSIM(image, reference) : 0.0f;
+		bool ok = has_reference && psnr >= min_psnr && ssim >= min_ssim;
+		passed = passed && ok;
+
+		//keep the failing result next to the reference to inspect it
+		if (!ok)
+			image.saveTGA((folder + "/" + scene.name + "_failed.tga").c_str());
+
+		auto it = reference_times.find(scene.name);
+		float reference_ms = it != reference_times.end() ? it->second : 0.0f;
+		char delta[16] = "-";
+		if (reference_ms > 0.0f)
+			snprintf(delta, sizeof(delta), "%+.1f%%", (ms / reference_ms - 1.0f) * 100.0f);
+
+		snprintf(line, sizeof(line), "%-22s %10.2f %8.4f %10.3f %10.3f %8s  %s", scene.name, psnr, ssim, reference_ms, ms, delta,
+			ok ? "PASS" : (has_reference ? "FAIL" : "NO REFERENCE"));
+		std::cout << line << std::endl;
+		report << line << std::endl;
+	}
+	fbo.unbind();
+
+	if (update_references) {
+		//the skipped scenes keep their previous times
+		for (auto& it : times)
+			reference_times[it.first] = it.second;
+		std::ofstream file(folder + "/times.txt");
+		for (auto& it : reference_times)
+			file << it.first << " " << it.second << "\n";
+		std::cout << "[INFO] Golden references updated in " << folder << std::endl;
+		return true;
+	}
+
+	std::cout << (passed ? "[INFO] Golden images passed" : "[ERROR] Golden images failed") << " (min PSNR " << min_psnr << " dB, min SSIM " << min_ssim << ")" << std::endl;
+	return passed;
+}
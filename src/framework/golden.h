@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+class Application;
+
+//renders a fixed set of scenes offscreen and compares them with the reference images stored in a folder
+//reports the PSNR/SSIM against the reference and the GPU time against the reference time, side by side
+class Golden
+{
+public:
+	static std::string folder; //reference images (<scene>.tga) and times (times.txt)
+	static bool update_references; //store the current results as the new references
+	static int width;
+	static int height;
+	static int timing_frames; //frames rendered per scene to measure its time
+
+	//error budget, a scene fails if it goes below any of them
+	static float min_psnr; //dB
+	static float min_ssim;
+
+	static bool run(Application* app); //false if any scene fails
+};
@@ -0,0 +1,201 @@
+#include "gpuprofiler.h"
+
+#include <vector>
+#include <map>
+
+#include "includes.h"
+
+#define GPU_PROFILER_FRAMES 3 //frames in flight, the queries of a frame are read when it comes back
+#define GPU_PROFILER_SAMPLES 60 //frames used for the averages
+
+bool GPUProfiler::enabled = true;
+
+struct sGPUZone
+{
+	std::string name;
+	std::string path;
+	int parent;
+	GLuint begin_query;
+	GLuint end_query;
+};
+
+struct sGPUFrame
+{
+	std::vector<GLuint> queries; //pool, reused every time the frame comes back
+	int used_queries = 0;
+	std::vector<sGPUZone> zones;
+};
+
+struct sGPUStats
+{
+	float samples[GPU_PROFILER_SAMPLES];
+	int num_samples = 0;
+	int next = 0;
+	float last = 0;
+
+	void add(float ms)
+	{
+		last = ms;
+		samples[next] = ms;
+		next = (next + 1) % GPU_PROFILER_SAMPLES;
+		if (num_samples < GPU_PROFILER_SAMPLES)
+			num_samples++;
+	}
+
+	float getAverage() const
+	{
+		float sum = 0;
+		for (int i = 0; i < num_samples; ++i)
+			sum += samples[i];
+		return num_samples ? sum / num_samples : 0.0f;
+	}
+};
+
+static int s_supported = -1;
+static bool s_in_frame = false;
+static int s_frame_index = 0;
+static sGPUFrame s_frames[GPU_PROFILER_FRAMES];
+static std::vector<int> s_stack; //open zones
+static std::map<std::string, sGPUStats> s_stats;
+static std::vector<sGPUZone> s_last_zones; //last frame read, used to build the tree
+
+static bool isSupported()
+{
+	if (s_supported == -1)
+	{
+		s_supported = glfwExtensionSupported("GL_ARB_timer_query") ? 1 : 0;
+		if (!s_supported)
+			std::cout << "[WARN] GL_ARB_timer_query not supported, GPU profiler disabled" << std::endl;
+	}
+	return s_supported == 1;
+}
+
+static GLuint getQuery(sGPUFrame& frame)
+{
+	if (frame.used_queries == (int)frame.queries.size())
+	{
+		GLuint query = 0;
+		glGenQueries(1, &query);
+		frame.queries.push_back(query);
+	}
+	return frame.queries[frame.used_queries++];
+}
+
+//reads the timestamps of an old frame, if they are not ready yet we skip it instead of stalling
+static void readFrame(sGPUFrame& frame)
+{
+	if (frame.zones.empty())
+		return;
+
+	GLint available = 0;
+	glGetQueryObjectiv(frame.queries[frame.used_queries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return;
+
+	//zones with the same path (nodes with the same name) are added together
+	std::map<std::string, float> frame_times;
+	for (size_t i = 0; i < frame.zones.size(); ++i)
+	{
+		sGPUZone& zone = frame.zones[i];
+		if (!zone.end_query)
+			continue;
+		GLuint64 begin_time = 0, end_time = 0;
+		glGetQueryObjectui64v(zone.begin_query, GL_QUERY_RESULT, &begin_time);
+		glGetQueryObjectui64v(zone.end_query, GL_QUERY_RESULT, &end_time);
+		frame_times[zone.path] += (float)((end_time - begin_time) * 1e-6);
+	}
+
+	for (auto& it : frame_times)
+		s_stats[it.first].add(it.second);
+	s_last_zones = frame.zones;
+}
+
+void GPUProfiler::beginFrame()
+{
+	if (!enabled || !isSupported())
+		return;
+
+	s_frame_index = (s_frame_index + 1) % GPU_PROFILER_FRAMES;
+	sGPUFrame& frame = s_frames[s_frame_index];
+	readFrame(frame);
+
+	frame.zones.clear();
+	frame.used_queries = 0;
+	s_stack.clear();
+	s_in_frame = true;
+
+	beginZone("Frame");
+}
+
+void GPUProfiler::endFrame()
+{
+	if (!s_in_frame)
+		return;
+	while (s_stack.size())
+		endZone();
+	s_in_frame = false;
+}
+
+void GPUProfiler::beginZone(const std::string& name)
+{
+	if (!s_in_frame)
+		return;
+
+	sGPUFrame& frame = s_frames[s_frame_index];
+
+	sGPUZone zone;
+	zone.name = name;
+	zone.parent = s_stack.size() ? s_stack.back() : -1;
+	zone.path = zone.parent != -1 ? frame.zones[zone.parent].path + "/" + name : name;
+	zone.begin_query = getQuery(frame);
+	zone.end_query = 0;
+	glQueryCounter(zone.begin_query, GL_TIMESTAMP);
+
+	s_stack.push_back((int)frame.zones.size());
+	frame.zones.push_back(zone);
+}
+
+void GPUProfiler::endZone()
+{
+	if (!s_in_frame || s_stack.empty())
+		return;
+
+	sGPUFrame& frame = s_frames[s_frame_index];
+	sGPUZone& zone = frame.zones[s_stack.back()];
+	s_stack.pop_back();
+
+	zone.end_query = getQuery(frame);
+	glQueryCounter(zone.end_query, GL_TIMESTAMP);
+}
+
+static void renderZone(int index, const std::vector< std::vector<int> >& children)
+{
+	const sGPUZone& zone = s_last_zones[index];
+	const sGPUStats& stats = s_stats[zone.path];
+
+	ImGuiTreeNodeFlags flags = ImGuiTreeNodeFlags_DefaultOpen;
+	if (children[index].empty())
+		flags |= ImGuiTreeNodeFlags_Leaf;
+
+	if (!ImGui::TreeNodeEx((void*)(intptr_t)index, flags, "%s: %.3f ms (avg %.3f ms)", zone.name.c_str(), stats.last, stats.getAverage()))
+		return;
+	for (size_t i = 0; i < children[index].size(); ++i)
+		renderZone(children[index][i], children);
+	ImGui::TreePop();
+}
+
+void GPUProfiler::renderInMenu()
+{
+	ImGui::Checkbox("Enabled", &enabled);
+	if (!isSupported() || s_last_zones.empty())
+		return;
+
+	std::vector< std::vector<int> > children(s_last_zones.size());
+	for (size_t i = 0; i < s_last_zones.size(); ++i)
+		if (s_last_zones[i].parent != -1)
+			children[s_last_zones[i].parent].push_back((int)i);
+
+	for (size_t i = 0; i < s_last_zones.size(); ++i)
+		if (s_last_zones[i].parent == -1)
+			renderZone((int)i, children);
+}
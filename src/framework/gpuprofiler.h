@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+//measures the GPU time of the zones of a frame using GL_TIMESTAMP queries
+//results are read some frames later (when they are ready) so the CPU never waits for the GPU
+class GPUProfiler
+{
+public:
+	static bool enabled;
+
+	static void beginFrame(); //opens the root zone
+	static void endFrame();
+
+	//zones can be nested, they are identified by their path in the tree
+	static void beginZone(const std::string& name);
+	static void endZone();
+
+	static void renderInMenu(); //timing tree with the averages of the last frames
+};
+
+class GPUScope
+{
+public:
+	GPUScope(const std::string& name) { GPUProfiler::beginZone(name); }
+	~GPUScope() { GPUProfiler::endZone(); }
+};
+
+#define GPU_PROFILE_CONCAT2(a, b) a##b
+#define GPU_PROFILE_CONCAT(a, b) GPU_PROFILE_CONCAT2(a, b)
+#define GPU_PROFILE_SCOPE(name) GPUScope GPU_PROFILE_CONCAT(gpu_scope_, __LINE__)(name)
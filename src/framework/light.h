@@ -17,6 +17,6 @@ public:
 
 	Light(glm::vec3 position = glm::vec3(0.f), eLightType type = LIGHT_DIRECTIONAL, float intensity = 1.f, glm::vec4 color = glm::vec4(1.f));
 
-	void setUniforms(Shader* shader, const glm::mat4& model);
+	void setUniforms(Shader* shader, const glm::mat4& inverse_model); //inverse model of the lit node
 	void renderInMenu();
 };
\ No newline at end of file
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+
+//read only view of a whole file in memory, the OS pages it in on demand (mmap in posix, a file mapping in windows)
+//files of any size are supported in 64 bits
+class MappedFile
+{
+public:
+	const char* data;
+	size_t size;
+
+	MappedFile();
+	~MappedFile();
+
+	bool open(const char* filename);
+	void close();
+	bool isOpen() const { return data != NULL; }
+
+private:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+#ifdef _WIN32
+	void* file_handle;
+	void* mapping_handle;
+#endif
+};
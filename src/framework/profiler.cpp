@@ -0,0 +1,131 @@
+#include "profiler.h"
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+
+#include "includes.h"
+
+#define PROFILER_RING_SIZE (1 << 16) //events per thread, older ones are overwritten
+
+std::atomic<bool> Profiler::capturing(false);
+
+struct sProfileEvent
+{
+	const char* name;
+	uint64_t start_ns;
+	uint64_t end_ns;
+};
+
+//written only by its thread, read by the main thread when the capture ends
+struct sThreadRing
+{
+	int thread_index;
+	std::atomic<uint32_t> head;
+	sProfileEvent events[PROFILER_RING_SIZE];
+};
+
+static const std::chrono::steady_clock::time_point s_start_time = std::chrono::steady_clock::now();
+static std::mutex s_rings_mutex; //only taken when a thread records its first event
+static std::vector<sThreadRing*> s_rings;
+static uint64_t s_capture_start = 0;
+static char s_capture_filename[256] = "trace.json";
+
+static thread_local sThreadRing* t_ring = NULL;
+
+static sThreadRing* getThreadRing()
+{
+	if (t_ring)
+		return t_ring;
+
+	sThreadRing* ring = new sThreadRing();
+	ring->head = 0;
+	std::lock_guard<std::mutex> lock(s_rings_mutex);
+	ring->thread_index = (int)s_rings.size();
+	s_rings.push_back(ring);
+	t_ring = ring;
+	return ring;
+}
+
+uint64_t Profiler::getTimeNs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_start_time).count() + 1; //never 0
+}
+
+void Profiler::record(const char* name, uint64_t start_ns, uint64_t end_ns)
+{
+	sThreadRing* ring = getThreadRing();
+	uint32_t head = ring->head.load(std::memory_order_relaxed);
+	sProfileEvent& event = ring->events[head % PROFILER_RING_SIZE];
+	event.name = name;
+	event.start_ns = start_ns;
+	event.end_ns = end_ns;
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::beginCapture()
+{
+	s_capture_start = getTimeNs();
+	capturing = true;
+	std::cout << "[INFO] CPU profiler capturing" << std::endl;
+}
+
+bool Profiler::endCapture(const std::string& filename)
+{
+	capturing = false;
+
+	FILE* f = fopen(filename.c_str(), "wb");
+	if (f == NULL)
+	{
+		std::cout << "[ERROR] cannot write trace: " << filename << std::endl;
+		return false;
+	}
+
+	std::vector<sThreadRing*> rings;
+	{
+		std::lock_guard<std::mutex> lock(s_rings_mutex);
+		rings = s_rings;
+	}
+
+	//chrome trace format, complete events ("X") in microseconds
+	int num_events = 0;
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	for (size_t i = 0; i < rings.size(); ++i)
+	{
+		sThreadRing* ring = rings[i];
+		uint32_t head = ring->head.load(std::memory_order_acquire);
+		uint32_t first = head > PROFILER_RING_SIZE ? head - PROFILER_RING_SIZE : 0;
+		for (uint32_t j = first; j < head; ++j)
+		{
+			const sProfileEvent& event = ring->events[j % PROFILER_RING_SIZE];
+			if (event.start_ns < s_capture_start)
+				continue;
+			fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				num_events ? "," : "", event.name, ring->thread_index,
+				(event.start_ns - s_capture_start) * 0.001, (event.end_ns - event.start_ns) * 0.001);
+			num_events++;
+		}
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+
+	std::cout << "[INFO] CPU trace saved: " << filename << " (" << num_events << " events)" << std::endl;
+	return true;
+}
+
+void Profiler::renderInMenu()
+{
+	ImGui::InputText("File", s_capture_filename, sizeof(s_capture_filename));
+	if (!capturing)
+	{
+		if (ImGui::Button("Start capture"))
+			beginCapture();
+	}
+	else
+	{
+		ImGui::Text("Capturing %.1f s", (getTimeNs() - s_capture_start) * 1e-9);
+		if (ImGui::Button("Stop and save"))
+			endCapture(s_capture_filename);
+	}
+}
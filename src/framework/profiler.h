@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <atomic>
+
+//CPU profiler: scoped zones stored in a ring per thread (no locks while recording)
+//captures are saved in the Chrome trace format, open them in chrome://tracing or ui.perfetto.dev
+class Profiler
+{
+public:
+	static std::atomic<bool> capturing;
+
+	static uint64_t getTimeNs(); //steady clock, since the program started
+
+	static void beginCapture();
+	static bool endCapture(const std::string& filename); //writes the json
+	static void record(const char* name, uint64_t start_ns, uint64_t end_ns); //name must be a literal (it is not copied)
+
+	static void renderInMenu();
+};
+
+class ProfileScope
+{
+public:
+	const char* name;
+	uint64_t start_ns;
+
+	ProfileScope(const char* name) : name(name), start_ns(Profiler::capturing.load(std::memory_order_relaxed) ? Profiler::getTimeNs() : 0) {}
+	~ProfileScope() { if (start_ns) Profiler::record(name, start_ns, Profiler::getTimeNs()); }
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__FUNCTION__)
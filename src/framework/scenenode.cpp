@@ -16,27 +16,32 @@ unsigned int mesh_selected = 0;
 SceneNode::SceneNode()
 {
 	this->type = NODE_BASE;
+	this->transform = TransformSystem::create();
 	this->name = std::string("Node" + std::to_string(this->lastNameId++));
 }
 
 SceneNode::SceneNode(const char* name)
 {
 	this->type = NODE_BASE;
+	this->transform = TransformSystem::create();
 	this->name = name;
 }
 
-SceneNode::~SceneNode() { }
+SceneNode::~SceneNode()
+{
+	TransformSystem::destroy(this->transform);
+}
 
 void SceneNode::render(Camera* camera)
 {
 	if (this->material && this->visible)
-		this->material->render(this->mesh, this->model, camera);
+		this->material->render(this->mesh, getModel(), getInverseModel(), camera);
 }
 
 void SceneNode::renderWireframe(Camera* camera)
 {
 	WireframeMaterial mat = WireframeMaterial();
-	mat.render(this->mesh, this->model, camera);
+	mat.render(this->mesh, getModel(), getInverseModel(), camera);
 }
 
 void SceneNode::renderInMenu()
@@ -44,13 +49,7 @@ void SceneNode::renderInMenu()
 	// Model edit
 	if (ImGui::TreeNode("Model")) 
 	{
-		float matrixTranslation[3], matrixRotation[3], matrixScale[3];
-		ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(this->model), matrixTranslation, matrixRotation, matrixScale);
-		ImGui::DragFloat3("Position", matrixTranslation, 0.1f);
-		ImGui::DragFloat3("Rotation", matrixRotation, 0.1f);
-		ImGui::DragFloat3("Scale", matrixScale, 0.1f);
-		ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, glm::value_ptr(this->model));
-		
+		renderModelInMenu();
 		ImGui::TreePop();
 	}
 
@@ -62,6 +61,20 @@ void SceneNode::renderInMenu()
 	}
 }
 
+void SceneNode::renderModelInMenu()
+{
+	float matrixTranslation[3], matrixRotation[3], matrixScale[3];
+	glm::mat4 local = TransformSystem::getLocalMatrix(this->transform);
+	ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(local), matrixTranslation, matrixRotation, matrixScale);
+	bool changed = ImGui::DragFloat3("Position", matrixTranslation, 0.1f);
+	changed |= ImGui::DragFloat3("Rotation", matrixRotation, 0.1f);
+	changed |= ImGui::DragFloat3("Scale", matrixScale, 0.1f);
+	if (!changed)
+		return;
+	ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, glm::value_ptr(local));
+	setModel(local);
+}
+
 unsigned int VolumeNode::lastNameId = 0;
 
 // VolumeNode Class Implementation
@@ -70,10 +83,6 @@ VolumeNode::VolumeNode()
 	this->type = NODE_VOLUME;
 	this->mesh = new Mesh();   // Create a new Mesh instance
 	this->mesh->createCube();  // Call createCube() on the instance
-	glm::mat4 model = glm::mat4(1.f);
-	this->model = model;
-
-
 }
 
 VolumeNode::VolumeNode(const char* name)
@@ -82,9 +91,6 @@ VolumeNode::VolumeNode(const char* name)
 	this->name = std::string("VolumeNode" + std::to_string(this->lastNameId++));
 	this->mesh = new Mesh();   // Create a new Mesh instance
 	this->mesh->createCube();  // Call createCube() on the instance
-	glm::mat4 model = glm::mat4(1.f);
-	this->model = model;	
-
 }
 
 VolumeNode::~VolumeNode() { }
@@ -93,14 +99,14 @@ void VolumeNode::render(Camera* camera)
 {
 	if (this->material && this->visible)
 	{
-		this->material->render(this->mesh, this->model, camera);
+		this->material->render(this->mesh, getModel(), getInverseModel(), camera);
 	}
 }
 
 void VolumeNode::renderVolume(Camera* camera)
 {
 	IsosurfaceMaterial mat = IsosurfaceMaterial();
-	mat.render(this->mesh, this->model, camera);
+	mat.render(this->mesh, getModel(), getInverseModel(), camera);
 }
 
 void VolumeNode::renderInMenu()
@@ -108,13 +114,7 @@ void VolumeNode::renderInMenu()
 	// Model edit
 	if (ImGui::TreeNode("Model"))
 	{
-		float matrixTranslation[3], matrixRotation[3], matrixScale[3];
-		ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(this->model), matrixTranslation, matrixRotation, matrixScale);
-		ImGui::DragFloat3("Position", matrixTranslation, 0.1f);
-		ImGui::DragFloat3("Rotation", matrixRotation, 0.1f);
-		ImGui::DragFloat3("Scale", matrixScale, 0.1f);
-		ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, glm::value_ptr(this->model));
-
+		renderModelInMenu();
 		ImGui::TreePop();
 	}
 
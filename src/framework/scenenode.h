@@ -7,6 +7,7 @@
 #include "../graphics/mesh.h"
 #include "../graphics/material.h"
 #include "framework/utils.h"
+#include "transform.h"
 
 class Light;
 enum eType { NODE_BASE, NODE_VOLUME, NODE_LIGHT };
@@ -18,19 +19,30 @@ public:
 	static unsigned int lastNameId;
 	std::string name;
 
-	glm::mat4 model = glm::mat4(1.f);
+	TransformHandle transform; //the matrices live in the TransformSystem
 	Mesh* mesh = NULL;
 	Material* material = NULL;
 
 	bool visible = true;
 
+	//filled by SceneCuller
+	int cull_proxy = -1; //leaf in the culling tree
+	bool in_frustum = true;
+
 	SceneNode();
 	SceneNode(const char* name);
 	~SceneNode();
 
+	//world matrices of the last TransformSystem::update
+	const glm::mat4& getModel() const { return TransformSystem::getWorld(this->transform); }
+	const glm::mat4& getInverseModel() const { return TransformSystem::getInverseWorld(this->transform); }
+	void setModel(const glm::mat4& model) { TransformSystem::setLocalMatrix(this->transform, model); } //relative to the parent
+	void setParent(SceneNode* parent) { TransformSystem::setParent(this->transform, parent ? parent->transform : -1); }
+
 	virtual void render(Camera* camera);
 	virtual void renderWireframe(Camera* camera);
 	virtual void renderInMenu();
+	void renderModelInMenu(); //local position, rotation and scale
 };
 
 // VolumeNode class inheriting from SceneNode
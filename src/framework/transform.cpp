@@ -0,0 +1,281 @@
+#include "transform.h"
+
+#include "workqueue.h"
+#include "profiler.h"
+#include "includes.h"
+
+#include <atomic>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+#define TRANSFORM_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+#define TRANSFORM_CHUNK_SIZE 256 //transforms per job inside a level
+
+bool TransformSystem::multithread = true;
+
+std::vector<glm::vec3> TransformSystem::positions;
+std::vector<glm::quat> TransformSystem::rotations;
+std::vector<glm::vec3> TransformSystem::scales;
+std::vector<TransformHandle> TransformSystem::parents;
+std::vector<glm::mat4> TransformSystem::world;
+std::vector<glm::mat4> TransformSystem::inverse_world;
+
+int TransformSystem::num_updated = 0;
+int TransformSystem::num_levels = 0;
+
+std::vector<uint8_t> TransformSystem::dirty;
+std::vector<uint8_t> TransformSystem::alive;
+std::vector<TransformHandle> TransformSystem::free_list;
+std::vector<TransformHandle> TransformSystem::order;
+std::vector<int> TransformSystem::level_start;
+bool TransformSystem::order_dirty = false;
+
+//out = a * b, out must not be a or b
+static inline void multiplyMatrices(const glm::mat4& a, const glm::mat4& b, glm::mat4& out)
+{
+#ifdef TRANSFORM_USE_SSE
+	__m128 a0 = _mm_loadu_ps(&a[0][0]);
+	__m128 a1 = _mm_loadu_ps(&a[1][0]);
+	__m128 a2 = _mm_loadu_ps(&a[2][0]);
+	__m128 a3 = _mm_loadu_ps(&a[3][0]);
+	for (int i = 0; i < 4; ++i)
+	{
+		__m128 r = _mm_mul_ps(a0, _mm_set1_ps(b[i][0]));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(b[i][1])));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(b[i][2])));
+		r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(b[i][3])));
+		_mm_storeu_ps(&out[i][0], r);
+	}
+#else
+	out = a * b;
+#endif
+}
+
+//local = T * R * S and its inverse S^-1 * R^T * T^-1
+static inline void composeTRS(const glm::vec3& t, const glm::quat& q, const glm::vec3& s, glm::mat4& local, glm::mat4& inverse_local)
+{
+	glm::mat3 r = glm::mat3_cast(q);
+	glm::vec3 inv_s = glm::vec3(s.x != 0.f ? 1.f / s.x : 0.f, s.y != 0.f ? 1.f / s.y : 0.f, s.z != 0.f ? 1.f / s.z : 0.f);
+
+	local[0] = glm::vec4(r[0] * s.x, 0.f);
+	local[1] = glm::vec4(r[1] * s.y, 0.f);
+	local[2] = glm::vec4(r[2] * s.z, 0.f);
+	local[3] = glm::vec4(t, 1.f);
+
+	for (int j = 0; j < 3; ++j)
+		inverse_local[j] = glm::vec4(r[0][j] * inv_s.x, r[1][j] * inv_s.y, r[2][j] * inv_s.z, 0.f);
+	glm::vec3 inv_t = -(glm::vec3(inverse_local[0]) * t.x + glm::vec3(inverse_local[1]) * t.y + glm::vec3(inverse_local[2]) * t.z);
+	inverse_local[3] = glm::vec4(inv_t, 1.f);
+}
+
+TransformHandle TransformSystem::create(TransformHandle parent)
+{
+	TransformHandle handle;
+	if (free_list.size())
+	{
+		handle = free_list.back();
+		free_list.pop_back();
+	}
+	else
+	{
+		handle = (TransformHandle)positions.size();
+		positions.push_back(glm::vec3(0.f));
+		rotations.push_back(glm::quat());
+		scales.push_back(glm::vec3(1.f));
+		parents.push_back(-1);
+		world.push_back(glm::mat4(1.f));
+		inverse_world.push_back(glm::mat4(1.f));
+		dirty.push_back(0);
+		alive.push_back(0);
+	}
+
+	positions[handle] = glm::vec3(0.f);
+	rotations[handle] = glm::angleAxis(0.f, glm::vec3(0.f, 1.f, 0.f));
+	scales[handle] = glm::vec3(1.f);
+	parents[handle] = -1;
+	world[handle] = glm::mat4(1.f);
+	inverse_world[handle] = glm::mat4(1.f);
+	alive[handle] = 1;
+	markDirty(handle);
+	order_dirty = true;
+
+	if (parent != -1)
+		setParent(handle, parent);
+	return handle;
+}
+
+void TransformSystem::destroy(TransformHandle handle)
+{
+	if (handle < 0 || handle >= (int)alive.size() || !alive[handle])
+		return;
+
+	for (size_t i = 0; i < parents.size(); ++i)
+		if (alive[i] && parents[i] == handle)
+		{
+			parents[i] = parents[handle];
+			markDirty((TransformHandle)i);
+		}
+
+	alive[handle] = 0;
+	dirty[handle] = 0;
+	parents[handle] = -1;
+	free_list.push_back(handle);
+	order_dirty = true;
+}
+
+void TransformSystem::setParent(TransformHandle handle, TransformHandle parent)
+{
+	//a transform cannot be attached to one of its children
+	for (TransformHandle p = parent; p != -1; p = parents[p])
+		if (p == handle)
+		{
+			std::cout << "[WARN] TransformSystem: cannot attach a transform to one of its children" << std::endl;
+			return;
+		}
+
+	parents[handle] = parent;
+	markDirty(handle);
+	order_dirty = true;
+}
+
+void TransformSystem::setPosition(TransformHandle handle, const glm::vec3& position)
+{
+	positions[handle] = position;
+	markDirty(handle);
+}
+
+void TransformSystem::setRotation(TransformHandle handle, const glm::quat& rotation)
+{
+	rotations[handle] = glm::normalize(rotation);
+	markDirty(handle);
+}
+
+void TransformSystem::setScale(TransformHandle handle, const glm::vec3& scale)
+{
+	scales[handle] = scale;
+	markDirty(handle);
+}
+
+void TransformSystem::setLocalMatrix(TransformHandle handle, const glm::mat4& m)
+{
+	glm::vec3 scale = glm::vec3(glm::length(glm::vec3(m[0])), glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2])));
+	glm::mat3 r = glm::mat3(m);
+	for (int i = 0; i < 3; ++i)
+		if (scale[i] != 0.f)
+			r[i] /= scale[i];
+
+	positions[handle] = glm::vec3(m[3]);
+	rotations[handle] = glm::normalize(glm::quat_cast(r));
+	scales[handle] = scale;
+	markDirty(handle);
+}
+
+glm::mat4 TransformSystem::getLocalMatrix(TransformHandle handle)
+{
+	glm::mat4 local, inverse_local;
+	composeTRS(positions[handle], rotations[handle], scales[handle], local, inverse_local);
+	return local;
+}
+
+void TransformSystem::rebuildOrder()
+{
+	//depth of every alive transform, the parents are resolved first
+	int count = (int)parents.size();
+	std::vector<int> depth(count, -1);
+	std::vector<TransformHandle> stack;
+	int max_depth = -1;
+	for (TransformHandle i = 0; i < count; ++i)
+	{
+		if (!alive[i])
+			continue;
+		for (TransformHandle h = i; h != -1 && depth[h] == -1; h = parents[h])
+			stack.push_back(h);
+		while (stack.size())
+		{
+			TransformHandle h = stack.back();
+			stack.pop_back();
+			depth[h] = parents[h] == -1 ? 0 : depth[parents[h]] + 1;
+		}
+		max_depth = std::max(max_depth, depth[i]);
+	}
+
+	//counting sort by depth
+	level_start.assign(max_depth + 2, 0);
+	for (TransformHandle i = 0; i < count; ++i)
+		if (alive[i])
+			level_start[depth[i] + 1]++;
+	for (int i = 1; i < (int)level_start.size(); ++i)
+		level_start[i] += level_start[i - 1];
+
+	order.resize(level_start.back());
+	std::vector<int> cursor(level_start.begin(), level_start.end() - 1);
+	for (TransformHandle i = 0; i < count; ++i)
+		if (alive[i])
+			order[cursor[depth[i]]++] = i;
+
+	num_levels = max_depth + 1;
+	order_dirty = false;
+}
+
+void TransformSystem::update()
+{
+	PROFILE_FUNCTION();
+
+	if (order_dirty)
+		rebuildOrder();
+
+	std::atomic<int> updated(0);
+
+	//a transform changes if it is dirty or its parent changed, the flag is kept until the end so the children see it
+	for (int level = 0; level < num_levels; ++level)
+	{
+		int start = level_start[level];
+		int end = level_start[level + 1];
+
+		auto updateChunk = [&](int chunk) {
+			int chunk_end = std::min(end, start + (chunk + 1) * TRANSFORM_CHUNK_SIZE);
+			int count = 0;
+			glm::mat4 local, inverse_local;
+			for (int i = start + chunk * TRANSFORM_CHUNK_SIZE; i < chunk_end; ++i)
+			{
+				TransformHandle h = order[i];
+				TransformHandle p = parents[h];
+				if (!dirty[h] && (p == -1 || !dirty[p]))
+					continue;
+				dirty[h] = 1;
+				count++;
+
+				composeTRS(positions[h], rotations[h], scales[h], local, inverse_local);
+				if (p == -1)
+				{
+					world[h] = local;
+					inverse_world[h] = inverse_local;
+					continue;
+				}
+				multiplyMatrices(world[p], local, world[h]);
+				multiplyMatrices(inverse_local, inverse_world[p], inverse_world[h]);
+			}
+			updated += count;
+		};
+
+		int num_chunks = (end - start + TRANSFORM_CHUNK_SIZE - 1) / TRANSFORM_CHUNK_SIZE;
+		if (multithread && num_chunks > 1)
+			WorkQueue::parallelFor(num_chunks, updateChunk);
+		else
+			for (int i = 0; i < num_chunks; ++i)
+				updateChunk(i);
+	}
+
+	std::fill(dirty.begin(), dirty.end(), 0);
+	num_updated = updated;
+}
+
+void TransformSystem::renderInMenu()
+{
+	ImGui::Checkbox("Multithread", &multithread);
+	ImGui::Text("%d transforms, %d levels", (int)order.size(), num_levels);
+	ImGui::Text("Updated last frame: %d", num_updated);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/vec3.hpp>
+#include <glm/matrix.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+//index in the TransformSystem arrays, -1 is none
+typedef int TransformHandle;
+
+//local TRS, world and inverse world matrices of every transform stored in contiguous arrays (SoA)
+//setters only mark the transform dirty, update() recomputes the dirty ones and their children once per frame
+//parents are processed before children (sorted by depth), every depth level is a batch that can run in the workers
+class TransformSystem
+{
+public:
+	static bool multithread;
+
+	//local transform
+	static std::vector<glm::vec3> positions;
+	static std::vector<glm::quat> rotations;
+	static std::vector<glm::vec3> scales;
+	static std::vector<TransformHandle> parents;
+
+	//results of the last update, world = parent world * local
+	static std::vector<glm::mat4> world;
+	static std::vector<glm::mat4> inverse_world; //built from the TRS, never with a general inverse
+
+	//stats of the last update
+	static int num_updated;
+	static int num_levels;
+
+	static TransformHandle create(TransformHandle parent = -1);
+	static void destroy(TransformHandle handle); //its children are attached to its parent
+
+	static void setParent(TransformHandle handle, TransformHandle parent); //keeps the local transform
+	static void setPosition(TransformHandle handle, const glm::vec3& position);
+	static void setRotation(TransformHandle handle, const glm::quat& rotation);
+	static void setScale(TransformHandle handle, const glm::vec3& scale);
+	static void setLocalMatrix(TransformHandle handle, const glm::mat4& m); //decomposed in TRS, shear is lost
+	static glm::mat4 getLocalMatrix(TransformHandle handle);
+
+	//references are valid until the next create
+	static const glm::mat4& getWorld(TransformHandle handle) { return world[handle]; }
+	static const glm::mat4& getInverseWorld(TransformHandle handle) { return inverse_world[handle]; }
+
+	static void update(); //call once per frame before using the world matrices
+	static void renderInMenu();
+
+private:
+	static std::vector<uint8_t> dirty;
+	static std::vector<uint8_t> alive;
+	static std::vector<TransformHandle> free_list;
+
+	//alive handles sorted by depth, level i is [level_start[i], level_start[i+1])
+	static std::vector<TransformHandle> order;
+	static std::vector<int> level_start;
+	static bool order_dirty;
+
+	static void markDirty(TransformHandle handle) { dirty[handle] = 1; }
+	static void rebuildOrder();
+};
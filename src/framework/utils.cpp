@@ -10,8 +10,10 @@
 
 #include "../application.h"
 #include "camera.h"
+#include "gldebug.h"
 #include "../graphics/shader.h"
 #include "../graphics/mesh.h"
+#include "../graphics/glstate.h"
 
 #include <glm/gtx/transform.hpp>
 
@@ -198,6 +200,10 @@ char const* gl_error_string(GLenum const err) noexcept
 bool checkGLErrors()
 {
 	#ifdef _DEBUG
+		//with KHR_debug the errors arrive through the callback, no need to sync with the driver
+		if (GLDebug::isActive())
+			return GLDebug::consumeErrors() == 0;
+
 		GLenum errCode;
 		const char* errString;
 
@@ -326,9 +332,9 @@ void drawGrid()
 	}
 
 	glLineWidth(1);
-	glEnable(GL_BLEND);
-	glDepthMask(false);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	GLState::setEnabled(GL_BLEND, true);
+	GLState::setDepthMask(false);
+	GLState::setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	Shader* grid_shader = Shader::getDefaultShader("grid");
 	grid_shader->enable();
 	glm::mat4 m = glm::mat4(1.f);
@@ -340,8 +346,8 @@ void drawGrid()
 	grid_shader->setUniform("u_camera_position", Camera::current->eye);
 	grid_shader->setUniform("u_viewprojection", Camera::current->viewprojection_matrix);
 	grid->render(GL_LINES); //background grid
-	glDisable(GL_BLEND);
-	glDepthMask(true);
+	GLState::setEnabled(GL_BLEND, false);
+	GLState::setDepthMask(true);
 	grid_shader->disable();
 }
 
@@ -452,14 +458,14 @@ char* fetchBufferVec2(char* data, std::vector<glm::vec2>& vector)
 	return data;
 }
 
-char* fetchBufferVec3u(char* data, std::vector<glm::vec3>& vector)
+char* fetchBufferVec3u(char* data, std::vector<glm::uvec3>& vector)
 {
 	int pos = 0;
 	std::vector<float> floats;
 	data = fetchBufferFloat(data, floats);
 	vector.resize(floats.size() / 3);
 	for (int i = 0; i < floats.size(); i += 3)
-		vector[i / 3] = glm::vec3(floats[i], floats[i + 1], floats[i + 2]);
+		vector[i / 3] = glm::uvec3(floats[i], floats[i + 1], floats[i + 2]);
 	return data;
 }
 
@@ -45,6 +45,6 @@ char* fetchEndLine(char* data);
 char* fetchBufferFloat(char* data, std::vector<float>& vector, int num = 0);
 char* fetchBufferVec3(char* data, std::vector<glm::vec3>& vector);
 char* fetchBufferVec2(char* data, std::vector<glm::vec2>& vector);
-char* fetchBufferVec3u(char* data, std::vector<glm::vec3>& vector);
+char* fetchBufferVec3u(char* data, std::vector<glm::uvec3>& vector);
 char* fetchBufferVec4ub(char* data, std::vector<glm::vec4>& vector);
 char* fetchBufferVec4(char* data, std::vector<glm::vec4>& vector);
@@ -0,0 +1,175 @@
+#include "workqueue.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cassert>
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+
+static std::vector<std::thread> s_threads;
+static std::deque<WorkQueue::Job> s_jobs;
+static std::mutex s_jobs_mutex;
+static std::condition_variable s_jobs_condition;
+static bool s_stopping = false;
+
+static std::vector<WorkQueue::Job> s_main_jobs;
+static std::mutex s_main_mutex;
+
+static std::thread::id s_main_thread_id = std::this_thread::get_id(); //static init runs in the main thread
+
+static void workerLoop()
+{
+	while (true)
+	{
+		WorkQueue::Job job;
+		{
+			std::unique_lock<std::mutex> lock(s_jobs_mutex);
+			s_jobs_condition.wait(lock, [] { return s_stopping || !s_jobs.empty(); });
+			if (s_stopping)
+				return;
+			job = std::move(s_jobs.front());
+			s_jobs.pop_front();
+		}
+		job();
+	}
+}
+
+void WorkQueue::init(int num_threads)
+{
+	if (s_threads.size())
+		return;
+
+	assert(isMainThread() && "WorkQueue must be initialized from the main thread");
+
+	if (num_threads <= 0)
+		num_threads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+
+	s_stopping = false;
+	for (int i = 0; i < num_threads; ++i)
+		s_threads.push_back(std::thread(workerLoop));
+	std::cout << "[INFO] WorkQueue: " << num_threads << " threads" << std::endl;
+}
+
+void WorkQueue::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(s_jobs_mutex);
+		s_stopping = true;
+		s_jobs.clear();
+	}
+	s_jobs_condition.notify_all();
+
+	for (size_t i = 0; i < s_threads.size(); ++i)
+		s_threads[i].join();
+	s_threads.clear();
+
+	std::lock_guard<std::mutex> lock(s_main_mutex);
+	s_main_jobs.clear();
+}
+
+void WorkQueue::submit(Job job)
+{
+	if (!s_threads.size())
+		init();
+
+	{
+		std::lock_guard<std::mutex> lock(s_jobs_mutex);
+		s_jobs.push_back(std::move(job));
+	}
+	s_jobs_condition.notify_one();
+}
+
+//shared with the helper jobs, that may start after parallelFor returned (then they find no work left)
+struct sParallelFor
+{
+	std::function<void(int)> func;
+	int count = 0;
+	std::atomic<int> next{ 0 };
+	std::atomic<int> done{ 0 };
+	std::mutex mutex;
+	std::condition_variable condition;
+
+	void work()
+	{
+		int i;
+		while ((i = next.fetch_add(1)) < count)
+		{
+			func(i);
+			if (done.fetch_add(1) + 1 == count)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				condition.notify_all();
+			}
+		}
+	}
+};
+
+void WorkQueue::parallelFor(int count, const std::function<void(int)>& func)
+{
+	if (count <= 0)
+		return;
+
+	std::shared_ptr<sParallelFor> state = std::make_shared<sParallelFor>();
+	state->func = func;
+	state->count = count;
+
+	//the caller works too and only waits for the items already taken, so it never deadlocks when called from a worker
+	int num_helpers = std::min(count - 1, getNumThreads());
+	for (int i = 0; i < num_helpers; ++i)
+		submit([state]() { state->work(); });
+	state->work();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->condition.wait(lock, [&]() { return state->done.load() == count; });
+}
+
+void WorkQueue::runOnMainThread(Job job)
+{
+	std::lock_guard<std::mutex> lock(s_main_mutex);
+	s_main_jobs.push_back(std::move(job));
+}
+
+void WorkQueue::flushMainThread()
+{
+	assert(isMainThread());
+
+	//swap them so jobs can queue more jobs without a deadlock
+	std::vector<Job> jobs;
+	{
+		std::lock_guard<std::mutex> lock(s_main_mutex);
+		jobs.swap(s_main_jobs);
+	}
+
+	for (size_t i = 0; i < jobs.size(); ++i)
+		jobs[i]();
+}
+
+void WorkQueue::waitFor(const std::function<bool()>& done)
+{
+	assert(isMainThread());
+
+	//the jobs being waited usually finish with a job for the main thread
+	while (true)
+	{
+		flushMainThread();
+		if (done())
+			return;
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+}
+
+bool WorkQueue::isMainThread()
+{
+	return std::this_thread::get_id() == s_main_thread_id;
+}
+
+int WorkQueue::getNumThreads()
+{
+	return (int)s_threads.size();
+}
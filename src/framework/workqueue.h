@@ -0,0 +1,23 @@
+#pragma once
+
+#include <functional>
+
+//pool of worker threads for the heavy CPU work (loading, baking assets...)
+//GL calls must stay in the main thread, use runOnMainThread for them
+class WorkQueue
+{
+public:
+	typedef std::function<void()> Job;
+
+	static void init(int num_threads = 0); //0 uses all the cores but the main one
+	static void shutdown(); //waits for the running jobs, the queued ones are discarded
+
+	static void submit(Job job); //runs in any worker
+	static void parallelFor(int count, const std::function<void(int)>& func); //calls func(0..count-1) in the workers and the calling thread, returns when all are done
+	static void runOnMainThread(Job job); //runs in the next flushMainThread
+	static void flushMainThread(); //call it once per frame from the main thread
+	static void waitFor(const std::function<bool()>& done); //main thread only, flushes the main thread jobs till done returns true
+
+	static bool isMainThread();
+	static int getNumThreads();
+};
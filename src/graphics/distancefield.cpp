@@ -0,0 +1,127 @@
+#include "distancefield.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "../framework/workqueue.h"
+#include "../framework/profiler.h"
+
+#define DISTANCE_INF 1e20f
+
+bool DistanceField::multithread = true;
+
+//squared distance transform of a line: d[q] = min over p of (q - p)^2 + f[p]
+//lower envelope of the parabolas of the finite samples (there must be one), v and z are scratch buffers of n and n + 1
+static void transformLine(const float* f, float* d, int n, int* v, float* z)
+{
+	int k = -1;
+	for (int q = 0; q < n; ++q)
+	{
+		if (f[q] >= DISTANCE_INF)
+			continue;
+		if (k == -1)
+		{
+			k = 0;
+			v[0] = q;
+			z[0] = -DISTANCE_INF;
+			z[1] = DISTANCE_INF;
+			continue;
+		}
+		float s;
+		while (true)
+		{
+			int p = v[k];
+			s = ((f[q] + q * q) - (f[p] + p * p)) / (2.f * q - 2.f * p);
+			if (s > z[k])
+				break;
+			k--; //z[0] is -inf, it always stops at the first one
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = DISTANCE_INF;
+	}
+
+	k = 0;
+	for (int q = 0; q < n; ++q)
+	{
+		while (z[k + 1] < q)
+			k++;
+		float dq = (float)(q - v[k]);
+		d[q] = dq * dq + f[v[k]];
+	}
+}
+
+//in place squared distance transform of a grid whose features are 0 and the rest DISTANCE_INF
+static void transformGrid(std::vector<float>& grid, int r)
+{
+	size_t layer = (size_t)r * r;
+
+	//every job does the lines of a plane, the axis is the stride between the samples of a line
+	auto pass = [&](int axis, int plane) {
+		std::vector<float> f(r), d(r), z(r + 1);
+		std::vector<int> v(r);
+		for (int i = 0; i < r; ++i)
+		{
+			size_t start, stride;
+			if (axis == 0) { start = i * (size_t)r + plane * layer; stride = 1; } //x lines of the z plane
+			else if (axis == 1) { start = i + plane * layer; stride = r; } //y lines of the z plane
+			else { start = i + plane * (size_t)r; stride = layer; } //z lines of the y plane
+
+			bool empty = true;
+			for (int j = 0; j < r; ++j)
+			{
+				f[j] = grid[start + j * stride];
+				empty &= f[j] >= DISTANCE_INF;
+			}
+			if (empty)
+				continue;
+			transformLine(f.data(), d.data(), r, v.data(), z.data());
+			for (int j = 0; j < r; ++j)
+				grid[start + j * stride] = d[j];
+		}
+	};
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		auto job = [&](int plane) { pass(axis, plane); };
+		if (DistanceField::multithread)
+			WorkQueue::parallelFor(r, job);
+		else
+			for (int plane = 0; plane < r; ++plane)
+				job(plane);
+	}
+}
+
+void DistanceField::bake(const float* density, int resolution, float threshold, float* result)
+{
+	PROFILE_FUNCTION();
+
+	size_t count = (size_t)resolution * resolution * resolution;
+	std::vector<float> to_inside(count);
+	std::vector<float> to_outside(count);
+	bool any_inside = false;
+	bool any_outside = false;
+	for (size_t i = 0; i < count; ++i)
+	{
+		bool inside = density[i] > threshold;
+		to_inside[i] = inside ? 0.f : DISTANCE_INF;
+		to_outside[i] = inside ? DISTANCE_INF : 0.f;
+		any_inside |= inside;
+		any_outside |= !inside;
+	}
+
+	//without surface every sample is far away
+	if (!any_inside || !any_outside)
+	{
+		std::fill(result, result + count, any_inside ? -(float)resolution : (float)resolution);
+		return;
+	}
+
+	transformGrid(to_inside, resolution);
+	transformGrid(to_outside, resolution);
+
+	for (size_t i = 0; i < count; ++i)
+		result[i] = to_inside[i] > 0.f ? std::sqrt(to_inside[i]) - 0.5f : 0.5f - std::sqrt(to_outside[i]);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+//signed distance to the surface where a density grid crosses a threshold, negative inside (density > threshold)
+//exact euclidean distance transform (Felzenszwalb and Huttenlocher) separable in x, y and z, the lines of every pass run in parallel
+class DistanceField
+{
+public:
+	static bool multithread;
+
+	//result has resolution^3 values in samples, the surface is half a sample away from the boundary samples
+	static void bake(const float* density, int resolution, float threshold, float* result);
+};
@@ -0,0 +1,85 @@
+#include "fbo.h"
+
+#include "texture.h"
+#include "../framework/utils.h"
+
+#include <iostream>
+#include <cassert>
+
+FBO::FBO()
+{
+	fbo_id = 0;
+	color_texture = NULL;
+	renderbuffer_depth = 0;
+	width = height = 0;
+	prev_fbo = 0;
+}
+
+FBO::~FBO()
+{
+	release();
+}
+
+bool FBO::create(int width, int height, int format, int type)
+{
+	assert(width && height && "FBO must have a size");
+	release();
+
+	this->width = width;
+	this->height = height;
+
+	color_texture = new Texture(width, height, format, type, false);
+
+	glGenRenderbuffers(1, &renderbuffer_depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer_depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+	glGenFramebuffers(1, &fbo_id);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_id);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_texture->texture_id, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffer_depth);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "[ERROR] FBO not complete, status: " << status << std::endl;
+		release();
+		return false;
+	}
+
+	assert(checkGLErrors() && "Error creating FBO");
+	return true;
+}
+
+void FBO::release()
+{
+	if (fbo_id)
+		glDeleteFramebuffers(1, &fbo_id);
+	if (renderbuffer_depth)
+		glDeleteRenderbuffers(1, &renderbuffer_depth);
+	if (color_texture)
+		delete color_texture;
+	fbo_id = 0;
+	renderbuffer_depth = 0;
+	color_texture = NULL;
+}
+
+void FBO::bind()
+{
+	assert(fbo_id && "FBO not created");
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+	glGetIntegerv(GL_VIEWPORT, prev_viewport);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_id);
+	glViewport(0, 0, width, height);
+}
+
+void FBO::unbind()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+	glViewport(prev_viewport[0], prev_viewport[1], prev_viewport[2], prev_viewport[3]);
+}
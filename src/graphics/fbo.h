@@ -0,0 +1,33 @@
+/*  by Javi Agenjo 2013 UPF  javi.agenjo@gmail.com
+	This class encapsulates a FrameBufferObject, used to render to textures instead of the screen.
+*/
+
+#pragma once
+
+#include "../framework/includes.h"
+
+class Texture;
+
+class FBO
+{
+public:
+	GLuint fbo_id;
+	Texture* color_texture;
+	GLuint renderbuffer_depth;
+	int width;
+	int height;
+
+	FBO();
+	~FBO();
+
+	bool create(int width, int height, int format = GL_RGBA, int type = GL_UNSIGNED_BYTE);
+	void release();
+
+	//binds it as the render target, the previous framebuffer and viewport are restored on unbind
+	void bind();
+	void unbind();
+
+private:
+	GLint prev_fbo;
+	GLint prev_viewport[4];
+};
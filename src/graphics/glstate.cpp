@@ -0,0 +1,150 @@
+#include "glstate.h"
+
+#include <cassert>
+
+#define GLSTATE_TEXTURE_SLOTS 16
+#define GLSTATE_UNKNOWN 0xFFFFFFFF
+
+bool GLState::enabled = true;
+int GLState::num_changes = 0;
+int GLState::num_skipped = 0;
+
+struct sCapState
+{
+	GLenum cap;
+	GLuint value; //0, 1 or unknown
+};
+
+static GLuint s_program = GLSTATE_UNKNOWN;
+static GLuint s_active_slot = GLSTATE_UNKNOWN;
+static GLenum s_texture_targets[GLSTATE_TEXTURE_SLOTS];
+static GLuint s_textures[GLSTATE_TEXTURE_SLOTS];
+static sCapState s_caps[] = { { GL_DEPTH_TEST, GLSTATE_UNKNOWN }, { GL_CULL_FACE, GLSTATE_UNKNOWN }, { GL_BLEND, GLSTATE_UNKNOWN } };
+static GLuint s_depth_mask = GLSTATE_UNKNOWN;
+static GLuint s_depth_func = GLSTATE_UNKNOWN;
+static GLuint s_blend_src = GLSTATE_UNKNOWN;
+static GLuint s_blend_dst = GLSTATE_UNKNOWN;
+static GLuint s_polygon_mode = GLSTATE_UNKNOWN;
+static bool s_textures_valid = false;
+
+//true if the value changed (and stores it)
+static bool update(GLuint& cached, GLuint value)
+{
+	if (GLState::enabled && cached == value)
+	{
+		GLState::num_skipped++;
+		return false;
+	}
+	cached = value;
+	GLState::num_changes++;
+	return true;
+}
+
+void GLState::useProgram(GLuint program)
+{
+	if (update(s_program, program))
+		glUseProgram(program);
+}
+
+void GLState::bindTexture(int slot, GLenum target, GLuint texture)
+{
+	assert(slot >= 0 && slot < GLSTATE_TEXTURE_SLOTS);
+	if (update(s_active_slot, slot))
+		glActiveTexture(GL_TEXTURE0 + slot);
+	bindTexture(target, texture);
+}
+
+void GLState::bindTexture(GLenum target, GLuint texture)
+{
+	if (!s_textures_valid)
+	{
+		for (int i = 0; i < GLSTATE_TEXTURE_SLOTS; ++i)
+			s_textures[i] = GLSTATE_UNKNOWN;
+		s_textures_valid = true;
+	}
+
+	//the slot is unknown after an invalidate, ask for it once
+	if (s_active_slot == GLSTATE_UNKNOWN)
+	{
+		GLint active = GL_TEXTURE0;
+		glGetIntegerv(GL_ACTIVE_TEXTURE, &active);
+		s_active_slot = active - GL_TEXTURE0;
+	}
+	if (s_active_slot >= GLSTATE_TEXTURE_SLOTS)
+	{
+		glBindTexture(target, texture);
+		return;
+	}
+
+	//a slot remembers one binding, binding other target in it always reaches GL
+	GLuint& cached = s_textures[s_active_slot];
+	if (s_texture_targets[s_active_slot] != target)
+		cached = GLSTATE_UNKNOWN;
+	s_texture_targets[s_active_slot] = target;
+	if (update(cached, texture))
+		glBindTexture(target, texture);
+}
+
+void GLState::setEnabled(GLenum cap, bool value)
+{
+	for (sCapState& state : s_caps)
+	{
+		if (state.cap != cap)
+			continue;
+		if (update(state.value, value ? 1 : 0))
+			value ? glEnable(cap) : glDisable(cap);
+		return;
+	}
+	value ? glEnable(cap) : glDisable(cap);
+}
+
+void GLState::setDepthMask(bool value)
+{
+	if (update(s_depth_mask, value ? 1 : 0))
+		glDepthMask(value ? GL_TRUE : GL_FALSE);
+}
+
+void GLState::setDepthFunc(GLenum func)
+{
+	if (update(s_depth_func, func))
+		glDepthFunc(func);
+}
+
+void GLState::setBlendFunc(GLenum src, GLenum dst)
+{
+	if (enabled && s_blend_src == src && s_blend_dst == dst)
+	{
+		num_skipped++;
+		return;
+	}
+	s_blend_src = src;
+	s_blend_dst = dst;
+	num_changes++;
+	glBlendFunc(src, dst);
+}
+
+void GLState::setPolygonMode(GLenum mode)
+{
+	if (update(s_polygon_mode, mode))
+		glPolygonMode(GL_FRONT_AND_BACK, mode);
+}
+
+void GLState::invalidate()
+{
+	s_program = GLSTATE_UNKNOWN;
+	s_active_slot = GLSTATE_UNKNOWN;
+	s_textures_valid = false;
+	for (sCapState& state : s_caps)
+		state.value = GLSTATE_UNKNOWN;
+	s_depth_mask = s_depth_func = GLSTATE_UNKNOWN;
+	s_blend_src = s_blend_dst = GLSTATE_UNKNOWN;
+	s_polygon_mode = GLSTATE_UNKNOWN;
+	num_changes = 0;
+	num_skipped = 0;
+}
+
+void GLState::renderInMenu()
+{
+	ImGui::Checkbox("State cache", &enabled);
+	ImGui::Text("%d state changes, %d skipped", num_changes, num_skipped);
+}
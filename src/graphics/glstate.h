@@ -0,0 +1,27 @@
+#pragma once
+
+#include "../framework/includes.h"
+
+//shadow copy of the GL state the renderer changes the most, the calls that would set the same value are skipped
+//code that touches GL behind its back (ImGui, other libraries) must call invalidate afterwards
+class GLState
+{
+public:
+	static bool enabled; //to compare, when false every call goes to GL
+
+	static void useProgram(GLuint program);
+	static void bindTexture(int slot, GLenum target, GLuint texture);
+	static void bindTexture(GLenum target, GLuint texture); //in the active slot
+	static void setEnabled(GLenum cap, bool value); //GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND... others go straight to GL
+	static void setDepthMask(bool value);
+	static void setDepthFunc(GLenum func);
+	static void setBlendFunc(GLenum src, GLenum dst);
+	static void setPolygonMode(GLenum mode);
+
+	static void invalidate(); //the real state is unknown, next calls always reach GL
+
+	//calls since the last invalidate
+	static int num_changes;
+	static int num_skipped;
+	static void renderInMenu();
+};
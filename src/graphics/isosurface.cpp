@@ -0,0 +1,241 @@
+#include "isosurface.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "mesh.h"
+#include "../framework/workqueue.h"
+#include "../framework/profiler.h"
+#include "../framework/utils.h"
+
+#define ISOSURFACE_SLAB_SIZE 8 //layers of cells per slab
+
+bool IsosurfaceExtractor::multithread = true;
+
+//corners of a cell as offsets and the 12 edges between them
+static const int s_corners[8][3] = { {0,0,0}, {1,0,0}, {0,1,0}, {1,1,0}, {0,0,1}, {1,0,1}, {0,1,1}, {1,1,1} };
+static const int s_edges[12][2] = { {0,1}, {2,3}, {4,5}, {6,7}, {0,2}, {1,3}, {4,6}, {5,7}, {0,4}, {1,5}, {2,6}, {3,7} };
+
+void IsosurfaceExtractor::setDensity(const float* data, int resolution)
+{
+	PROFILE_FUNCTION();
+
+	this->resolution = resolution;
+	density_version++;
+	density.resize((size_t)resolution * resolution * resolution);
+	for (size_t i = 0; i < density.size(); ++i)
+		density[i] = std::min(std::max(data[i], 0.f), 1.f);
+
+	int num_cells = resolution - 1;
+	int num_slabs = (num_cells + ISOSURFACE_SLAB_SIZE - 1) / ISOSURFACE_SLAB_SIZE;
+	slabs.assign(num_slabs, sSlab());
+	cell_vertex.assign((size_t)num_cells * num_cells * num_cells, -1);
+
+	//range of the samples used by the cells of every slab
+	size_t layer = (size_t)resolution * resolution;
+	for (int s = 0; s < num_slabs; ++s)
+	{
+		int z0 = s * ISOSURFACE_SLAB_SIZE;
+		int z1 = std::min(z0 + ISOSURFACE_SLAB_SIZE, num_cells);
+		const float* start = &density[z0 * layer];
+		const float* end = &density[0] + (z1 + 1) * layer;
+		slabs[s].min_value = *std::min_element(start, end);
+		slabs[s].max_value = *std::max_element(start, end);
+	}
+}
+
+//central differences, points to the higher density
+glm::vec3 IsosurfaceExtractor::getGradient(int x, int y, int z) const
+{
+	int r = resolution;
+	auto sample = [&](int sx, int sy, int sz) {
+		sx = std::min(std::max(sx, 0), r - 1);
+		sy = std::min(std::max(sy, 0), r - 1);
+		sz = std::min(std::max(sz, 0), r - 1);
+		return density[sx + (size_t)sy * r + (size_t)sz * r * r];
+	};
+	return glm::vec3(sample(x + 1, y, z) - sample(x - 1, y, z), sample(x, y + 1, z) - sample(x, y - 1, z), sample(x, y, z + 1) - sample(x, y, z - 1));
+}
+
+//one vertex per cell with corners on both sides, at the average of the edge crossings
+void IsosurfaceExtractor::extractVertices(int slab_index, float threshold)
+{
+	sSlab& slab = slabs[slab_index];
+	slab.vertices.clear();
+	slab.normals.clear();
+
+	int r = resolution;
+	int num_cells = r - 1;
+	int z0 = slab_index * ISOSURFACE_SLAB_SIZE;
+	int z1 = std::min(z0 + ISOSURFACE_SLAB_SIZE, num_cells);
+	if (threshold < slab.min_value || threshold >= slab.max_value)
+		return;
+
+	float to_local = 2.f / r;
+	float values[8];
+	for (int z = z0; z < z1; ++z)
+		for (int y = 0; y < num_cells; ++y)
+			for (int x = 0; x < num_cells; ++x)
+			{
+				int mask = 0;
+				for (int i = 0; i < 8; ++i)
+				{
+					values[i] = density[(x + s_corners[i][0]) + (size_t)(y + s_corners[i][1]) * r + (size_t)(z + s_corners[i][2]) * r * r];
+					if (values[i] > threshold)
+						mask |= 1 << i;
+				}
+				if (mask == 0 || mask == 255)
+					continue;
+
+				glm::vec3 position(0.f);
+				glm::vec3 gradient(0.f);
+				int num_crossings = 0;
+				for (int e = 0; e < 12; ++e)
+				{
+					int a = s_edges[e][0];
+					int b = s_edges[e][1];
+					if (((mask >> a) & 1) == ((mask >> b) & 1))
+						continue;
+					float f = (threshold - values[a]) / (values[b] - values[a]);
+					glm::vec3 pa(x + s_corners[a][0], y + s_corners[a][1], z + s_corners[a][2]);
+					glm::vec3 pb(x + s_corners[b][0], y + s_corners[b][1], z + s_corners[b][2]);
+					position += pa + (pb - pa) * f;
+					glm::vec3 ga = getGradient((int)pa.x, (int)pa.y, (int)pa.z);
+					glm::vec3 gb = getGradient((int)pb.x, (int)pb.y, (int)pb.z);
+					gradient += ga + (gb - ga) * f;
+					num_crossings++;
+				}
+				position = position * (1.f / num_crossings);
+
+				//sample i is at the center of the texel i, like the texture
+				cell_vertex[x + (size_t)y * num_cells + (size_t)z * num_cells * num_cells] = (int)slab.vertices.size();
+				slab.vertices.push_back(position * to_local + glm::vec3(to_local * 0.5f - 1.f));
+				float length = std::sqrt(glm::dot(gradient, gradient));
+				slab.normals.push_back(length > 0.f ? gradient * (-1.f / length) : glm::vec3(0.f, 1.f, 0.f));
+			}
+}
+
+//a quad joins the four cells around every edge with a sign change, facing the lower density
+//slab s owns the edges that start at the sample layers of its cells
+void IsosurfaceExtractor::extractQuads(int slab_index, float threshold)
+{
+	sSlab& slab = slabs[slab_index];
+	slab.quads.clear();
+
+	int r = resolution;
+	int num_cells = r - 1;
+	int z0 = slab_index * ISOSURFACE_SLAB_SIZE;
+	int z1 = std::min(z0 + ISOSURFACE_SLAB_SIZE, num_cells);
+	if (threshold < slab.min_value || threshold >= slab.max_value)
+		return;
+
+	auto cell = [&](int x, int y, int z) { return x + y * num_cells + z * num_cells * num_cells; };
+	auto addQuad = [&](bool inside_first, int c00, int c10, int c11, int c01) {
+		if (!inside_first)
+			std::swap(c10, c01);
+		slab.quads.push_back(c00);
+		slab.quads.push_back(c10);
+		slab.quads.push_back(c11);
+		slab.quads.push_back(c01);
+	};
+
+	for (int z = z0; z < z1; ++z)
+		for (int y = 0; y < r; ++y)
+			for (int x = 0; x < r; ++x)
+			{
+				bool inside = density[x + (size_t)y * r + (size_t)z * r * r] > threshold;
+				//along x, cells around in (y, z)
+				if (x < num_cells && y > 0 && y < r - 1 && z > 0 && inside != (density[x + 1 + (size_t)y * r + (size_t)z * r * r] > threshold))
+					addQuad(inside, cell(x, y - 1, z - 1), cell(x, y, z - 1), cell(x, y, z), cell(x, y - 1, z));
+				//along y, cells around in (z, x)
+				if (y < num_cells && x > 0 && x < r - 1 && z > 0 && inside != (density[x + (size_t)(y + 1) * r + (size_t)z * r * r] > threshold))
+					addQuad(inside, cell(x - 1, y, z - 1), cell(x - 1, y, z), cell(x, y, z), cell(x, y, z - 1));
+				//along z, cells around in (x, y)
+				if (x > 0 && x < r - 1 && y > 0 && y < r - 1 && inside != (density[x + (size_t)y * r + (size_t)(z + 1) * r * r] > threshold))
+					addQuad(inside, cell(x - 1, y - 1, z), cell(x, y - 1, z), cell(x, y, z), cell(x - 1, y, z));
+			}
+}
+
+bool IsosurfaceExtractor::extract(float threshold, Mesh* mesh)
+{
+	int num_slabs = (int)slabs.size();
+	bool pending = false;
+	for (sSlab& slab : slabs)
+		pending |= !slab.valid;
+	if (!num_slabs || (!pending && threshold == this->threshold))
+		return false;
+
+	PROFILE_FUNCTION();
+	long start_time = getTime();
+
+	//only the slabs where the surface was or will be
+	std::vector<int> dirty;
+	for (int s = 0; s < num_slabs; ++s)
+	{
+		sSlab& slab = slabs[s];
+		bool had_surface = this->threshold >= slab.min_value && this->threshold < slab.max_value;
+		bool has_surface = threshold >= slab.min_value && threshold < slab.max_value;
+		if (!slab.valid || had_surface || has_surface)
+			dirty.push_back(s);
+	}
+	num_slabs_extracted = (int)dirty.size();
+
+	//the quads read the vertices of the previous slab, so all the vertices go first
+	auto vertices_job = [&](int i) { extractVertices(dirty[i], threshold); };
+	auto quads_job = [&](int i) { extractQuads(dirty[i], threshold); slabs[dirty[i]].valid = true; };
+	if (multithread && dirty.size() > 1)
+	{
+		WorkQueue::parallelFor((int)dirty.size(), vertices_job);
+		WorkQueue::parallelFor((int)dirty.size(), quads_job);
+	}
+	else
+	{
+		for (int i = 0; i < (int)dirty.size(); ++i)
+			vertices_job(i);
+		for (int i = 0; i < (int)dirty.size(); ++i)
+			quads_job(i);
+	}
+	this->threshold = threshold;
+
+	//join the slabs, the cells of the quads become indices
+	std::vector<unsigned int> vertex_base(num_slabs + 1, 0);
+	std::vector<unsigned int> triangle_base(num_slabs + 1, 0);
+	for (int s = 0; s < num_slabs; ++s)
+	{
+		vertex_base[s + 1] = vertex_base[s] + (unsigned int)slabs[s].vertices.size();
+		triangle_base[s + 1] = triangle_base[s] + (unsigned int)slabs[s].quads.size() / 2;
+	}
+
+	mesh->clear();
+	mesh->vertices.resize(vertex_base[num_slabs]);
+	mesh->normals.resize(vertex_base[num_slabs]);
+	mesh->indices.resize(triangle_base[num_slabs]);
+	int cells_per_slab = (resolution - 1) * (resolution - 1) * ISOSURFACE_SLAB_SIZE;
+	auto join_job = [&](int s) {
+		sSlab& slab = slabs[s];
+		std::copy(slab.vertices.begin(), slab.vertices.end(), mesh->vertices.begin() + vertex_base[s]);
+		std::copy(slab.normals.begin(), slab.normals.end(), mesh->normals.begin() + vertex_base[s]);
+		glm::uvec3* triangles = mesh->indices.data() + triangle_base[s];
+		for (size_t q = 0; q < slab.quads.size(); q += 4)
+		{
+			unsigned int corners[4];
+			for (int i = 0; i < 4; ++i)
+			{
+				int c = slab.quads[q + i];
+				corners[i] = vertex_base[c / cells_per_slab] + cell_vertex[c];
+			}
+			*triangles++ = glm::uvec3(corners[0], corners[1], corners[2]);
+			*triangles++ = glm::uvec3(corners[0], corners[2], corners[3]);
+		}
+	};
+	if (multithread && num_slabs > 1)
+		WorkQueue::parallelFor(num_slabs, join_job);
+	else
+		for (int s = 0; s < num_slabs; ++s)
+			join_job(s);
+
+	if (mesh->vertices.size())
+		mesh->updateBoundingBox();
+	extraction_time = getTime() - start_time;
+	return true;
+}
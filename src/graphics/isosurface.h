@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+class Mesh;
+
+//builds the triangle mesh of the surface where a density grid crosses a threshold (naive surface nets, a dual method)
+//the cells are split in slabs along z that are extracted in parallel, every slab keeps its result
+//and is only extracted again when the old or the new threshold is inside its density range
+//one extraction at a time, it can run in a worker as it doesnt touch GL
+class IsosurfaceExtractor
+{
+public:
+	static bool multithread;
+
+	int resolution = 0; //samples per axis
+	unsigned int density_version = 0; //changes with every setDensity
+	std::vector<float> density; //resolution^3, x first
+	float threshold = 0.f; //of the current mesh
+
+	//stats of the last extraction
+	int num_slabs_extracted = 0;
+	long extraction_time = 0; //ms
+
+	void setDensity(const float* data, int resolution); //copied clamped to [0,1] like the R8 texture, the mesh is extracted again
+	bool extract(float threshold, Mesh* mesh); //the grid covers [-1,1] like the density texture, returns true if the mesh changed (not uploaded)
+
+private:
+	struct sSlab
+	{
+		bool valid = false;
+		float min_value = 0.f;
+		float max_value = 0.f;
+		std::vector<glm::vec3> vertices;
+		std::vector<glm::vec3> normals;
+		std::vector<int> quads; //4 cells per quad, their vertices are the corners
+	};
+	std::vector<sSlab> slabs;
+	std::vector<int> cell_vertex; //index in the slab of the vertex of every active cell
+
+	void extractVertices(int slab_index, float threshold);
+	void extractQuads(int slab_index, float threshold);
+	glm::vec3 getGradient(int x, int y, int z) const;
+};
@@ -0,0 +1,303 @@
+#include "lightclusters.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "shader.h"
+#include "streambuffer.h"
+#include "../framework/light.h"
+#include "../framework/camera.h"
+#include "../framework/workqueue.h"
+#include "../framework/profiler.h"
+#include "../framework/includes.h"
+
+//bindings of the buffers in basic.fs
+#define LIGHT_BUFFER_BINDING 0
+#define CLUSTER_BUFFER_BINDING 1
+#define LIGHT_INDEX_BUFFER_BINDING 2
+
+bool LightClusters::enabled = true;
+bool LightClusters::multithread = true;
+int LightClusters::grid_x = 16;
+int LightClusters::grid_y = 9;
+int LightClusters::grid_z = 24;
+
+int LightClusters::num_lights = 0;
+int LightClusters::num_global_lights = 0;
+int LightClusters::num_indices = 0;
+int LightClusters::max_lights_per_cluster = 0;
+
+//std430 layout of a light in basic.fs
+struct sGPULight
+{
+	glm::vec4 position; //w is the type
+	glm::vec4 color; //a is the intensity
+	glm::vec4 direction; //w is the shininess
+	glm::vec4 params; //x is the max distance
+};
+
+//point and spot lights in view space
+struct sLocalLight
+{
+	glm::vec3 center;
+	float radius;
+	int index; //in the light buffer
+};
+
+//froxels of a depth slice, filled by its own job
+struct sSlice
+{
+	std::vector<unsigned int> counts; //per tile
+	std::vector<unsigned int> offsets; //per tile, inside indices
+	std::vector<unsigned int> indices;
+	std::vector<glm::ivec4> rects; //tiles touched by every light of the slice (x0, y0, x1, y1)
+	std::vector<int> lights;
+};
+
+static int s_supported = -1;
+static bool s_active = false;
+static GLint s_offset_alignment = 16;
+static GLuint s_buffers[3] = {};
+
+static std::vector<sGPULight> s_gpu_lights;
+static std::vector<sLocalLight> s_local_lights;
+static std::vector<sSlice> s_slices;
+static std::vector<unsigned int> s_grid; //offset and count per cluster
+static std::vector<unsigned int> s_indices;
+
+static glm::mat4 s_view;
+static glm::vec2 s_depth_params; //slice = log(depth) * x + y
+static glm::vec4 s_viewport;
+
+bool LightClusters::isSupported()
+{
+	if (s_supported == -1)
+	{
+		s_supported = glfwExtensionSupported("GL_ARB_shader_storage_buffer_object") && glBindBufferRange != 0 ? 1 : 0;
+		if (!s_supported)
+			std::cout << "[WARN] GL_ARB_shader_storage_buffer_object not supported, lights are rendered in multiple passes" << std::endl;
+		else
+			glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &s_offset_alignment);
+	}
+	return s_supported == 1;
+}
+
+bool LightClusters::isActive()
+{
+	return enabled && s_active;
+}
+
+//the stream buffer holds it until the GPU is done, otherwise a buffer of its own is reallocated
+static void uploadBuffer(int binding, const void* data, size_t bytes)
+{
+	size_t offset;
+	if (StreamBuffer::upload(data, bytes, offset, s_offset_alignment))
+	{
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, StreamBuffer::getBufferId(), offset, bytes);
+		return;
+	}
+
+	if (!s_buffers[binding])
+		glGenBuffers(1, &s_buffers[binding]);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_buffers[binding]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, data, GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, s_buffers[binding]);
+}
+
+//tiles covered by the part of the sphere between the depths z0 and z1, false if it is out of the screen
+static bool getTileRect(const glm::mat4& projection, const sLocalLight& light, float z0, float z1, glm::ivec4& rect)
+{
+	//radius of the sphere at the slice depth closest to its center
+	float depth = -light.center.z;
+	float dz = glm::clamp(depth, z0, z1) - depth;
+	float radius = std::sqrt(std::max(light.radius * light.radius - dz * dz, 0.f));
+
+	glm::vec2 ndc_min = glm::vec2(1e10f);
+	glm::vec2 ndc_max = glm::vec2(-1e10f);
+	for (int i = 0; i < 8; ++i)
+	{
+		glm::vec4 corner = glm::vec4(light.center.x + (i & 1 ? radius : -radius), light.center.y + (i & 2 ? radius : -radius), i & 4 ? -z1 : -z0, 1.f);
+		glm::vec4 clip = projection * corner;
+		glm::vec2 ndc = glm::vec2(clip) / clip.w;
+		ndc_min = glm::min(ndc_min, ndc);
+		ndc_max = glm::max(ndc_max, ndc);
+	}
+	if (ndc_max.x < -1.f || ndc_max.y < -1.f || ndc_min.x > 1.f || ndc_min.y > 1.f)
+		return false;
+
+	int gx = LightClusters::grid_x;
+	int gy = LightClusters::grid_y;
+	rect.x = glm::clamp((int)std::floor((ndc_min.x * 0.5f + 0.5f) * gx), 0, gx - 1);
+	rect.y = glm::clamp((int)std::floor((ndc_min.y * 0.5f + 0.5f) * gy), 0, gy - 1);
+	rect.z = glm::clamp((int)std::floor((ndc_max.x * 0.5f + 0.5f) * gx), 0, gx - 1);
+	rect.w = glm::clamp((int)std::floor((ndc_max.y * 0.5f + 0.5f) * gy), 0, gy - 1);
+	return true;
+}
+
+void LightClusters::update(Camera* camera, const std::vector<Light*>& lights)
+{
+	PROFILE_FUNCTION();
+
+	s_active = false;
+	if (!enabled || !isSupported())
+		return;
+
+	//directional lights first, they are not assigned to clusters
+	s_gpu_lights.clear();
+	s_local_lights.clear();
+	for (int pass = 0; pass < 2; ++pass)
+		for (Light* light : lights)
+		{
+			bool directional = light->light_type == LIGHT_DIRECTIONAL;
+			if (directional != (pass == 0))
+				continue;
+
+			const glm::mat4& model = light->getModel();
+			sGPULight gpu_light;
+			gpu_light.position = glm::vec4(glm::vec3(model[3]), (float)light->light_type);
+			gpu_light.color = glm::vec4(glm::vec3(light->color), light->intensity);
+			gpu_light.direction = glm::vec4(glm::vec3(model[2]), light->shininess);
+			gpu_light.params = glm::vec4(light->max_distance, 0.f, 0.f, 0.f);
+
+			if (!directional)
+			{
+				sLocalLight local;
+				local.center = glm::vec3(camera->view_matrix * glm::vec4(glm::vec3(model[3]), 1.f));
+				local.radius = light->max_distance;
+				local.index = (int)s_gpu_lights.size();
+				s_local_lights.push_back(local);
+			}
+			s_gpu_lights.push_back(gpu_light);
+		}
+	num_lights = (int)s_gpu_lights.size();
+	num_global_lights = num_lights - (int)s_local_lights.size();
+
+	//exponential slices, the ones close to the camera are thin
+	float near_plane = camera->near_plane;
+	float far_plane = camera->far_plane;
+	float log_ratio = std::log(far_plane / near_plane);
+	s_depth_params = glm::vec2(grid_z / log_ratio, -grid_z * std::log(near_plane) / log_ratio);
+	s_view = camera->view_matrix;
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	s_viewport = glm::vec4(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+	int num_tiles = grid_x * grid_y;
+	s_slices.resize(grid_z);
+
+	//every slice counts the lights per tile and then writes their indices, nothing is shared between slices
+	auto assignSlice = [&](int z) {
+		sSlice& slice = s_slices[z];
+		slice.counts.assign(num_tiles, 0);
+		slice.offsets.resize(num_tiles);
+		slice.rects.clear();
+		slice.lights.clear();
+
+		float z0 = near_plane * std::pow(far_plane / near_plane, z / (float)grid_z);
+		float z1 = near_plane * std::pow(far_plane / near_plane, (z + 1) / (float)grid_z);
+		for (const sLocalLight& light : s_local_lights)
+		{
+			float depth = -light.center.z;
+			glm::ivec4 rect;
+			if (depth + light.radius < z0 || depth - light.radius > z1 || !getTileRect(camera->projection_matrix, light, z0, z1, rect))
+				continue;
+			slice.rects.push_back(rect);
+			slice.lights.push_back(light.index);
+			for (int y = rect.y; y <= rect.w; ++y)
+				for (int x = rect.x; x <= rect.z; ++x)
+					slice.counts[x + y * grid_x]++;
+		}
+
+		unsigned int total = 0;
+		for (int i = 0; i < num_tiles; ++i)
+		{
+			slice.offsets[i] = total;
+			total += slice.counts[i];
+		}
+		slice.indices.resize(total);
+
+		std::vector<unsigned int> cursor = slice.offsets;
+		for (size_t i = 0; i < slice.lights.size(); ++i)
+		{
+			const glm::ivec4& rect = slice.rects[i];
+			for (int y = rect.y; y <= rect.w; ++y)
+				for (int x = rect.x; x <= rect.z; ++x)
+					slice.indices[cursor[x + y * grid_x]++] = slice.lights[i];
+		}
+	};
+	if (multithread && s_local_lights.size() > 8)
+		WorkQueue::parallelFor(grid_z, assignSlice);
+	else
+		for (int z = 0; z < grid_z; ++z)
+			assignSlice(z);
+
+	//concatenate the slices, cluster index is x + y * grid_x + z * grid_x * grid_y
+	s_grid.resize(num_tiles * grid_z * 2);
+	s_indices.clear();
+	max_lights_per_cluster = 0;
+	for (int z = 0; z < grid_z; ++z)
+	{
+		sSlice& slice = s_slices[z];
+		unsigned int base = (unsigned int)s_indices.size();
+		for (int i = 0; i < num_tiles; ++i)
+		{
+			s_grid[(z * num_tiles + i) * 2] = base + slice.offsets[i];
+			s_grid[(z * num_tiles + i) * 2 + 1] = slice.counts[i];
+			max_lights_per_cluster = std::max(max_lights_per_cluster, (int)slice.counts[i]);
+		}
+		s_indices.insert(s_indices.end(), slice.indices.begin(), slice.indices.end());
+	}
+	num_indices = (int)s_indices.size();
+
+	//empty buffers cannot be bound
+	if (s_gpu_lights.empty())
+		s_gpu_lights.push_back(sGPULight());
+	if (s_indices.empty())
+		s_indices.push_back(0);
+
+	uploadBuffer(LIGHT_BUFFER_BINDING, s_gpu_lights.data(), s_gpu_lights.size() * sizeof(sGPULight));
+	uploadBuffer(CLUSTER_BUFFER_BINDING, s_grid.data(), s_grid.size() * sizeof(unsigned int));
+	uploadBuffer(LIGHT_INDEX_BUFFER_BINDING, s_indices.data(), s_indices.size() * sizeof(unsigned int));
+	s_active = true;
+}
+
+void LightClusters::setUniforms(Shader* shader)
+{
+	shader->setUniform("u_view", s_view);
+	shader->setUniform3("u_cluster_grid", grid_x, grid_y, grid_z);
+	shader->setUniform("u_cluster_depth", s_depth_params);
+	shader->setUniform("u_viewport", s_viewport);
+	shader->setUniform("u_num_global_lights", num_global_lights);
+}
+
+void LightClusters::release()
+{
+	for (int i = 0; i < 3; ++i)
+		if (s_buffers[i])
+			glDeleteBuffers(1, &s_buffers[i]);
+	memset(s_buffers, 0, sizeof(s_buffers));
+	s_active = false;
+}
+
+void LightClusters::renderInMenu()
+{
+	if (!isSupported())
+	{
+		ImGui::Text("Clustered lighting not supported");
+		return;
+	}
+	ImGui::Checkbox("Clustered lighting", &enabled);
+	ImGui::Checkbox("Multithread", &multithread);
+	int grid[3] = { grid_x, grid_y, grid_z };
+	if (ImGui::DragInt3("Clusters", grid, 0.1f, 1, 64))
+	{
+		grid_x = std::max(grid[0], 1);
+		grid_y = std::max(grid[1], 1);
+		grid_z = std::max(grid[2], 1);
+	}
+	ImGui::Text("%d lights (%d directional)", num_lights, num_global_lights);
+	ImGui::Text("%d indices, max %d per cluster", num_indices, max_lights_per_cluster);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+
+class Light;
+class Camera;
+class Shader;
+
+//clustered forward lighting: the view frustum is split in a grid of froxels (tiles in screen, exponential slices in depth)
+//every frame the CPU assigns the point and spot lights to the froxels their max_distance sphere touches
+//the lights, the grid and the light indices go to shader storage buffers so basic.fs shades every light in one pass
+//directional lights touch everything, they are at the start of the light buffer and not in the grid
+class LightClusters
+{
+public:
+	static bool enabled;
+	static bool multithread; //one job per depth slice
+	static int grid_x, grid_y, grid_z;
+
+	//stats of the last update
+	static int num_lights;
+	static int num_global_lights;
+	static int num_indices;
+	static int max_lights_per_cluster;
+
+	static bool isSupported(); //GL_ARB_shader_storage_buffer_object
+	static bool isActive(); //buffers ready for this frame
+
+	static void update(Camera* camera, const std::vector<Light*>& lights); //after the transforms, before rendering
+	static void setUniforms(Shader* shader); //the shader must be built with USE_CLUSTERED_LIGHTING
+
+	static void release();
+	static void renderInMenu();
+};
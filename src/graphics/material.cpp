@@ -3,11 +3,206 @@
 #include "texture.h"
 #include "openvdbReader.h"
 #include "bbox.h"
+#include "glstate.h"
+#include "lightclusters.h"
+#include "distancefield.h"
 
 #include <istream>
 #include <fstream>
 #include <algorithm>
 
+#include "../framework/filewatcher.h"
+#include "../framework/workqueue.h"
+#include "../framework/profiler.h"
+
+#define VDB_RESOLUTION 128
+
+// Converts the vdb into a density volume of VDB_RESOLUTION^3 voxels, only the last grid ends up in the texture
+// It doesn't touch GL so it can run in a worker, the caller owns the returned data
+static float* bakeVDBDensity(easyVDB::OpenVDBReader* vdbReader)
+{
+	PROFILE_FUNCTION();
+
+	int resolution = VDB_RESOLUTION;
+	float radius = 2.0;
+
+	int convertedGrids = 0;
+	int convertedVoxels = 0;
+
+	int totalGrids = vdbReader->gridsSize;
+	int totalVoxels = totalGrids * pow(resolution, 3);
+
+	float resolutionInv = 1.0f / resolution;
+	int resolutionPow2 = pow(resolution, 2);
+	int resolutionPow3 = pow(resolution, 3);
+
+	if (totalGrids == 0)
+		return NULL;
+
+	// read the last grid data and convert it to a texture
+	easyVDB::Grid& grid = vdbReader->grids[totalGrids - 1];
+	float* data = new float[resolutionPow3];
+	memset(data, 0, sizeof(float) * resolutionPow3);
+
+	// Bbox
+	easyVDB::Bbox bbox = easyVDB::Bbox();
+	bbox = grid.getPreciseWorldBbox();
+	glm::vec3 target = bbox.getCenter();
+	glm::vec3 size = bbox.getSize();
+	glm::vec3 step = size * resolutionInv;
+
+	grid.transform->applyInverseTransformMap(step);
+	target = target - (size * 0.5f);
+	grid.transform->applyInverseTransformMap(target);
+	target = target + (step * 0.5f);
+
+	int x = 0;
+	int y = 0;
+	int z = 0;
+
+	for (unsigned int j = 0; j < resolutionPow3; j++) {
+		int baseX = x;
+		int baseY = y;
+		int baseZ = z;
+		int baseIndex = baseX + baseY * resolution + baseZ * resolutionPow2;
+
+		if (target.x >= 40 && target.y >= 40.33 && target.z >= 10.36) {
+			int a = 0;
+		}
+
+		float value = grid.getValue(target);
+
+		int cellBleed = radius;
+
+		if (cellBleed) {
+			for (int sx = -cellBleed; sx < cellBleed; sx++) {
+				for (int sy = -cellBleed; sy < cellBleed; sy++) {
+					for (int sz = -cellBleed; sz < cellBleed; sz++) {
+						if (x + sx < 0.0 || x + sx >= resolution ||
+							y + sy < 0.0 || y + sy >= resolution ||
+							z + sz < 0.0 || z + sz >= resolution) {
+							continue;
+						}
+
+						int targetIndex = baseIndex + sx + sy * resolution + sz * resolutionPow2;
+
+						float offset = std::max(0.0, std::min(1.0, 1.0 - std::hypot(sx, sy, sz) / (radius / 2.0)));
+						float dataValue = offset * value * 255.f;
+
+						data[targetIndex] += dataValue;
+						data[targetIndex] = std::min((float)data[targetIndex], 255.f);
+					}
+				}
+			}
+		}
+		else {
+			float dataValue = value * 255.f;
+
+			data[baseIndex] += dataValue;
+			data[baseIndex] = std::min((float)data[baseIndex], 255.f);
+		}
+
+		convertedVoxels++;
+
+		if (z >= resolution) {
+			break;
+		}
+
+		x++;
+		target.x += step.x;
+
+		if (x >= resolution) {
+			x = 0;
+			target.x -= step.x * resolution;
+
+			y++;
+			target.y += step.y;
+		}
+
+		if (y >= resolution) {
+			y = 0;
+			target.y -= step.y * resolution;
+
+			z++;
+			target.z += step.z;
+		}
+
+		// yield
+	}
+
+	return data;
+}
+
+static void uploadVDBDensity(Material* material, float* data)
+{
+	// now we create the texture with the data
+	// use this: https://www.khronos.org/opengl/wiki/OpenGL_Type
+	// and this: https://registry.khronos.org/OpenGL-Refpages/gl4/html/glTexImage3D.xhtml
+	if (!material->texture)
+		material->texture = new Texture();
+	material->texture->create3D(VDB_RESOLUTION, VDB_RESOLUTION, VDB_RESOLUTION, GL_RED, GL_FLOAT, false, data, GL_R8);
+
+	//the isosurface extracts its mesh from a copy, a new extractor so the one in a worker is not modified
+	if (IsosurfaceMaterial* isosurface = dynamic_cast<IsosurfaceMaterial*>(material))
+	{
+		std::shared_ptr<IsosurfaceExtractor> extractor = std::make_shared<IsosurfaceExtractor>();
+		extractor->density_version = isosurface->extractor->density_version;
+		extractor->setDensity(data, VDB_RESOLUTION);
+		isosurface->extractor = extractor;
+	}
+
+	//any density counts, the proxy doesnt depend on the threshold or the scale of the sliders
+	Mesh** proxy_mesh = NULL;
+	if (VolumeMaterial* volume = dynamic_cast<VolumeMaterial*>(material))
+		proxy_mesh = &volume->proxy_mesh;
+	else if (IsosurfaceMaterial* isosurface = dynamic_cast<IsosurfaceMaterial*>(material))
+		proxy_mesh = &isosurface->proxy_mesh;
+	if (proxy_mesh)
+	{
+		if (!*proxy_mesh)
+			*proxy_mesh = new Mesh();
+		VolumeProxy::build(data, VDB_RESOLUTION, 0.f, *proxy_mesh);
+	}
+}
+
+// The proxy replaces the box only from outside of it, from inside its front faces can be behind the camera
+static Mesh* selectVolumeProxy(Mesh* mesh, Mesh* proxy_mesh, const glm::mat4& inverse_model, Camera* camera)
+{
+	if (!proxy_mesh || !proxy_mesh->getNumVertices())
+		return mesh;
+	glm::vec3 local_camera_pos = glm::vec3(inverse_model * glm::vec4(camera->eye, 1.0));
+	glm::vec3 min = mesh->aabb_min, max = mesh->aabb_max;
+	if (local_camera_pos.x >= min.x && local_camera_pos.y >= min.y && local_camera_pos.z >= min.z &&
+		local_camera_pos.x <= max.x && local_camera_pos.y <= max.y && local_camera_pos.z <= max.z)
+		return mesh;
+	return proxy_mesh;
+}
+
+// Reads the vdb again in a worker when the file changes, the texture is replaced in the main thread
+static void watchVDB(Material* material, const std::string& file_path)
+{
+	FileWatcher::watch(file_path, material, [material, file_path]() {
+		unsigned int version = FileWatcher::getVersion(file_path, material);
+		WorkQueue::submit([material, file_path, version]() {
+			easyVDB::OpenVDBReader* vdbReader = new easyVDB::OpenVDBReader();
+			{
+				PROFILE_SCOPE("readVDB");
+				vdbReader->read(file_path);
+			}
+			float* data = bakeVDBDensity(vdbReader);
+			delete vdbReader;
+			if (!data)
+				return;
+			WorkQueue::runOnMainThread([material, file_path, version, data]() {
+				//the material was destroyed or a newer save is on its way
+				if (FileWatcher::getVersion(file_path, material) == version)
+					uploadVDBDensity(material, data);
+				delete[] data;
+			});
+		});
+	});
+}
+
 
 FlatMaterial::FlatMaterial(glm::vec4 color)
 {
@@ -17,7 +212,7 @@ FlatMaterial::FlatMaterial(glm::vec4 color)
 
 FlatMaterial::~FlatMaterial() { }
 
-void FlatMaterial::setUniforms(Camera* camera, glm::mat4 model)
+void FlatMaterial::setUniforms(Camera* camera, const glm::mat4& model, const glm::mat4& inverse_model)
 {
 	//upload node uniforms
 	this->shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
@@ -27,14 +222,14 @@ void FlatMaterial::setUniforms(Camera* camera, glm::mat4 model)
 	this->shader->setUniform("u_color", this->color);
 }
 
-void FlatMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
+void FlatMaterial::render(Mesh* mesh, const glm::mat4& model, const glm::mat4& inverse_model, Camera* camera)
 {
 	if (mesh && this->shader) {
 		// enable shader
 		this->shader->enable();
 
 		// upload uniforms
-		setUniforms(camera, model);
+		setUniforms(camera, model, inverse_model);
 
 		// do the draw call
 		mesh->render(GL_TRIANGLES);
@@ -43,6 +238,35 @@ void FlatMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
 	}
 }
 
+void FlatMaterial::renderInstanced(Mesh* mesh, const std::vector<glm::mat4>& models, const std::vector<glm::vec4>& colors, Camera* camera)
+{
+	if (!mesh || !this->shader || models.empty())
+		return;
+
+	//the instanced variant reads u_model and u_color from the instance attributes
+	Shader* instanced_shader = this->shader->getVariant("#define USE_INSTANCING\n");
+	if (!instanced_shader || !instanced_shader->compiled)
+	{
+		//still linking, the fallback shader has no instance attributes
+		glm::vec4 material_color = this->color;
+		for (size_t i = 0; i < models.size(); ++i)
+		{
+			this->color = colors[i];
+			render(mesh, models[i], glm::inverse(models[i]), camera);
+		}
+		this->color = material_color;
+		return;
+	}
+
+	instanced_shader->enable();
+	instanced_shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
+	instanced_shader->setUniform("u_camera_position", camera->eye);
+
+	mesh->renderInstanced(GL_TRIANGLES, models.data(), (int)models.size(), colors.data());
+
+	instanced_shader->disable();
+}
+
 void FlatMaterial::renderInMenu()
 {
 	ImGui::ColorEdit3("Color", (float*)&this->color);
@@ -56,24 +280,24 @@ WireframeMaterial::WireframeMaterial()
 
 WireframeMaterial::~WireframeMaterial() { }
 
-void WireframeMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
+void WireframeMaterial::render(Mesh* mesh, const glm::mat4& model, const glm::mat4& inverse_model, Camera* camera)
 {
 	if (this->shader && mesh)
 	{
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		glDisable(GL_CULL_FACE);
+		GLState::setPolygonMode(GL_LINE);
+		GLState::setEnabled(GL_CULL_FACE, false);
 
 		//enable shader
 		this->shader->enable();
 
 		//upload material specific uniforms
-		setUniforms(camera, model);
+		setUniforms(camera, model, inverse_model);
 
 		//do the draw call
 		mesh->render(GL_TRIANGLES);
 
-		glEnable(GL_CULL_FACE);
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		GLState::setEnabled(GL_CULL_FACE, true);
+		GLState::setPolygonMode(GL_FILL);
 	}
 }
 
@@ -87,7 +311,7 @@ StandardMaterial::StandardMaterial(glm::vec4 color)
 
 StandardMaterial::~StandardMaterial() { }
 
-void StandardMaterial::setUniforms(Camera* camera, glm::mat4 model)
+void StandardMaterial::setUniforms(Camera* camera, const glm::mat4& model, const glm::mat4& inverse_model)
 {
 	//upload node uniforms
 	this->shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
@@ -101,8 +325,26 @@ void StandardMaterial::setUniforms(Camera* camera, glm::mat4 model)
 	}
 }
 
-void StandardMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
+void StandardMaterial::render(Mesh* mesh, const glm::mat4& model, const glm::mat4& inverse_model, Camera* camera)
 {
+	//all the lights in a single pass, the fragment shader reads the ones of its cluster
+	if (mesh && this->shader == this->base_shader && LightClusters::isActive())
+	{
+		Shader* clustered_shader = this->shader->getVariant("#define USE_CLUSTERED_LIGHTING\n");
+		if (clustered_shader && clustered_shader->compiled)
+		{
+			this->shader = clustered_shader;
+			this->shader->enable();
+			setUniforms(camera, model, inverse_model);
+			LightClusters::setUniforms(this->shader);
+			this->shader->setUniform("u_ambient_light", Application::instance->ambient_light);
+			mesh->render(GL_TRIANGLES);
+			this->shader->disable();
+			this->shader = this->base_shader;
+			return;
+		}
+	}
+
 	bool first_pass = true;
 	if (mesh && this->shader)
 	{
@@ -116,18 +358,18 @@ void StandardMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
 			if (nlight == -1) { nlight++; } // hotfix
 
 			// upload uniforms
-			setUniforms(camera, model);
+			setUniforms(camera, model, inverse_model);
 
 			// upload light uniforms
 			if (!first_pass) {
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-				glDepthFunc(GL_LEQUAL);
+				GLState::setBlendFunc(GL_SRC_ALPHA, GL_ONE);
+				GLState::setDepthFunc(GL_LEQUAL);
 			}
 			this->shader->setUniform("u_ambient_light", Application::instance->ambient_light * (float)first_pass);
 
 			if (num_lights > 0) {
 				Light* light = Application::instance->light_list[nlight];
-				light->setUniforms(this->shader, model);
+				light->setUniforms(this->shader, inverse_model);
 			}
 			else {
 				// Set some uniforms in case there is no light
@@ -161,6 +403,63 @@ void StandardMaterial::renderInMenu()
 	if (!this->show_normals) ImGui::ColorEdit3("Color", (float*)&this->color);
 }
 
+#define MAX_VOLUME_LIGHTS 16 //same as fullvolume.fs
+
+//uploads the lights whose max_distance sphere touches the world box of the volume, the strongest ones if there are too many
+//positions go in the local space of the volume like the camera, returns the number of lights
+static int setVolumeLights(Shader* shader, Mesh* mesh, const glm::mat4& model, const glm::mat4& inverse_model)
+{
+	BoundingBox local_box;
+	local_box.center = (mesh->aabb_min + mesh->aabb_max) * 0.5f;
+	local_box.halfsize = (mesh->aabb_max - mesh->aabb_min) * 0.5f;
+	BoundingBox box = transformBoundingBox(model, local_box);
+
+	std::vector<std::pair<float, Light*>> candidates; //weight, light
+	for (Light* light : Application::instance->light_list)
+	{
+		if (light->light_type == LIGHT_DIRECTIONAL)
+		{
+			candidates.push_back(std::make_pair(light->intensity, light));
+			continue;
+		}
+		glm::vec3 delta = glm::max(glm::abs(glm::vec3(light->getModel()[3]) - box.center) - box.halfsize, glm::vec3(0.f));
+		float distance = glm::length(delta);
+		if (distance >= light->max_distance)
+			continue;
+		candidates.push_back(std::make_pair(light->intensity, light)); //fullvolume.fs only uses max_distance to cull
+	}
+	if (candidates.size() > MAX_VOLUME_LIGHTS)
+	{
+		std::partial_sort(candidates.begin(), candidates.begin() + MAX_VOLUME_LIGHTS, candidates.end(),
+			[](const std::pair<float, Light*>& a, const std::pair<float, Light*>& b) { return a.first > b.first; });
+		candidates.resize(MAX_VOLUME_LIGHTS);
+	}
+
+	//distances in local units, assumes an uniform scale
+	float local_scale = glm::length(glm::vec3(inverse_model[0]));
+	glm::vec4 positions[MAX_VOLUME_LIGHTS];
+	glm::vec4 colors[MAX_VOLUME_LIGHTS];
+	int num_lights = (int)candidates.size();
+	for (int i = 0; i < num_lights; ++i)
+	{
+		Light* light = candidates[i].second;
+		const glm::mat4& light_model = light->getModel();
+		if (light->light_type == LIGHT_DIRECTIONAL)
+			positions[i] = glm::vec4(glm::normalize(glm::vec3(inverse_model * glm::vec4(glm::vec3(light_model[2]), 0.f))), 0.f);
+		else
+			positions[i] = glm::vec4(glm::vec3(inverse_model * light_model[3]), 1.f);
+		colors[i] = glm::vec4(glm::vec3(light->color) * light->intensity, light->max_distance * local_scale);
+	}
+
+	shader->setUniform("u_num_lights", num_lights);
+	if (num_lights)
+	{
+		shader->setUniform4Array("u_light_positions", (float*)positions, num_lights);
+		shader->setUniform4Array("u_light_colors", (float*)colors, num_lights);
+	}
+	return num_lights;
+}
+
 // VolumeMaterial implementation
 VolumeMaterial::VolumeMaterial(glm::vec4 color)
 {
@@ -190,137 +489,39 @@ VolumeMaterial::VolumeMaterial(glm::vec4 color)
 	this->flag_jittering = false;
 }
 
-VolumeMaterial::~VolumeMaterial() { }
+VolumeMaterial::~VolumeMaterial()
+{
+	FileWatcher::unwatch(this);
+	delete this->texture; //the density, created in uploadVDBDensity
+	delete this->proxy_mesh;
+}
 
 void VolumeMaterial::loadVDB(std::string file_path)
 {
+	PROFILE_FUNCTION();
+
 	easyVDB::OpenVDBReader* vdbReader = new easyVDB::OpenVDBReader();
 	vdbReader->read(file_path);
 
 	// now, read the grid from the vdbReader and store the data in a 3D texture
 	estimate3DTexture(vdbReader);
+
+	watchVDB(this, file_path);
 }
 
 void VolumeMaterial::estimate3DTexture(easyVDB::OpenVDBReader* vdbReader)
 {
-	int resolution = 128;
-	float radius = 2.0;
-
-	int convertedGrids = 0;
-	int convertedVoxels = 0;
-
-	int totalGrids = vdbReader->gridsSize;
-	int totalVoxels = totalGrids * pow(resolution, 3);
-
-	float resolutionInv = 1.0f / resolution;
-	int resolutionPow2 = pow(resolution, 2);
-	int resolutionPow3 = pow(resolution, 3);
-
-	// read all grids data and convert to texture
-	for (unsigned int i = 0; i < totalGrids; i++) {
-		easyVDB::Grid& grid = vdbReader->grids[i];
-		float* data = new float[resolutionPow3];
-		memset(data, 0, sizeof(float) * resolutionPow3);
-
-		// Bbox
-		easyVDB::Bbox bbox = easyVDB::Bbox();
-		bbox = grid.getPreciseWorldBbox();
-		glm::vec3 target = bbox.getCenter();
-		glm::vec3 size = bbox.getSize();
-		glm::vec3 step = size * resolutionInv;
-
-		grid.transform->applyInverseTransformMap(step);
-		target = target - (size * 0.5f);
-		grid.transform->applyInverseTransformMap(target);
-		target = target + (step * 0.5f);
-
-		int x = 0;
-		int y = 0;
-		int z = 0;
-
-		for (unsigned int j = 0; j < resolutionPow3; j++) {
-			int baseX = x;
-			int baseY = y;
-			int baseZ = z;
-			int baseIndex = baseX + baseY * resolution + baseZ * resolutionPow2;
-
-			if (target.x >= 40 && target.y >= 40.33 && target.z >= 10.36) {
-				int a = 0;
-			}
-
-			float value = grid.getValue(target);
-
-			int cellBleed = radius;
-
-			if (cellBleed) {
-				for (int sx = -cellBleed; sx < cellBleed; sx++) {
-					for (int sy = -cellBleed; sy < cellBleed; sy++) {
-						for (int sz = -cellBleed; sz < cellBleed; sz++) {
-							if (x + sx < 0.0 || x + sx >= resolution ||
-								y + sy < 0.0 || y + sy >= resolution ||
-								z + sz < 0.0 || z + sz >= resolution) {
-								continue;
-							}
-
-							int targetIndex = baseIndex + sx + sy * resolution + sz * resolutionPow2;
-
-							float offset = std::max(0.0, std::min(1.0, 1.0 - std::hypot(sx, sy, sz) / (radius / 2.0)));
-							float dataValue = offset * value * 255.f;
-
-							data[targetIndex] += dataValue;
-							data[targetIndex] = std::min((float)data[targetIndex], 255.f);
-						}
-					}
-				}
-			}
-			else {
-				float dataValue = value * 255.f;
-
-				data[baseIndex] += dataValue;
-				data[baseIndex] = std::min((float)data[baseIndex], 255.f);
-			}
-
-			convertedVoxels++;
-
-			if (z >= resolution) {
-				break;
-			}
-
-			x++;
-			target.x += step.x;
-
-			if (x >= resolution) {
-				x = 0;
-				target.x -= step.x * resolution;
-
-				y++;
-				target.y += step.y;
-			}
-
-			if (y >= resolution) {
-				y = 0;
-				target.y -= step.y * resolution;
-
-				z++;
-				target.z += step.z;
-			}
-
-			// yield
-		}
-
-		// now we create the texture with the data
-		// use this: https://www.khronos.org/opengl/wiki/OpenGL_Type
-		// and this: https://registry.khronos.org/OpenGL-Refpages/gl4/html/glTexImage3D.xhtml
-		this->texture = new Texture();
-		this->texture->create3D(resolution, resolution, resolution, GL_RED, GL_FLOAT, false, data, GL_R8);
-	}
+	float* data = bakeVDBDensity(vdbReader);
+	if (!data)
+		return;
+	uploadVDBDensity(this, data);
+	delete[] data;
 }
 
-void VolumeMaterial::setUniforms(Camera* camera, glm::mat4 model)
+void VolumeMaterial::setUniforms(Camera* camera, const glm::mat4& model, const glm::mat4& inverse_model)
 {
-	glm::mat4 inverseModel = glm::inverse(model);
 	glm::vec4 temp = glm::vec4(camera->eye, 1.0);
-	glm::vec3 local_camera_pos = glm::vec3((inverseModel * temp) / temp.w);
+	glm::vec3 local_camera_pos = glm::vec3((inverse_model * temp) / temp.w);
 	
 
 
@@ -349,12 +550,6 @@ void VolumeMaterial::setUniforms(Camera* camera, glm::mat4 model)
 
 	if (this->densitySource == VDB_DENSITY && this->texture) {
 		this->shader->setUniform("u_density_texture", this->texture, 0);
-		if (this->shaderType == FULL_VOLUME) {
-			this->shader->setUniform("u_emission_color", this->emissiveColor);
-			this->shader->setUniform("u_emission_intensity", this->emissiveIntensity);
-			this->shader->setUniform("u_scatter_coefficient", this->scatterCoefficient);
-			this->shader->setUniform("u_threshold", this->threshold);
-		}
 	}
 	else if (this->densitySource == NOISE_DENSITY) {
 		this->shader->setUniform("u_noise_scale", this->noiseScale);
@@ -365,9 +560,17 @@ void VolumeMaterial::setUniforms(Camera* camera, glm::mat4 model)
 		this->shader->setUniform("u_emission_color", this->emissiveColor);
 		this->shader->setUniform("u_emission_intensity", this->emissiveIntensity);
 	}
+
+	//for every density source, the program is shared and would keep the values of another material
+	if (this->shaderType == FULL_VOLUME) {
+		this->shader->setUniform("u_emission_color", this->emissiveColor);
+		this->shader->setUniform("u_emission_intensity", this->emissiveIntensity);
+		this->shader->setUniform("u_scatter_coefficient", this->scatterCoefficient);
+		this->shader->setUniform("u_threshold", this->threshold);
+	}
 }
 
-void VolumeMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
+void VolumeMaterial::render(Mesh* mesh, const glm::mat4& model, const glm::mat4& inverse_model, Camera* camera)
 {
 	if (!mesh || !this->shader) return;
 
@@ -376,15 +579,21 @@ void VolumeMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
 	this->boxMin = mesh->aabb_min;
 	this->boxMax = mesh->aabb_max;
 
-	setUniforms(camera, model);
-	Light* light = Application::instance->light_list[0];
-	light->setUniforms(this->shader, model);
-	mesh->render(GL_TRIANGLES);
+	setUniforms(camera, model, inverse_model);
+	this->num_lights = setVolumeLights(this->shader, mesh, model, inverse_model);
+
+	//the homogeneous medium fills the whole box
+	if (this->use_proxy && this->volumeType == HETEROGENEOUS && this->densitySource == VDB_DENSITY)
+		selectVolumeProxy(mesh, this->proxy_mesh, inverse_model, camera)->render(GL_TRIANGLES);
+	else
+		mesh->render(GL_TRIANGLES);
 	this->shader->disable();
 }
 
 void VolumeMaterial::renderInMenu()
 {
+	ImGui::Text("Lights touching the volume: %d", this->num_lights);
+
 	// Update shader based on the selected shader type
 	if (ImGui::Combo("Shader Type", (int*)&shaderType, "Absorption\0Absorption-Emission\0Full Volume\0")) {
 		if (shaderType == ABSORPTION) {
@@ -433,6 +642,9 @@ void VolumeMaterial::renderInMenu()
 			ImGui::SliderFloat("Emission Intensity", &this->emissiveIntensity, 0.0f, 1.0f);
 			ImGui::Checkbox("Jittering", &this->flag_jittering);
 			ImGui::SliderFloat("Threshold", &this->threshold, 0.0f, 1.0f);
+			ImGui::Checkbox("Proxy hull", &this->use_proxy);
+			if (this->proxy_mesh)
+				ImGui::Text("Proxy: %d triangles", (int)this->proxy_mesh->getNumTriangles());
 		}
 	}
 
@@ -465,143 +677,48 @@ IsosurfaceMaterial::IsosurfaceMaterial(glm::vec4 color)
 	this->volumeType = HETEROGENEOUS;
 	this->densitySource = VDB_DENSITY;
 	this->shader = Shader::Get("res/shaders/basic.vs", "res/shaders/isosurface.fs");
-	this->stepLength = 0.001f;
+	this->stepLength = 0.01f; //coarse, the refine_steps secant steps find the crossing inside the step
 	this->densityScale = 1.0f;
 	this->threshold = 0.5f;
 	this->flag_jittering = false;
 }
 
-IsosurfaceMaterial::~IsosurfaceMaterial() { } 
+IsosurfaceMaterial::~IsosurfaceMaterial()
+{
+	FileWatcher::unwatch(this);
+	delete this->texture; //the density, created in uploadVDBDensity
+	delete this->surface_mesh;
+	delete this->surface_material;
+	delete this->distance_texture;
+	delete this->proxy_mesh;
+}
 
 void IsosurfaceMaterial::loadVDB(std::string file_path) 
 {
+	PROFILE_FUNCTION();
+
 	easyVDB::OpenVDBReader* vdbReader = new easyVDB::OpenVDBReader();
 	vdbReader->read(file_path);
 
 	// now, read the grid from the vdbReader and store the data in a 3D texture
 	estimate3DTexture(vdbReader);
+
+	watchVDB(this, file_path);
 }
 
-void IsosurfaceMaterial::estimate3DTexture(easyVDB::OpenVDBReader* vdbReader) 
+void IsosurfaceMaterial::estimate3DTexture(easyVDB::OpenVDBReader* vdbReader)
 {
-	int resolution = 128;
-	float radius = 2.0;
-
-	int convertedGrids = 0;
-	int convertedVoxels = 0;
-
-	int totalGrids = vdbReader->gridsSize;
-	int totalVoxels = totalGrids * pow(resolution, 3);
-
-	float resolutionInv = 1.0f / resolution;
-	int resolutionPow2 = pow(resolution, 2);
-	int resolutionPow3 = pow(resolution, 3);
-
-	// read all grids data and convert to texture
-	for (unsigned int i = 0; i < totalGrids; i++) {
-		easyVDB::Grid& grid = vdbReader->grids[i];
-		float* data = new float[resolutionPow3];
-		memset(data, 0, sizeof(float) * resolutionPow3);
-
-		// Bbox
-		easyVDB::Bbox bbox = easyVDB::Bbox();
-		bbox = grid.getPreciseWorldBbox();
-		glm::vec3 target = bbox.getCenter();
-		glm::vec3 size = bbox.getSize();
-		glm::vec3 step = size * resolutionInv;
-
-		grid.transform->applyInverseTransformMap(step);
-		target = target - (size * 0.5f);
-		grid.transform->applyInverseTransformMap(target);
-		target = target + (step * 0.5f);
-
-		int x = 0;
-		int y = 0;
-		int z = 0;
-
-		for (unsigned int j = 0; j < resolutionPow3; j++) {
-			int baseX = x;
-			int baseY = y;
-			int baseZ = z;
-			int baseIndex = baseX + baseY * resolution + baseZ * resolutionPow2;
-
-			if (target.x >= 40 && target.y >= 40.33 && target.z >= 10.36) {
-				int a = 0;
-			}
-
-			float value = grid.getValue(target);
-
-			int cellBleed = radius;
-
-			if (cellBleed) {
-				for (int sx = -cellBleed; sx < cellBleed; sx++) {
-					for (int sy = -cellBleed; sy < cellBleed; sy++) {
-						for (int sz = -cellBleed; sz < cellBleed; sz++) {
-							if (x + sx < 0.0 || x + sx >= resolution ||
-								y + sy < 0.0 || y + sy >= resolution ||
-								z + sz < 0.0 || z + sz >= resolution) {
-								continue;
-							}
-
-							int targetIndex = baseIndex + sx + sy * resolution + sz * resolutionPow2;
-
-							float offset = std::max(0.0, std::min(1.0, 1.0 - std::hypot(sx, sy, sz) / (radius / 2.0)));
-							float dataValue = offset * value * 255.f;
-
-							data[targetIndex] += dataValue;
-							data[targetIndex] = std::min((float)data[targetIndex], 255.f);
-						}
-					}
-				}
-			}
-			else {
-				float dataValue = value * 255.f;
-
-				data[baseIndex] += dataValue;
-				data[baseIndex] = std::min((float)data[baseIndex], 255.f);
-			}
-
-			convertedVoxels++;
-
-			if (z >= resolution) {
-				break;
-			}
-
-			x++;
-			target.x += step.x;
-
-			if (x >= resolution) {
-				x = 0;
-				target.x -= step.x * resolution;
-
-				y++;
-				target.y += step.y;
-			}
-
-			if (y >= resolution) {
-				y = 0;
-				target.y -= step.y * resolution;
-
-				z++;
-				target.z += step.z;
-			}
-
-			// yield
-		}
-
-		// now we create the texture with the data
-		// use this: https://www.khronos.org/opengl/wiki/OpenGL_Type
-		// and this: https://registry.khronos.org/OpenGL-Refpages/gl4/html/glTexImage3D.xhtml
-		this->texture = new Texture();
-		this->texture->create3D(resolution, resolution, resolution, GL_RED, GL_FLOAT, false, data, GL_R8);
-	}
+	float* data = bakeVDBDensity(vdbReader);
+	if (!data)
+		return;
+	uploadVDBDensity(this, data);
+	delete[] data;
 }
 
-void IsosurfaceMaterial::setUniforms(Camera* camera, glm::mat4 model)
+void IsosurfaceMaterial::setUniforms(Camera* camera, const glm::mat4& model, const glm::mat4& inverse_model)
 {
-	glm::mat4 inverseModel = glm::inverse(model);
 	glm::vec4 temp = glm::vec4(camera->eye, 1.0);
-	glm::vec3 local_camera_pos = glm::vec3((inverseModel * temp) / temp.w);
+	glm::vec3 local_camera_pos = glm::vec3((inverse_model * temp) / temp.w);
 
 
 
@@ -625,31 +742,136 @@ void IsosurfaceMaterial::setUniforms(Camera* camera, glm::mat4 model)
 	this->shader->setUniform("u_density_source", (int)this->densitySource);
 
 	this->shader->setUniform("u_jittering", this->flag_jittering);
+	this->shader->setUniform("u_refine_steps", this->refine_steps);
 
-	if (this->densitySource == VDB_DENSITY && this->texture) {
+	this->shader->setUniform("u_threshold", this->threshold);
+	if (this->densitySource == VDB_DENSITY && this->texture)
 		this->shader->setUniform("u_density_texture", this->texture, 0);
-		if (this->shaderType == FULL_VOLUME) {
-			this->shader->setUniform("u_threshold", this->threshold);
-		}
-	}
+	else if (this->densitySource == NOISE_DENSITY)
+		this->shader->setUniform("u_noise_scale", this->noiseScale);
+
+	bool use_distance_field = this->use_distance_field && this->distance_texture && this->densitySource == VDB_DENSITY;
+	this->shader->setUniform("u_use_distance_field", use_distance_field);
+	if (use_distance_field)
+		this->shader->setUniform("u_distance_texture", this->distance_texture, 1);
 
 
 	
 }
 
-void IsosurfaceMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera) 
+void IsosurfaceMaterial::bakeDistanceField(float threshold)
+{
+	PROFILE_FUNCTION();
+
+	//the worker bakes its own copy, the density can be reloaded meanwhile
+	int resolution = this->extractor->resolution;
+	size_t size = (size_t)resolution * resolution * resolution;
+	float* density = new float[size];
+	std::copy(this->extractor->density.begin(), this->extractor->density.end(), density);
+
+	IsosurfaceMaterial* material = this;
+	std::weak_ptr<bool> alive = this->lifetime;
+	unsigned int version = this->extractor->density_version;
+	this->distance_baking = true;
+
+	WorkQueue::submit([material, alive, density, resolution, size, threshold, version]() {
+		float* distances = new float[size];
+		DistanceField::bake(density, resolution, threshold, distances);
+		delete[] density;
+
+		//from samples to the local units of the box [-1,1]
+		float sample_size = 2.f / resolution;
+		for (size_t i = 0; i < size; ++i)
+			distances[i] *= sample_size;
+
+		WorkQueue::runOnMainThread([material, alive, distances, resolution, threshold, version]() {
+			if (!alive.expired())
+			{
+				if (!material->distance_texture)
+					material->distance_texture = new Texture();
+				material->distance_texture->create3D(resolution, resolution, resolution, GL_RED, GL_FLOAT, false, distances, GL_R16F);
+				material->distance_threshold = threshold;
+				material->distance_version = version;
+				material->distance_baking = false;
+			}
+			delete[] distances;
+		});
+	});
+}
+
+void IsosurfaceMaterial::extractSurface(float threshold)
+{
+	//the extractor is only used by this job until it finishes, a reload replaces it instead of changing it
+	IsosurfaceMaterial* material = this;
+	std::weak_ptr<bool> alive = this->lifetime;
+	std::shared_ptr<IsosurfaceExtractor> extractor = this->extractor;
+	unsigned int version = extractor->density_version;
+	this->surface_extracting = true;
+
+	WorkQueue::submit([material, alive, extractor, threshold, version]() {
+		Mesh* result = new Mesh(); //no GL calls until it is uploaded
+		if (!extractor->extract(threshold, result))
+		{
+			delete result;
+			result = NULL;
+		}
+
+		WorkQueue::runOnMainThread([material, alive, result, threshold, version]() {
+			if (!alive.expired())
+			{
+				if (result)
+				{
+					if (result->vertices.size())
+						result->uploadToVRAM();
+					delete material->surface_mesh;
+					material->surface_mesh = result;
+				}
+				material->surface_threshold = threshold;
+				material->surface_version = version;
+				material->surface_extracting = false;
+			}
+			else
+				delete result;
+		});
+	});
+}
+
+void IsosurfaceMaterial::render(Mesh* mesh, const glm::mat4& model, const glm::mat4& inverse_model, Camera* camera) 
 {
 	if (!mesh || !this->shader) return;
 
+	//baked again when the threshold or the density change, one bake at a time
+	if (this->use_distance_field && this->densitySource == VDB_DENSITY && this->extractor->resolution && !this->distance_baking)
+	{
+		float threshold = this->threshold / this->densityScale;
+		if (!this->distance_texture || this->distance_threshold != threshold || this->distance_version != this->extractor->density_version)
+			bakeDistanceField(threshold);
+	}
+
+	//the mesh is only extracted again when the threshold or the density change, one extraction at a time
+	if (this->extract_mesh && this->densitySource == VDB_DENSITY && this->extractor->resolution)
+	{
+		float threshold = this->threshold / this->densityScale;
+		if (!this->surface_extracting && (!this->surface_mesh || this->surface_threshold != threshold || this->surface_version != this->extractor->density_version))
+			extractSurface(threshold);
+		if (!this->surface_material)
+			this->surface_material = new StandardMaterial();
+		this->surface_material->color = this->color;
+		if (this->surface_mesh && this->surface_mesh->getNumVertices())
+			this->surface_material->render(this->surface_mesh, model, inverse_model, camera);
+		return;
+	}
+
 	this->shader->enable();
 
 	this->boxMin = mesh->aabb_min;
 	this->boxMax = mesh->aabb_max;
 
-	setUniforms(camera, model);
-	Light* light = Application::instance->light_list[0];
-	light->setUniforms(this->shader, model);
-	mesh->render(GL_TRIANGLES);
+	setUniforms(camera, model, inverse_model);
+	if (this->use_proxy && this->volumeType == HETEROGENEOUS && this->densitySource == VDB_DENSITY)
+		selectVolumeProxy(mesh, this->proxy_mesh, inverse_model, camera)->render(GL_TRIANGLES);
+	else
+		mesh->render(GL_TRIANGLES);
 	this->shader->disable();
 }
 
@@ -677,6 +899,19 @@ void IsosurfaceMaterial::renderInMenu()
 		if (densitySource == VDB_DENSITY) {
 			ImGui::Checkbox("Jittering", &this->flag_jittering);
 			ImGui::SliderFloat("Threshold", &this->threshold, 0.0f, 1.0f); 
+			ImGui::SliderInt("Refinement steps", &this->refine_steps, 0, 8);
+			ImGui::Checkbox("Sphere tracing", &this->use_distance_field);
+			ImGui::Checkbox("Proxy hull", &this->use_proxy);
+			if (this->proxy_mesh)
+				ImGui::Text("Proxy: %d triangles", (int)this->proxy_mesh->getNumTriangles());
+			ImGui::Checkbox("Extract mesh", &this->extract_mesh);
+			if (this->extract_mesh && this->surface_mesh) {
+				if (this->surface_extracting)
+					ImGui::Text("%d triangles, extracting...", (int)this->surface_mesh->getNumTriangles());
+				else //the stats are written by the worker
+					ImGui::Text("%d triangles, %d slabs extracted in %d ms", (int)this->surface_mesh->getNumTriangles(), this->extractor->num_slabs_extracted, (int)this->extractor->extraction_time);
+				ImGui::ColorEdit3("Surface color", (float*)&this->color);
+			}
 		}
 	}
 
@@ -685,5 +920,6 @@ void IsosurfaceMaterial::renderInMenu()
 	ImGui::Combo("Density Source", (int*)&densitySource, "Constant\0Noise\0VDB\0");
 	ImGui::SliderFloat("Density Scale", &densityScale, 0.1f, 5.0f);
 
-
+	if (densitySource == NOISE_DENSITY)
+		ImGui::SliderFloat("Noise Scale", &noiseScale, 1.0f, 10.0f);
 }
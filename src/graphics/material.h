@@ -4,12 +4,16 @@
 #include <glm/vec4.hpp>
 #include <glm/matrix.hpp>
 
+#include <memory>
+
 #include "../framework/camera.h"
 #include "mesh.h"
 #include "texture.h"
 #include "openvdbReader.h"
 #include "bbox.h"
 #include "shader.h"
+#include "isosurface.h"
+#include "volumeproxy.h"
 
 class Material {
 public:
@@ -18,9 +22,16 @@ public:
 	Texture* texture = NULL;
 	glm::vec4 color;
 
-	virtual void setUniforms(Camera* camera, glm::mat4 model) = 0;
-	virtual void render(Mesh* mesh, glm::mat4 model, Camera* camera) = 0;
+	virtual ~Material() {}
+
+	virtual void setUniforms(Camera* camera, const glm::mat4& model, const glm::mat4& inverse_model) = 0;
+	virtual void render(Mesh* mesh, const glm::mat4& model, const glm::mat4& inverse_model, Camera* camera) = 0;
 	virtual void renderInMenu() = 0;
+
+	//materials that can draw many nodes in a single instanced call, the model and the color change per instance
+	//the RenderQueue groups the nodes with the same mesh, shader, texture and type of material
+	virtual bool supportsInstancing() { return false; }
+	virtual void renderInstanced(Mesh*, const std::vector<glm::mat4>&, const std::vector<glm::vec4>&, Camera*) {}
 };
 
 class FlatMaterial : public Material {
@@ -29,9 +40,12 @@ public:
 	FlatMaterial(glm::vec4 color = glm::vec4(1.f));
 	~FlatMaterial();
 
-	void setUniforms(Camera* camera, glm::mat4 model);
-	void render(Mesh* mesh, glm::mat4 model, Camera* camera);
+	void setUniforms(Camera* camera, const glm::mat4& model, const glm::mat4& inverse_model);
+	void render(Mesh* mesh, const glm::mat4& model, const glm::mat4& inverse_model, Camera* camera);
 	void renderInMenu();
+
+	bool supportsInstancing() { return true; }
+	void renderInstanced(Mesh* mesh, const std::vector<glm::mat4>& models, const std::vector<glm::vec4>& colors, Camera* camera);
 };
 
 class WireframeMaterial : public FlatMaterial {
@@ -40,7 +54,9 @@ public:
 	WireframeMaterial();
 	~WireframeMaterial();
 
-	void render(Mesh* mesh, glm::mat4 model, Camera* camera);
+	void render(Mesh* mesh, const glm::mat4& model, const glm::mat4& inverse_model, Camera* camera);
+
+	bool supportsInstancing() { return false; } //changes the polygon mode
 };
 
 class StandardMaterial : public Material {
@@ -55,8 +71,8 @@ public:
 	StandardMaterial(glm::vec4 color = glm::vec4(1.f));
 	~StandardMaterial();
 
-	void setUniforms(Camera* camera, glm::mat4 model);
-	void render(Mesh* mesh, glm::mat4 model, Camera* camera);
+	void setUniforms(Camera* camera, const glm::mat4& model, const glm::mat4& inverse_model);
+	void render(Mesh* mesh, const glm::mat4& model, const glm::mat4& inverse_model, Camera* camera);
 	void renderInMenu();
 };
 
@@ -110,11 +126,17 @@ public:
 
 	bool flag_jittering;
 
+	int num_lights = 0; //touching the volume box in the last render
+
+	//hull of the occupied cells of the vdb density, drawn instead of the box so the rays skip the empty space
+	bool use_proxy = true;
+	Mesh* proxy_mesh = NULL;
+
 	void loadVDB(std::string file_path);
 	void estimate3DTexture(easyVDB::OpenVDBReader* vdbReader);
 
-    void setUniforms(Camera* camera, glm::mat4 model);
-    void render(Mesh* mesh, glm::mat4 model, Camera* camera);
+    void setUniforms(Camera* camera, const glm::mat4& model, const glm::mat4& inverse_model);
+    void render(Mesh* mesh, const glm::mat4& model, const glm::mat4& inverse_model, Camera* camera);
     void renderInMenu();
 };
 
@@ -136,11 +158,39 @@ public:
 	bool flag_jittering;
 
 	float threshold;
+	float noiseScale = 2.0f; //of the noise density
+	int refine_steps = 4; //secant steps after the march crosses the threshold, allows longer steps
+
+	//the surface extracted as triangles instead of ray marched every frame
+	bool extract_mesh = false;
+	//it is extracted in a worker, the previous mesh is drawn meanwhile
+	std::shared_ptr<IsosurfaceExtractor> extractor = std::make_shared<IsosurfaceExtractor>(); //keeps a copy of the density, replaced when it changes (the extraction in flight keeps the old one)
+	Mesh* surface_mesh = NULL;
+	StandardMaterial* surface_material = NULL;
+	float surface_threshold = 0.f; //of the extracted mesh
+	unsigned int surface_version = 0; //of the density used
+	bool surface_extracting = false; //an extraction is in flight
+	void extractSurface(float threshold);
+
+	//sphere tracing through a signed distance field baked for the current threshold
+	//it is baked in a worker, the previous field is traced meanwhile
+	bool use_distance_field = false;
+	Texture* distance_texture = NULL;
+	float distance_threshold = 0.f; //of the baked field
+	unsigned int distance_version = 0; //of the density used
+	bool distance_baking = false; //a bake is in flight
+	void bakeDistanceField(float threshold);
+
+	std::shared_ptr<bool> lifetime = std::make_shared<bool>(true); //the jobs in flight keep a weak_ptr, it expires with the material
+
+	//hull of the occupied cells of the vdb density, drawn instead of the box so the rays skip the empty space
+	bool use_proxy = true;
+	Mesh* proxy_mesh = NULL;
 
 	void loadVDB(std::string file_path);
 	void estimate3DTexture(easyVDB::OpenVDBReader* vdbReader);
 
-	void setUniforms(Camera* camera, glm::mat4 model);
-	void render(Mesh* mesh, glm::mat4 model, Camera* camera);
+	void setUniforms(Camera* camera, const glm::mat4& model, const glm::mat4& inverse_model);
+	void render(Mesh* mesh, const glm::mat4& model, const glm::mat4& inverse_model, Camera* camera);
 	void renderInMenu();
 };
\ No newline at end of file
@@ -4,18 +4,40 @@
 #include <iostream>
 #include <limits>
 #include <sys/stat.h>
+#include <filesystem>
+#include <string_view>
+#include <charconv>
+#include <cctype>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
+#include <cfloat>
+#include <mutex>
+#include <cstddef>
 
 #include "shader.h"
 #include "texture.h"
+#include "streambuffer.h"
 #include "../framework/includes.h"
 #include "../framework/utils.h"
 #include "../framework/camera.h"
+#include "../framework/filewatcher.h"
+#include "../framework/workqueue.h"
+#include "../framework/profiler.h"
+#include "../framework/mappedfile.h"
+
+#include <glm/gtc/packing.hpp>
 
 bool Mesh::use_binary = true;			//checks if there is .wbin, it there is one tries to read it instead of the other file
 bool Mesh::auto_upload_to_vram = true;	//uploads the mesh to the GPU VRAM to speed up rendering
 bool Mesh::interleave_meshes = true;	//places the geometry in an interleaved array
+bool Mesh::index_meshes = true;			//shares the repeated vertices using indices
+bool Mesh::keep_in_ram = false;			//binary meshes are uploaded straight from the file mapping
+bool Mesh::quantize_meshes = true;		//stores the vertices in the compact format
 
 std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
+static std::mutex s_meshes_mutex; //GetAsync may be called from the workers
 long Mesh::num_meshes_rendered = 0;
 long Mesh::num_triangles_rendered = 0;
 
@@ -24,50 +46,36 @@ long Mesh::num_triangles_rendered = 0;
 #define FORMAT_MBIN 3
 #define FORMAT_MESH 4
 
-const glm::vec3 corners[] = { {1,1,1},  {1,1,-1},  {1,-1,1},  {1,-1,-1},  {-1,1,1},  {-1,1,-1},  {-1,-1,1},  {-1,-1,-1} };
-
+//Arvo: the center is transformed as a point and the halfsize by the absolute value of the rotation and scale,
+//same box as transforming the 8 corners (for affine matrices) without the loop
 BoundingBox transformBoundingBox(const glm::mat4 m, const BoundingBox& box)
 {
-	glm::vec3 box_min(10000000.0f, 1000000.0f, 1000000.0f);
-	glm::vec3 box_max(-10000000.0f, -1000000.0f, -1000000.0f);
-
-	for (int i = 0; i < 8; ++i)
-	{
-		glm::vec3 corner = corners[i];
-		corner = box.halfsize * corner;
-		corner = corner + box.center;
-		corner = m * glm::vec4(corner, 1.f);
-
-		//box_min.setMin(corner);
-		if (corner.x < box_min.x) box_min.x = corner.x;
-		if (corner.y < box_min.y) box_min.y = corner.y;
-		if (corner.z < box_min.z) box_min.z = corner.z;
-
-		//box_max.setMax(corner);
-		if (corner.x > box_min.x) box_min.x = corner.x;
-		if (corner.y > box_min.y) box_min.y = corner.y;
-		if (corner.z > box_min.z) box_min.z = corner.z;
-	}
-
-	glm::vec3 halfsize = (box_max - box_min) * 0.5f;
-	return BoundingBox(box_max - halfsize, halfsize);
+	glm::vec3 center = glm::vec3(m * glm::vec4(box.center, 1.f));
+	glm::vec3 halfsize = glm::abs(glm::vec3(m[0])) * box.halfsize.x + glm::abs(glm::vec3(m[1])) * box.halfsize.y + glm::abs(glm::vec3(m[2])) * box.halfsize.z;
+	return BoundingBox(center, halfsize);
 }
 
 Mesh::Mesh()
 {
 	radius = 0;
+	index_type = GL_UNSIGNED_INT;
 	vertices_vbo_id = uvs_vbo_id = uvs1_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = 0;
 	collision_model = NULL;
+	mapped_file = NULL;
+	loading = false;
 	clear();
 }
 
 Mesh::~Mesh()
 {
+	FileWatcher::unwatch(this);
 	clear();
 }
 
 void Mesh::clear()
 {
+	releaseVertexArrays();
+
 	//Free VBOs
 	if (vertices_vbo_id)
 		glDeleteBuffersARB(1, &vertices_vbo_id);
@@ -90,6 +98,13 @@ void Mesh::clear()
 
 	//VBOs ids
 	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = uvs1_vbo_id = 0;
+	vbo_num_vertices = vbo_num_triangles = 0;
+
+	//binary file not uploaded yet
+	if (mapped_file)
+		delete mapped_file;
+	mapped_file = NULL;
+	memset(mapped_streams, 0, sizeof(mapped_streams));
 
 	//buffers
 	vertices.clear();
@@ -101,47 +116,153 @@ void Mesh::clear()
 	bones.clear();
 	weights.clear();
 	uvs1.clear();
+	quantized.clear();
+	colors8.clear();
+	weights8.clear();
+
+	vertex_format = VERTEX_FORMAT_FLOAT;
+	position_offset = glm::vec3(0.0f);
+	position_scale = glm::vec3(1.0f);
+}
+
+//last vertex array bound, to skip redundant binds between draws
+static unsigned int s_bound_vao = 0;
+
+static void bindVAO(unsigned int vao_id)
+{
+	if (s_bound_vao == vao_id)
+		return;
+	glBindVertexArray(vao_id);
+	s_bound_vao = vao_id;
+}
+
+bool Mesh::bindVertexArray(Shader* shader)
+{
+	//meshes that are not in VRAM use client side arrays
+	if (!interleaved_vbo_id && !vertices_vbo_id)
+	{
+		bindVAO(0);
+		return false;
+	}
+
+	sVertexArrayInfo& info = vertex_arrays[shader];
+	if (info.vao_id && info.program_version == shader->program_version)
+	{
+		bindVAO(info.vao_id);
+		return true;
+	}
+
+	//the program changed (or it is the first time), attribute locations may be different
+	if (info.vao_id)
+	{
+		if (s_bound_vao == info.vao_id)
+			s_bound_vao = 0;
+		glDeleteVertexArrays(1, &info.vao_id);
+	}
+
+	glGenVertexArrays(1, &info.vao_id);
+	info.program_version = shader->program_version;
+	bindVAO(info.vao_id);
+
+	//the attribute setup and the index buffer get stored in the VAO
+	enableBuffers(shader);
+	if (indices_vbo_id)
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	return true;
+}
+
+void Mesh::releaseVertexArrays()
+{
+	for (auto& it : vertex_arrays)
+	{
+		if (s_bound_vao == it.second.vao_id)
+			bindVAO(0);
+		glDeleteVertexArrays(1, &it.second.vao_id);
+	}
+	vertex_arrays.clear();
+}
+
+//meshes that are not in VRAM send their vertices every draw, through the ring buffer instead of client side arrays when possible
+static const void* streamVertexData(const void* data, size_t bytes, GLuint& buffer)
+{
+	size_t offset = 0;
+	buffer = StreamBuffer::upload(data, bytes, offset) ? StreamBuffer::getBufferId() : 0;
+	return buffer ? (const void*)offset : data;
 }
 
-int vertex_location = -1;
-int normal_location = -1;
-int uv_location = -1;
-int color_location = -1;
-int bones_location = -1;
-int weights_location = -1;
-int uv1_location = -1;
+static void setClientAttribute(int location, int size, GLenum type, GLboolean normalized, const void* data, size_t bytes)
+{
+	GLuint buffer = 0;
+	const void* pointer = streamVertexData(data, bytes, buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glVertexAttribPointer(location, size, type, normalized, 0, pointer);
+}
 
 void Mesh::enableBuffers(Shader* sh)
 {
-	vertex_location = sh->getAttribLocation("a_vertex");
+	int vertex_location = sh->getAttribLocation("a_vertex");
 	assert(vertex_location != -1 && "No a_vertex found in shader");
 
 	if (vertex_location == -1)
 		return;
 
+	//layout of the position, normal and uv streams
 	int spacing = 0;
-	int offset_normal = 0;
-	int offset_uv = 0;
-
-	if (interleaved.size())
+	size_t offset_normal = 0;
+	size_t offset_uv = 0;
+	GLenum vertex_type = GL_FLOAT;
+	GLenum normal_type = GL_FLOAT;
+	GLenum uv_type = GL_FLOAT;
+	int normal_size = 3;
+	GLboolean normalized = GL_FALSE;
+	const char* interleaved_data = NULL; //when they are not in VRAM
+
+	if (vertex_format == VERTEX_FORMAT_QUANTIZED)
+	{
+		spacing = sizeof(tQuantized);
+		offset_normal = offsetof(tQuantized, normal);
+		offset_uv = offsetof(tQuantized, uv);
+		vertex_type = GL_UNSIGNED_SHORT;
+		normal_type = GL_SHORT;
+		normal_size = 2; //decoded in the shader
+		uv_type = GL_HALF_FLOAT;
+		normalized = GL_TRUE;
+		if (quantized.size())
+			interleaved_data = (const char*)&quantized[0];
+	}
+	else if (interleaved.size() || interleaved_vbo_id)
 	{
 		spacing = sizeof(tInterleaved);
 		offset_normal = sizeof(glm::vec3);
 		offset_uv = sizeof(glm::vec3) + sizeof(glm::vec3);
+		if (interleaved.size())
+			interleaved_data = (const char*)&interleaved[0];
 	}
 
+	//the interleaved block is streamed once and shared by its attributes
+	GLuint interleaved_buffer = 0;
+	if (interleaved_data && !interleaved_vbo_id)
+		interleaved_data = (const char*)streamVertexData(interleaved_data, getNumVertices() * spacing, interleaved_buffer);
+
 	glEnableVertexAttribArray(vertex_location);
 
 	if (vertices_vbo_id || interleaved_vbo_id)
 	{
 		glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : vertices_vbo_id);
-		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
+		glVertexAttribPointer(vertex_location, 3, vertex_type, normalized, spacing, 0);
+	}
+	else if (spacing)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, interleaved_buffer);
+		glVertexAttribPointer(vertex_location, 3, vertex_type, normalized, spacing, interleaved_data);
 	}
 	else
-		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].vertex : &vertices[0]);
+		setClientAttribute(vertex_location, 3, vertex_type, normalized, &vertices[0], vertices.size() * sizeof(glm::vec3));
 
-	normal_location = -1;
-	if (normals.size() || spacing)
+	int normal_location = -1;
+	if (normals.size() || normals_vbo_id || spacing)
 	{
 		normal_location = sh->getAttribLocation("a_normal");
 		if (normal_location != -1)
@@ -150,15 +271,20 @@ void Mesh::enableBuffers(Shader* sh)
 			if (normals_vbo_id || interleaved_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_normal);
+				glVertexAttribPointer(normal_location, normal_size, normal_type, normalized, spacing, (void*)offset_normal);
+			}
+			else if (spacing)
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, interleaved_buffer);
+				glVertexAttribPointer(normal_location, normal_size, normal_type, normalized, spacing, interleaved_data + offset_normal);
 			}
 			else
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].normal : &normals[0]);
+				setClientAttribute(normal_location, normal_size, normal_type, normalized, &normals[0], normals.size() * sizeof(glm::vec3));
 		}
 	}
 
-	uv_location = -1;
-	if (uvs.size() || spacing)
+	int uv_location = -1;
+	if (uvs.size() || uvs_vbo_id || spacing)
 	{
 		uv_location = sh->getAttribLocation("a_uv");
 		if (uv_location != -1)
@@ -167,15 +293,20 @@ void Mesh::enableBuffers(Shader* sh)
 			if (uvs_vbo_id || interleaved_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)offset_uv);
+				glVertexAttribPointer(uv_location, 2, uv_type, GL_FALSE, spacing, (void*)offset_uv);
+			}
+			else if (spacing)
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, interleaved_buffer);
+				glVertexAttribPointer(uv_location, 2, uv_type, GL_FALSE, spacing, interleaved_data + offset_uv);
 			}
 			else
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].uv : &uvs[0]);
+				setClientAttribute(uv_location, 2, uv_type, GL_FALSE, &uvs[0], uvs.size() * sizeof(glm::vec2));
 		}
 	}
 
-	uv1_location = -1;
-	if (uvs1.size())
+	int uv1_location = -1;
+	if (uvs1.size() || uvs1_vbo_id)
 	{
 		uv1_location = sh->getAttribLocation("a_uv1");
 		if (uv1_location != -1)
@@ -184,15 +315,18 @@ void Mesh::enableBuffers(Shader* sh)
 			if (uvs1_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, uvs1_vbo_id);
-				glVertexAttribPointer(uv1_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)NULL);
+				glVertexAttribPointer(uv1_location, 2, GL_FLOAT, GL_FALSE, 0, (void*)NULL);
 			}
 			else
-				glVertexAttribPointer(uv1_location, 2, GL_FLOAT, GL_FALSE, spacing, &uvs1[0]);
+				setClientAttribute(uv1_location, 2, GL_FLOAT, GL_FALSE, &uvs1[0], uvs1.size() * sizeof(glm::vec2));
 		}
 	}
 
-	color_location = -1;
-	if (colors.size())
+	//colors and weights are unorm bytes in the compact format
+	GLenum attrib8_type = vertex_format == VERTEX_FORMAT_QUANTIZED ? GL_UNSIGNED_BYTE : GL_FLOAT;
+
+	int color_location = -1;
+	if (colors.size() || colors8.size() || colors_vbo_id)
 	{
 		color_location = sh->getAttribLocation("a_color");
 		if (color_location != -1)
@@ -201,15 +335,17 @@ void Mesh::enableBuffers(Shader* sh)
 			if (colors_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, colors_vbo_id);
-				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+				glVertexAttribPointer(color_location, 4, attrib8_type, normalized, 0, NULL);
 			}
+			else if (colors8.size())
+				setClientAttribute(color_location, 4, attrib8_type, normalized, &colors8[0], colors8.size() * sizeof(glm::u8vec4));
 			else
-				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, &colors[0]);
+				setClientAttribute(color_location, 4, attrib8_type, normalized, &colors[0], colors.size() * sizeof(glm::vec4));
 		}
 	}
 
-	bones_location = -1;
-	if (bones.size())
+	int bones_location = -1;
+	if (bones.size() || bones_vbo_id)
 	{
 		bones_location = sh->getAttribLocation("a_bones");
 		if (bones_location != -1)
@@ -221,11 +357,11 @@ void Mesh::enableBuffers(Shader* sh)
 				glVertexAttribPointer(bones_location, 4, GL_UNSIGNED_BYTE, GL_FALSE, 0, NULL);
 			}
 			else
-				glVertexAttribPointer(bones_location, 4, GL_UNSIGNED_BYTE, GL_FALSE, 0, &bones[0]);
+				setClientAttribute(bones_location, 4, GL_UNSIGNED_BYTE, GL_FALSE, &bones[0], bones.size() * sizeof(glm::vec4));
 		}
 	}
-	weights_location = -1;
-	if (weights.size())
+	int weights_location = -1;
+	if (weights.size() || weights8.size() || weights_vbo_id)
 	{
 		weights_location = sh->getAttribLocation("a_weights");
 		if (weights_location != -1)
@@ -234,10 +370,12 @@ void Mesh::enableBuffers(Shader* sh)
 			if (weights_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, weights_vbo_id);
-				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+				glVertexAttribPointer(weights_location, 4, attrib8_type, normalized, 0, NULL);
 			}
+			else if (weights8.size())
+				setClientAttribute(weights_location, 4, attrib8_type, normalized, &weights8[0], weights8.size() * sizeof(glm::u8vec4));
 			else
-				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, &weights[0]);
+				setClientAttribute(weights_location, 4, attrib8_type, normalized, &weights[0], weights.size() * sizeof(glm::vec4));
 		}
 	}
 
@@ -245,16 +383,24 @@ void Mesh::enableBuffers(Shader* sh)
 
 void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 {
+	if (loading || load_failed)
+		return; //GetAsync has not finished yet or the file could not be loaded
+
 	Shader* shader = Shader::current;
-	if (!shader || !shader->compiled)
+	if (!shader || (!shader->compiled && !Shader::s_fallback)) //shaders still linking render with the fallback
 	{
 		assert(0 && "no shader or shader not compiled or enabled");
 		return;
 	}
-	assert((interleaved.size() || vertices.size()) && "No vertices in this mesh");
+	assert(getNumVertices() && "No vertices in this mesh");
 
-	//bind buffers to attribute locations
-	enableBuffers(shader);
+	//bind buffers to attribute locations (a single bind if the mesh is in VRAM)
+	bool use_vao = bindVertexArray(shader);
+	if (!use_vao)
+		enableBuffers(shader);
+
+	//to decode the compact vertex format, only uploaded when it changes
+	shader->setVertexDecode(position_offset, position_scale, vertex_format == VERTEX_FORMAT_QUANTIZED);
 
 	//draw call
 	if (submesh_id == -1 && materials.size() > 0) // if there's mesh mtl
@@ -276,18 +422,16 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 		drawCall(primitive, submesh_id, 0, num_instances);
 	}
 
-	//unbind them
-	disableBuffers(shader);
+	//unbind them, the VAO stays bound until another mesh needs a different one
+	if (!use_vao)
+		disableBuffers(shader);
 }
 
 void Mesh::drawCall(unsigned int primitive, int submesh_id, int draw_call_id, int num_instances)
 {
+	bool indexed = isIndexed();
 	size_t start = 0; //in primitives
-	size_t size = vertices.size();
-	if (indices.size())
-		size = indices.size();
-	else if (interleaved.size())
-		size = interleaved.size();
+	size_t size = indexed ? getNumTriangles() : getNumVertices();
 
 	if (submesh_id > -1)
 	{
@@ -299,21 +443,25 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int draw_call_id, in
 	}
 
 	//DRAW
-	if (indices.size())
+	if (indexed)
 	{
+		//the index buffer is bound as part of the VAO
+		size_t index_size = index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
 		if (num_instances > 0)
 		{
 			assert(indices_vbo_id && "indices must be uploaded to the GPU");
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-			glDrawElementsInstanced(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start * sizeof(glm::vec3)), num_instances);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			glDrawElementsInstanced(primitive, size * 3, index_type, (void*)(start * 3 * index_size), num_instances);
 		}
 		else
 		{
+			size_t offset = 0;
 			if (indices_vbo_id)
+				glDrawElements(primitive, size * 3, index_type, (void*)(start * 3 * index_size));
+			else if (StreamBuffer::upload(&indices[0] + start, size * sizeof(glm::uvec3), offset))
 			{
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start * sizeof(glm::vec3)));
+				//there is no VAO holding an index buffer, bind it only for this draw
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, StreamBuffer::getBufferId());
+				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)offset);
 				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 			}
 			else
@@ -328,26 +476,27 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int draw_call_id, in
 			glDrawArrays(primitive, start, size);
 	}
 
-	num_triangles_rendered += static_cast<long>((size / 3) * (num_instances ? num_instances : 1));
+	num_triangles_rendered += static_cast<long>((indexed ? size : size / 3) * (num_instances ? num_instances : 1));
 	num_meshes_rendered++;
 }
 
 void Mesh::disableBuffers(Shader* shader)
 {
-	glDisableVertexAttribArray(vertex_location);
-	if (normal_location != -1) glDisableVertexAttribArray(normal_location);
-	if (uv_location != -1) glDisableVertexAttribArray(uv_location);
-	if (uv1_location != -1) glDisableVertexAttribArray(uv1_location);
-	if (color_location != -1) glDisableVertexAttribArray(color_location);
-	if (bones_location != -1) glDisableVertexAttribArray(bones_location);
-	if (weights_location != -1) glDisableVertexAttribArray(weights_location);
+	//locations are cached in the shader, no need to keep them in globals
+	const char* attributes[] = { "a_vertex", "a_normal", "a_uv", "a_uv1", "a_color", "a_bones", "a_weights" };
+	for (const char* name : attributes)
+	{
+		int location = shader->getAttribLocation(name);
+		if (location != -1)
+			glDisableVertexAttribArray(location);
+	}
 	glBindBuffer(GL_ARRAY_BUFFER, 0);    //if crashes here, COMMENT THIS LINE ****************************
 }
 
 GLuint instances_buffer_id = 0;
 
 //should be faster but in some system it is slower
-void Mesh::renderInstanced(unsigned int primitive, const glm::mat4* instanced_models, int num_instances)
+void Mesh::renderInstanced(unsigned int primitive, const glm::mat4* instanced_models, int num_instances, const glm::vec4* instanced_colors)
 {
 	if (!num_instances)
 		return;
@@ -355,10 +504,20 @@ void Mesh::renderInstanced(unsigned int primitive, const glm::mat4* instanced_mo
 	Shader* shader = Shader::current;
 	assert(shader && "shader must be enabled");
 
-	if (instances_buffer_id == 0)
-		glGenBuffersARB(1, &instances_buffer_id);
-	glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
-	glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(glm::mat4), instanced_models, GL_STREAM_DRAW_ARB);
+	//instanced attributes are stored in the VAO of this mesh, bind it first
+	bindVertexArray(shader);
+
+	//the matrices go to the ring buffer, the shared buffer is reallocated only if it doesnt fit
+	size_t instances_offset = 0;
+	if (StreamBuffer::upload(instanced_models, num_instances * sizeof(glm::mat4), instances_offset))
+		glBindBuffer(GL_ARRAY_BUFFER, StreamBuffer::getBufferId());
+	else
+	{
+		if (instances_buffer_id == 0)
+			glGenBuffersARB(1, &instances_buffer_id);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(glm::mat4), instanced_models, GL_STREAM_DRAW_ARB);
+	}
 
 	int attribLocation = shader->getAttribLocation("u_model");
 	assert(attribLocation != -1 && "shader must have attribute mat4 u_model (not a uniform)");
@@ -369,12 +528,32 @@ void Mesh::renderInstanced(unsigned int primitive, const glm::mat4* instanced_mo
 	for (int k = 0; k < 4; ++k)
 	{
 		glEnableVertexAttribArray(attribLocation + k);
-		int offset = sizeof(float) * 4 * k;
+		size_t offset = instances_offset + sizeof(float) * 4 * k;
 		const uint8_t* addr = (uint8_t*)offset;
 		glVertexAttribPointer(attribLocation + k, 4, GL_FLOAT, false, sizeof(glm::mat4x4), addr);
 		glVertexAttribDivisor(attribLocation + k, 1); // This makes it instanced!
 	}
 
+	//optional color per instance
+	int colorLocation = instanced_colors ? shader->getAttribLocation("a_instance_color") : -1;
+	if (colorLocation != -1)
+	{
+		size_t colors_offset = 0;
+		if (StreamBuffer::upload(instanced_colors, num_instances * sizeof(glm::vec4), colors_offset))
+			glBindBuffer(GL_ARRAY_BUFFER, StreamBuffer::getBufferId());
+		else
+		{
+			static GLuint colors_buffer_id = 0;
+			if (colors_buffer_id == 0)
+				glGenBuffers(1, &colors_buffer_id);
+			glBindBuffer(GL_ARRAY_BUFFER, colors_buffer_id);
+			glBufferData(GL_ARRAY_BUFFER, num_instances * sizeof(glm::vec4), instanced_colors, GL_STREAM_DRAW);
+		}
+		glEnableVertexAttribArray(colorLocation);
+		glVertexAttribPointer(colorLocation, 4, GL_FLOAT, false, sizeof(glm::vec4), (void*)colors_offset);
+		glVertexAttribDivisor(colorLocation, 1);
+	}
+
 	//regular render
 	render(primitive, -1, num_instances);
 
@@ -384,6 +563,11 @@ void Mesh::renderInstanced(unsigned int primitive, const glm::mat4* instanced_mo
 		glDisableVertexAttribArray(attribLocation + k);
 		glVertexAttribDivisor(attribLocation + k, 0);
 	}
+	if (colorLocation != -1)
+	{
+		glDisableVertexAttribArray(colorLocation);
+		glVertexAttribDivisor(colorLocation, 0);
+	}
 }
 
 void Mesh::renderInstanced(unsigned int primitive, const std::vector<glm::vec3> positions, const char* uniform_name)
@@ -395,10 +579,19 @@ void Mesh::renderInstanced(unsigned int primitive, const std::vector<glm::vec3>
 	Shader* shader = Shader::current;
 	assert(shader && "shader must be enabled");
 
-	if (instances_buffer_id == 0)
-		glGenBuffersARB(1, &instances_buffer_id);
-	glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
-	glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(glm::vec3), &positions[0], GL_STREAM_DRAW_ARB);
+	//instanced attributes are stored in the VAO of this mesh, bind it first
+	bindVertexArray(shader);
+
+	size_t instances_offset = 0;
+	if (StreamBuffer::upload(&positions[0], num_instances * sizeof(glm::vec3), instances_offset))
+		glBindBuffer(GL_ARRAY_BUFFER, StreamBuffer::getBufferId());
+	else
+	{
+		if (instances_buffer_id == 0)
+			glGenBuffersARB(1, &instances_buffer_id);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(glm::vec3), &positions[0], GL_STREAM_DRAW_ARB);
+	}
 
 	int attribLocation = shader->getAttribLocation(uniform_name);
 	assert(attribLocation != -1 && "shader uniform not found");
@@ -406,7 +599,7 @@ void Mesh::renderInstanced(unsigned int primitive, const std::vector<glm::vec3>
 		return; //this shader doesnt have instanced uniform
 
 	glEnableVertexAttribArray(attribLocation);
-	glVertexAttribPointer(attribLocation, 3, GL_FLOAT, false, sizeof(glm::vec3), 0);
+	glVertexAttribPointer(attribLocation, 3, GL_FLOAT, false, sizeof(glm::vec3), (void*)instances_offset);
 	glVertexAttribDivisor(attribLocation, 1); // This makes it instanced!
 
 	//regular render
@@ -421,9 +614,10 @@ void Mesh::renderInstanced(unsigned int primitive, const std::vector<glm::vec3>
 //super obsolete rendering method, do not use
 void Mesh::renderFixedPipeline(int primitive)
 {
-	assert((vertices.size() || interleaved.size()) && "No vertices in this mesh");
+	assert(getNumVertices() && "No vertices in this mesh");
+	assert(vertex_format == VERTEX_FORMAT_FLOAT && "the fixed pipeline cannot decode the compact vertex format");
 
-	int interleave_offset = interleaved.size() ? sizeof(tInterleaved) : 0;
+	int interleave_offset = (interleaved.size() || interleaved_vbo_id) ? sizeof(tInterleaved) : 0;
 	int offset_normal = sizeof(glm::vec3);
 	int offset_uv = sizeof(glm::vec3) + sizeof(glm::vec3);
 
@@ -437,7 +631,11 @@ void Mesh::renderFixedPipeline(int primitive)
 	else
 		glVertexPointer(3, GL_FLOAT, interleave_offset, interleave_offset ? &interleaved[0].vertex : &vertices[0]);
 
-	if (normals.size() || interleave_offset)
+	bool has_normals = normals.size() || normals_vbo_id || interleave_offset;
+	bool has_uvs = uvs.size() || uvs_vbo_id || interleave_offset;
+	bool has_colors = colors.size() || colors_vbo_id;
+
+	if (has_normals)
 	{
 		glEnableClientState(GL_NORMAL_ARRAY);
 		if (normals_vbo_id || interleaved_vbo_id)
@@ -449,7 +647,7 @@ void Mesh::renderFixedPipeline(int primitive)
 			glNormalPointer(GL_FLOAT, interleave_offset, interleave_offset ? &interleaved[0].normal : &normals[0]);
 	}
 
-	if (uvs.size() || interleave_offset)
+	if (has_uvs)
 	{
 		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 		if (uvs_vbo_id || interleaved_vbo_id)
@@ -461,7 +659,7 @@ void Mesh::renderFixedPipeline(int primitive)
 			glTexCoordPointer(2, GL_FLOAT, interleave_offset, interleave_offset ? &interleaved[0].uv : &uvs[0]);
 	}
 
-	if (colors.size())
+	if (has_colors)
 	{
 		glEnableClientState(GL_COLOR_ARRAY);
 		if (colors_vbo_id)
@@ -473,17 +671,13 @@ void Mesh::renderFixedPipeline(int primitive)
 			glColorPointer(4, GL_FLOAT, 0, &colors[0]);
 	}
 
-	int size = (int)vertices.size();
-	if (!size)
-		size = (int)interleaved.size();
-
-	glDrawArrays(primitive, 0, (GLsizei)size);
+	glDrawArrays(primitive, 0, (GLsizei)getNumVertices());
 	glDisableClientState(GL_VERTEX_ARRAY);
-	if (normals.size())
+	if (has_normals)
 		glDisableClientState(GL_NORMAL_ARRAY);
-	if (uvs.size())
+	if (has_uvs)
 		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-	if (colors.size())
+	if (has_colors)
 		glDisableClientState(GL_COLOR_ARRAY);
 	glBindBuffer(GL_ARRAY_BUFFER, 0); //if it crashes, comment this line
 }
@@ -507,9 +701,17 @@ void Mesh::renderFixedPipeline(int primitive)
 //	render(primitive);
 //}
 
+//the stream in RAM or, if it was not copied, the one in the mapped binary file
+template<typename T> static const void* getStreamData(const std::vector<T>& stream, const char* mapped)
+{
+	return stream.size() ? (const void*)&stream[0] : (const void*)mapped;
+}
+
 void Mesh::uploadToVRAM()
 {
-	assert(vertices.size() || interleaved.size());
+	PROFILE_FUNCTION();
+
+	assert(getNumVertices());
 
 	if (glGenBuffersARB == 0)
 	{
@@ -517,13 +719,28 @@ void Mesh::uploadToVRAM()
 		exit(0);
 	}
 
-	if (interleaved.size())
+	//buffers may change, so the VAOs must be rebuilt. Also make sure no VAO captures the index buffer bind
+	releaseVertexArrays();
+	bindVAO(0);
+
+	size_t num_vertices = getNumVertices();
+	size_t num_triangles = isIndexed() ? getNumTriangles() : 0;
+
+	if (quantized.size() || mapped_streams[MESH_STREAM_QUANTIZED])
+	{
+		// Vertex,Normal,UV in the compact format
+		if (interleaved_vbo_id == 0)
+			glGenBuffersARB(1, &interleaved_vbo_id);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, interleaved_vbo_id);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(tQuantized), getStreamData(quantized, mapped_streams[MESH_STREAM_QUANTIZED]), GL_STATIC_DRAW_ARB);
+	}
+	else if (interleaved.size() || mapped_streams[MESH_STREAM_INTERLEAVED])
 	{
 		// Vertex,Normal,UV
 		if (interleaved_vbo_id == 0)
 			glGenBuffersARB(1, &interleaved_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, interleaved_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, interleaved.size() * sizeof(tInterleaved), &interleaved[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(tInterleaved), getStreamData(interleaved, mapped_streams[MESH_STREAM_INTERLEAVED]), GL_STATIC_DRAW_ARB);
 	}
 	else
 	{
@@ -531,73 +748,113 @@ void Mesh::uploadToVRAM()
 		if (vertices_vbo_id == 0)
 			glGenBuffersARB(1, &vertices_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, vertices_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(glm::vec3), getStreamData(vertices, mapped_streams[MESH_STREAM_VERTICES]), GL_STATIC_DRAW_ARB);
 
 		// UVs
-		if (uvs.size())
+		if (uvs.size() || mapped_streams[MESH_STREAM_UVS])
 		{
 			if (uvs_vbo_id == 0)
 				glGenBuffersARB(1, &uvs_vbo_id);
 			glBindBufferARB(GL_ARRAY_BUFFER_ARB, uvs_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, uvs.size() * sizeof(glm::vec2), &uvs[0], GL_STATIC_DRAW_ARB);
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(glm::vec2), getStreamData(uvs, mapped_streams[MESH_STREAM_UVS]), GL_STATIC_DRAW_ARB);
 		}
 
 		// Normals
-		if (normals.size())
+		if (normals.size() || mapped_streams[MESH_STREAM_NORMALS])
 		{
 			if (normals_vbo_id == 0)
 				glGenBuffersARB(1, &normals_vbo_id);
 			glBindBufferARB(GL_ARRAY_BUFFER_ARB, normals_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, normals.size() * sizeof(glm::vec3), &normals[0], GL_STATIC_DRAW_ARB);
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(glm::vec3), getStreamData(normals, mapped_streams[MESH_STREAM_NORMALS]), GL_STATIC_DRAW_ARB);
 		}
 	}
 
 	// UVs
-	if (uvs1.size())
+	if (uvs1.size() || mapped_streams[MESH_STREAM_UVS1])
 	{
 		if (uvs1_vbo_id == 0)
 			glGenBuffersARB(1, &uvs1_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, uvs1_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, uvs1.size() * sizeof(glm::vec2), &uvs1[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(glm::vec2), getStreamData(uvs1, mapped_streams[MESH_STREAM_UVS1]), GL_STATIC_DRAW_ARB);
 	}
 
 	// Colors
-	if (colors.size())
+	if (colors.size() || mapped_streams[MESH_STREAM_COLORS])
+	{
+		if (colors_vbo_id == 0)
+			glGenBuffersARB(1, &colors_vbo_id);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, colors_vbo_id);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(glm::vec4), getStreamData(colors, mapped_streams[MESH_STREAM_COLORS]), GL_STATIC_DRAW_ARB);
+	}
+	else if (colors8.size() || mapped_streams[MESH_STREAM_COLORS8])
 	{
 		if (colors_vbo_id == 0)
 			glGenBuffersARB(1, &colors_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, colors_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, colors.size() * sizeof(glm::vec4), &colors[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(glm::u8vec4), getStreamData(colors8, mapped_streams[MESH_STREAM_COLORS8]), GL_STATIC_DRAW_ARB);
 	}
 
-	if (bones.size())
+	if (bones.size() || mapped_streams[MESH_STREAM_BONES])
 	{
 		if (bones_vbo_id == 0)
 			glGenBuffersARB(1, &bones_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, bones_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, bones.size() * sizeof(glm::uvec4), &bones[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(glm::uvec4), getStreamData(bones, mapped_streams[MESH_STREAM_BONES]), GL_STATIC_DRAW_ARB);
 	}
-	if (weights.size())
+	if (weights.size() || mapped_streams[MESH_STREAM_WEIGHTS])
 	{
 		if (weights_vbo_id == 0)
 			glGenBuffersARB(1, &weights_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, weights_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, weights.size() * sizeof(glm::vec4), &weights[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(glm::vec4), getStreamData(weights, mapped_streams[MESH_STREAM_WEIGHTS]), GL_STATIC_DRAW_ARB);
+	}
+	else if (weights8.size() || mapped_streams[MESH_STREAM_WEIGHTS8])
+	{
+		if (weights_vbo_id == 0)
+			glGenBuffersARB(1, &weights_vbo_id);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, weights_vbo_id);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(glm::u8vec4), getStreamData(weights8, mapped_streams[MESH_STREAM_WEIGHTS8]), GL_STATIC_DRAW_ARB);
 	}
 
 	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
 
-	// Indices
-	if (indices.size())
+	// Indices (16 bits when every vertex can be addressed with them)
+	if (num_triangles)
 	{
+		const glm::uvec3* triangles = (const glm::uvec3*)getStreamData(indices, mapped_streams[MESH_STREAM_INDICES]);
 		if (indices_vbo_id == 0)
 			glGenBuffersARB(1, &indices_vbo_id);
 		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(glm::uvec3), &indices[0], GL_STATIC_DRAW_ARB);
+		if (num_vertices <= 0x10000)
+		{
+			//narrowed straight into the buffer, no temporary copy
+			glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, num_triangles * 3 * sizeof(uint16_t), NULL, GL_STATIC_DRAW_ARB);
+			uint16_t* indices16 = (uint16_t*)glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_WRITE_ONLY);
+			assert(indices16 && "cannot map the index buffer");
+			for (size_t i = 0; i < num_triangles; ++i)
+				for (int j = 0; j < 3; ++j)
+					indices16[i * 3 + j] = (uint16_t)triangles[i][j];
+			glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+			index_type = GL_UNSIGNED_SHORT;
+		}
+		else
+		{
+			glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, num_triangles * sizeof(glm::uvec3), triangles, GL_STATIC_DRAW_ARB);
+			index_type = GL_UNSIGNED_INT;
+		}
 	}
 	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
 
+	vbo_num_vertices = num_vertices;
+	vbo_num_triangles = num_triangles;
 
+	//the streams are in VRAM now, the file is not needed anymore
+	if (mapped_file)
+	{
+		delete mapped_file;
+		mapped_file = NULL;
+		memset(mapped_streams, 0, sizeof(mapped_streams));
+	}
 
 	checkGLErrors();
 
@@ -606,6 +863,8 @@ void Mesh::uploadToVRAM()
 
 bool Mesh::interleaveBuffers()
 {
+	PROFILE_FUNCTION();
+
 	if (!vertices.size() || !normals.size() || !uvs.size())
 		return false;
 
@@ -627,127 +886,619 @@ bool Mesh::interleaveBuffers()
 	return true;
 }
 
-struct sMeshInfo
+//INDEXING ****************************************************
+
+#define VCACHE_SIZE 32 //vertex cache simulated when sorting the triangles
+#define VCACHE_FIFO_SIZE 16 //cache used to split the triangles in clusters for the overdraw sorting
+
+//a stream of per vertex data seen as raw bytes, to compare and hash vertices with every attribute
+struct sVertexStream
 {
-	int version = 0;
-	int header_bytes = 0;
-	size_t size = 0;
-	size_t num_indices = 0;
-	glm::vec3 aabb_min;
-	glm::vec3 aabb_max;
-	glm::vec3 center;
-	glm::vec3 halfsize;
-	float radius = 0.0;
-	size_t num_bones = 0;
-	size_t num_submeshes = 0;
-	glm::mat4 bind_matrix;
-	char streams[8]; //Vertex/Interlaved|Normal|Uvs|Color|Indices|Bones|Weights|Extra|Uvs1
-	char extra[32]; //unused
+	const uint8_t* data;
+	size_t stride;
 };
 
-bool Mesh::readBin(const char* filename)
+struct sVertexHasher
 {
-	FILE* f;
-	assert(filename);
+	const std::vector<sVertexStream>* streams;
 
-	struct stat stbuffer;
+	size_t operator()(unsigned int vertex) const
+	{
+		uint64_t hash = 14695981039346656037ULL; //FNV-1a
+		for (const sVertexStream& stream : *streams)
+		{
+			const uint8_t* bytes = stream.data + vertex * stream.stride;
+			for (size_t i = 0; i < stream.stride; ++i)
+				hash = (hash ^ bytes[i]) * 1099511628211ULL;
+		}
+		return (size_t)hash;
+	}
+};
 
-	stat(filename, &stbuffer);
-	f = fopen(filename, "rb");
-	if (f == NULL)
-		return false;
+struct sVertexEqual
+{
+	const std::vector<sVertexStream>* streams;
 
-	unsigned int size = (unsigned int)stbuffer.st_size;
-	char* data = new char[size];
-	fread(data, size, 1, f);
-	fclose(f);
+	bool operator()(unsigned int a, unsigned int b) const
+	{
+		for (const sVertexStream& stream : *streams)
+			if (memcmp(stream.data + a * stream.stride, stream.data + b * stream.stride, stream.stride) != 0)
+				return false;
+		return true;
+	}
+};
 
-	//watermark
-	if (memcmp(data, "MBIN", 4) != 0)
+template<typename T> static void addVertexStream(std::vector<sVertexStream>& streams, const std::vector<T>& stream)
+{
+	if (stream.size())
+		streams.push_back({ (const uint8_t*)&stream[0], sizeof(T) });
+}
+
+//new_stream[i] = stream[source[i]]
+template<typename T> static void remapVertexStream(std::vector<T>& stream, const std::vector<unsigned int>& source)
+{
+	if (!stream.size())
+		return;
+	std::vector<T> remapped(source.size());
+	for (size_t i = 0; i < source.size(); ++i)
+		remapped[i] = stream[source[i]];
+	stream.swap(remapped);
+}
+
+//Tom Forsyth's scores (Linear-Speed Vertex Cache Optimisation)
+static float getVertexCacheScore(int cache_pos, int remaining_triangles)
+{
+	if (remaining_triangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cache_pos >= 0)
 	{
-		std::cout << "[ERROR] loading BIN: invalid content: " << filename << std::endl;
-		return false;
+		if (cache_pos < 3) //last triangle, no gain using it again right now
+			score = 0.75f;
+		else
+			score = powf(1.0f - (cache_pos - 3) * (1.0f / (VCACHE_SIZE - 3)), 1.5f);
 	}
 
-	char* pos = data + 4;
-	sMeshInfo info;
-	memcpy(&info, pos, sizeof(sMeshInfo));
-	pos += sizeof(sMeshInfo);
+	//boost the vertices with few triangles left, so they don't remain alone
+	return score + 2.0f * powf((float)remaining_triangles, -0.5f);
+}
 
-	if (info.version != MESH_BIN_VERSION || info.header_bytes != sizeof(sMeshInfo))
+//sorts the triangles so the vertices are reused while they are still in the post-transform cache
+//local_id must have one entry per vertex set to -1, it is left as it was
+static void optimizeVertexCache(glm::uvec3* triangles, size_t num_triangles, std::vector<int>& local_id)
+{
+	if (num_triangles < 2)
+		return;
+
+	//use local ids for the vertices of this range
+	std::vector<unsigned int> vertices;
+	std::vector<glm::ivec3> local_triangles(num_triangles);
+	for (size_t i = 0; i < num_triangles; ++i)
+		for (int j = 0; j < 3; ++j)
+		{
+			unsigned int v = triangles[i][j];
+			if (local_id[v] < 0)
+			{
+				local_id[v] = (int)vertices.size();
+				vertices.push_back(v);
+			}
+			local_triangles[i][j] = local_id[v];
+		}
+	size_t num_vertices = vertices.size();
+
+	//triangles of every vertex, the ones already emitted are moved to the end of the list
+	std::vector<int> remaining(num_vertices, 0);
+	std::vector<size_t> first_triangle(num_vertices + 1, 0);
+	for (const glm::ivec3& t : local_triangles)
+		for (int j = 0; j < 3; ++j)
+			remaining[t[j]]++;
+	for (size_t i = 0; i < num_vertices; ++i)
+		first_triangle[i + 1] = first_triangle[i] + remaining[i];
+	std::vector<int> adjacency(num_triangles * 3);
+	std::vector<size_t> fill(first_triangle.begin(), first_triangle.end() - 1);
+	for (size_t i = 0; i < num_triangles; ++i)
+		for (int j = 0; j < 3; ++j)
+			adjacency[fill[local_triangles[i][j]]++] = (int)i;
+
+	std::vector<int> cache_pos(num_vertices, -1);
+	std::vector<float> vertex_score(num_vertices);
+	for (size_t i = 0; i < num_vertices; ++i)
+		vertex_score[i] = getVertexCacheScore(-1, remaining[i]);
+
+	std::vector<float> triangle_score(num_triangles);
+	std::vector<bool> emitted(num_triangles, false);
+	int best = -1;
+	float best_score = -1.0f;
+	for (size_t i = 0; i < num_triangles; ++i)
+	{
+		const glm::ivec3& t = local_triangles[i];
+		triangle_score[i] = vertex_score[t.x] + vertex_score[t.y] + vertex_score[t.z];
+		if (triangle_score[i] > best_score)
+		{
+			best_score = triangle_score[i];
+			best = (int)i;
+		}
+	}
+
+	std::vector<glm::uvec3> sorted;
+	sorted.reserve(num_triangles);
+	int cache[VCACHE_SIZE + 3];
+	int cache_size = 0;
+	size_t cursor = 0; //first triangle that may not be emitted, used when the cache has no candidates
+
+	for (size_t n = 0; n < num_triangles; ++n)
 	{
-		std::cout << "[WARN] loading BIN: old version: " << filename << std::endl;
+		if (best < 0)
+		{
+			while (emitted[cursor])
+				cursor++;
+			best = (int)cursor;
+		}
+
+		const glm::ivec3 t = local_triangles[best];
+		emitted[best] = true;
+		sorted.push_back(triangles[best]);
+
+		//remove it from the lists of its vertices
+		for (int j = 0; j < 3; ++j)
+		{
+			int v = t[j];
+			int* list = &adjacency[first_triangle[v]];
+			for (int k = 0; k < remaining[v]; ++k)
+				if (list[k] == best)
+				{
+					std::swap(list[k], list[remaining[v] - 1]);
+					break;
+				}
+			remaining[v]--;
+		}
+
+		//the vertices of the triangle go to the front of the cache
+		int new_cache[VCACHE_SIZE + 3];
+		int new_size = 0;
+		for (int j = 0; j < 3; ++j)
+			new_cache[new_size++] = t[j];
+		for (int i = 0; i < cache_size; ++i)
+		{
+			int v = cache[i];
+			if (v != t.x && v != t.y && v != t.z)
+				new_cache[new_size++] = v;
+		}
+
+		for (int i = 0; i < new_size; ++i)
+		{
+			int v = new_cache[i];
+			cache_pos[v] = i < VCACHE_SIZE ? i : -1; //the last ones fall out of the cache
+			vertex_score[v] = getVertexCacheScore(cache_pos[v], remaining[v]);
+		}
+
+		//only the triangles touching the cache change, the next one is chosen among them
+		best = -1;
+		best_score = -1.0f;
+		for (int i = 0; i < new_size; ++i)
+		{
+			int v = new_cache[i];
+			for (int k = 0; k < remaining[v]; ++k)
+			{
+				int tri = adjacency[first_triangle[v] + k];
+				const glm::ivec3& t2 = local_triangles[tri];
+				triangle_score[tri] = vertex_score[t2.x] + vertex_score[t2.y] + vertex_score[t2.z];
+				if (triangle_score[tri] > best_score)
+				{
+					best_score = triangle_score[tri];
+					best = tri;
+				}
+			}
+		}
+
+		cache_size = std::min(new_size, VCACHE_SIZE);
+		memcpy(cache, new_cache, cache_size * sizeof(int));
+	}
+
+	memcpy(triangles, &sorted[0], num_triangles * sizeof(glm::uvec3));
+	for (unsigned int v : vertices)
+		local_id[v] = -1;
+}
+
+//splits the sorted triangles where the cache restarts and draws first the clusters facing outwards
+//(Sander et al. Fast Triangle Reordering for Vertex Locality and Reduced Overdraw), the cache order is kept inside the clusters
+static void optimizeOverdraw(glm::uvec3* triangles, size_t num_triangles, const std::vector<glm::vec3>& positions)
+{
+	if (num_triangles < 2)
+		return;
+
+	//clusters start on the triangles with no vertex in a FIFO cache
+	std::vector<size_t> clusters;
+	std::vector<unsigned int> fifo;
+	for (size_t i = 0; i < num_triangles; ++i)
+	{
+		int misses = 0;
+		for (int j = 0; j < 3; ++j)
+		{
+			unsigned int v = triangles[i][j];
+			if (std::find(fifo.begin(), fifo.end(), v) == fifo.end())
+			{
+				misses++;
+				fifo.push_back(v);
+				if (fifo.size() > VCACHE_FIFO_SIZE)
+					fifo.erase(fifo.begin());
+			}
+		}
+		if (misses == 3 || i == 0)
+			clusters.push_back(i);
+	}
+	clusters.push_back(num_triangles);
+	size_t num_clusters = clusters.size() - 1;
+	if (num_clusters < 2)
+		return;
+
+	//area weighted centroid of the whole range and of every cluster
+	glm::vec3 center(0.0f);
+	float total_area = 0.0f;
+	std::vector<glm::vec3> cluster_centroid(num_clusters, glm::vec3(0.0f));
+	std::vector<glm::vec3> cluster_normal(num_clusters, glm::vec3(0.0f));
+	for (size_t c = 0; c < num_clusters; ++c)
+	{
+		float cluster_area = 0.0f;
+		for (size_t i = clusters[c]; i < clusters[c + 1]; ++i)
+		{
+			const glm::vec3& a = positions[triangles[i].x];
+			const glm::vec3& b = positions[triangles[i].y];
+			const glm::vec3& d = positions[triangles[i].z];
+			glm::vec3 n = glm::cross(b - a, d - a); //length is twice the area
+			float area = glm::length(n);
+			glm::vec3 centroid = (a + b + d) * (1.0f / 3.0f);
+			cluster_centroid[c] += centroid * area;
+			cluster_normal[c] += n;
+			cluster_area += area;
+		}
+		center += cluster_centroid[c];
+		total_area += cluster_area;
+		if (cluster_area > 0.0f)
+			cluster_centroid[c] /= cluster_area;
+	}
+	if (total_area > 0.0f)
+		center /= total_area;
+
+	//clusters facing outwards hide the ones behind them, draw them first
+	std::vector<std::pair<float, size_t>> order(num_clusters);
+	for (size_t c = 0; c < num_clusters; ++c)
+	{
+		float normal_length = glm::length(cluster_normal[c]);
+		glm::vec3 normal = normal_length > 0.0f ? cluster_normal[c] / normal_length : glm::vec3(0.0f);
+		order[c] = std::make_pair(-glm::dot(cluster_centroid[c] - center, normal), c);
+	}
+	std::stable_sort(order.begin(), order.end(), [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) { return a.first < b.first; });
+
+	std::vector<glm::uvec3> sorted;
+	sorted.reserve(num_triangles);
+	for (const std::pair<float, size_t>& it : order)
+		sorted.insert(sorted.end(), triangles + clusters[it.second], triangles + clusters[it.second + 1]);
+	memcpy(triangles, &sorted[0], num_triangles * sizeof(glm::uvec3));
+}
+
+bool Mesh::createIndices()
+{
+	PROFILE_FUNCTION();
+
+	size_t num_vertices = vertices.size();
+	if (interleaved.size() || indices.size() || !num_vertices || num_vertices % 3)
+		return false;
+
+	//every stream must have one value per vertex (broken OBJs can have less uvs or normals than vertices)
+	if ((normals.size() && normals.size() != num_vertices) || (uvs.size() && uvs.size() != num_vertices) ||
+		(uvs1.size() && uvs1.size() != num_vertices) || (colors.size() && colors.size() != num_vertices) ||
+		(bones.size() && bones.size() != num_vertices) || (weights.size() && weights.size() != num_vertices))
 		return false;
+
+	std::vector<sVertexStream> streams;
+	addVertexStream(streams, vertices);
+	addVertexStream(streams, normals);
+	addVertexStream(streams, uvs);
+	addVertexStream(streams, uvs1);
+	addVertexStream(streams, colors);
+	addVertexStream(streams, bones);
+	addVertexStream(streams, weights);
+
+	//merge the vertices with the same attributes
+	std::vector<unsigned int> remap(num_vertices);
+	std::vector<unsigned int> unique_vertices; //first appearance of every unique vertex
+	{
+		std::unordered_map<unsigned int, unsigned int, sVertexHasher, sVertexEqual> unique(num_vertices, sVertexHasher{ &streams }, sVertexEqual{ &streams });
+		for (unsigned int i = 0; i < (unsigned int)num_vertices; ++i)
+		{
+			auto it = unique.emplace(i, (unsigned int)unique_vertices.size());
+			if (it.second)
+				unique_vertices.push_back(i);
+			remap[i] = it.first->second;
+		}
 	}
 
-	if (info.streams[0] == 'I')
+	indices.resize(num_vertices / 3);
+	for (size_t i = 0; i < indices.size(); ++i)
+		indices[i] = glm::uvec3(remap[i * 3], remap[i * 3 + 1], remap[i * 3 + 2]);
+
+	std::vector<glm::vec3> positions(unique_vertices.size());
+	for (size_t i = 0; i < unique_vertices.size(); ++i)
+		positions[i] = vertices[unique_vertices[i]];
+
+	//draw call ranges are in vertices in triangle soups and in triangles in indexed meshes
+	std::vector<std::pair<size_t, size_t>> ranges;
+	for (sSubmeshInfo& submesh : submeshes)
+		for (unsigned int i = 0; i < submesh.num_draw_calls; ++i)
+		{
+			sSubmeshDrawCallInfo& dc = submesh.draw_calls[i];
+			dc.start /= 3;
+			dc.length /= 3;
+			ranges.push_back(std::make_pair(dc.start, dc.length));
+		}
+	if (ranges.empty())
+		ranges.push_back(std::make_pair((size_t)0, indices.size()));
+
+	//triangles can only be sorted inside their draw call
+	std::vector<int> local_id(unique_vertices.size(), -1);
+	for (const std::pair<size_t, size_t>& range : ranges)
 	{
-		interleaved.resize(info.size);
-		memcpy((void*)&interleaved[0], pos, sizeof(tInterleaved) * info.size);
-		pos += sizeof(tInterleaved) * info.size;
+		if (range.first + range.second > indices.size())
+			continue;
+		optimizeVertexCache(&indices[range.first], range.second, local_id);
+		optimizeOverdraw(&indices[range.first], range.second, positions);
 	}
-	else if (info.streams[0] == 'V')
+
+	//store the vertices in the order they are used, so the fetches are close in memory too
+	std::vector<unsigned int> new_id(unique_vertices.size(), 0xFFFFFFFF);
+	std::vector<unsigned int> source; //old vertex of every new vertex
+	source.reserve(unique_vertices.size());
+	for (glm::uvec3& triangle : indices)
+		for (int j = 0; j < 3; ++j)
+		{
+			unsigned int& v = triangle[j];
+			if (new_id[v] == 0xFFFFFFFF)
+			{
+				new_id[v] = (unsigned int)source.size();
+				source.push_back(unique_vertices[v]);
+			}
+			v = new_id[v];
+		}
+
+	remapVertexStream(vertices, source);
+	remapVertexStream(normals, source);
+	remapVertexStream(uvs, source);
+	remapVertexStream(uvs1, source);
+	remapVertexStream(colors, source);
+	remapVertexStream(bones, source);
+	remapVertexStream(weights, source);
+
+	std::cout << "[" << num_vertices << " -> " << vertices.size() << " vertices] ";
+	return true;
+}
+
+//QUANTIZATION ****************************************************
+
+//octahedral encoding of an unit vector, decoded in the shaders
+static glm::vec2 encodeOctahedral(const glm::vec3& n)
+{
+	float sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (sum == 0.0f)
+		return glm::vec2(0.0f);
+	glm::vec2 e(n.x / sum, n.y / sum);
+	if (n.z < 0.0f)
 	{
-		vertices.resize(info.size);
-		memcpy((void*)&vertices[0], pos, sizeof(glm::vec3) * info.size);
-		pos += sizeof(glm::vec3) * info.size;
+		glm::vec2 folded((1.0f - fabsf(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f), (1.0f - fabsf(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f));
+		e = folded;
 	}
+	return e;
+}
+
+static int16_t quantizeSnorm16(float v)
+{
+	return (int16_t)roundf(glm::clamp(v, -1.0f, 1.0f) * 32767.0f);
+}
+
+static uint8_t quantizeUnorm8(float v)
+{
+	return (uint8_t)roundf(glm::clamp(v, 0.0f, 1.0f) * 255.0f);
+}
 
-	if (info.streams[1] == 'N')
+bool Mesh::quantizeBuffers()
+{
+	PROFILE_FUNCTION();
+
+	size_t num_vertices = interleaved.size() ? interleaved.size() : vertices.size();
+	if (vertex_format != VERTEX_FORMAT_FLOAT || !num_vertices)
+		return false;
+	if (!interleaved.size() && ((normals.size() && normals.size() != num_vertices) || (uvs.size() && uvs.size() != num_vertices)))
+		return false;
+
+	//the positions are stored relative to their bounding box, computed here so it is always tight
+	glm::vec3 min_pos(FLT_MAX);
+	glm::vec3 max_pos(-FLT_MAX);
+	for (size_t i = 0; i < num_vertices; ++i)
 	{
-		normals.resize(info.size);
-		memcpy((void*)&normals[0], pos, sizeof(glm::vec3) * info.size);
-		pos += sizeof(glm::vec3) * info.size;
+		const glm::vec3& p = interleaved.size() ? interleaved[i].vertex : vertices[i];
+		min_pos = glm::min(min_pos, p);
+		max_pos = glm::max(max_pos, p);
 	}
+	glm::vec3 extent = max_pos - min_pos;
+	glm::vec3 inv_extent(extent.x > 0.0f ? 1.0f / extent.x : 0.0f, extent.y > 0.0f ? 1.0f / extent.y : 0.0f, extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
 
-	if (info.streams[2] == 'U')
+	quantized.resize(num_vertices);
+	for (size_t i = 0; i < num_vertices; ++i)
 	{
-		uvs.resize(info.size);
-		memcpy((void*)&uvs[0], pos, sizeof(glm::vec2) * info.size);
-		pos += sizeof(glm::vec2) * info.size;
+		glm::vec3 p = interleaved.size() ? interleaved[i].vertex : vertices[i];
+		glm::vec3 n = interleaved.size() ? interleaved[i].normal : normals.size() ? normals[i] : glm::vec3(0.0f);
+		glm::vec2 uv = interleaved.size() ? interleaved[i].uv : uvs.size() ? uvs[i] : glm::vec2(0.0f);
+
+		tQuantized& q = quantized[i];
+		glm::vec3 t = (p - min_pos) * inv_extent;
+		for (int j = 0; j < 3; ++j)
+			q.position[j] = (uint16_t)roundf(glm::clamp(t[j], 0.0f, 1.0f) * 65535.0f);
+		q.position[3] = 0;
+
+		glm::vec2 e = encodeOctahedral(n);
+		q.normal[0] = quantizeSnorm16(e.x);
+		q.normal[1] = quantizeSnorm16(e.y);
+
+		q.uv[0] = glm::packHalf1x16(uv.x);
+		q.uv[1] = glm::packHalf1x16(uv.y);
 	}
 
-	if (info.streams[3] == 'C')
+	colors8.resize(colors.size());
+	for (size_t i = 0; i < colors.size(); ++i)
+		colors8[i] = glm::u8vec4(quantizeUnorm8(colors[i].x), quantizeUnorm8(colors[i].y), quantizeUnorm8(colors[i].z), quantizeUnorm8(colors[i].w));
+
+	//the rounding error goes to the biggest weight so they still add up to one
+	weights8.resize(weights.size());
+	for (size_t i = 0; i < weights.size(); ++i)
 	{
-		colors.resize(info.size);
-		memcpy((void*)&colors[0], pos, sizeof(glm::vec4) * info.size);
-		pos += sizeof(glm::vec4) * info.size;
+		glm::u8vec4& w = weights8[i];
+		int sum = 0;
+		int biggest = 0;
+		for (int j = 0; j < 4; ++j)
+		{
+			w[j] = quantizeUnorm8(weights[i][j]);
+			sum += w[j];
+			if (weights[i][j] > weights[i][biggest])
+				biggest = j;
+		}
+		float total = weights[i].x + weights[i].y + weights[i].z + weights[i].w;
+		if (fabsf(total - 1.0f) < 0.01f)
+			w[biggest] = (uint8_t)std::clamp(w[biggest] + 255 - sum, 0, 255);
 	}
 
-	if (info.streams[4] == 'I')
+	position_offset = min_pos;
+	position_scale = extent;
+	vertex_format = VERTEX_FORMAT_QUANTIZED;
+
+	std::vector<tInterleaved>().swap(interleaved);
+	std::vector<glm::vec3>().swap(vertices);
+	std::vector<glm::vec3>().swap(normals);
+	std::vector<glm::vec2>().swap(uvs);
+	std::vector<glm::vec4>().swap(colors);
+	std::vector<glm::vec4>().swap(weights);
+	return true;
+}
+
+#define MBIN_STREAM_ALIGNMENT 64 //streams start at cache line boundaries, the mapping is page aligned
+
+struct sMeshInfo
+{
+	int32_t version = 0;
+	int32_t header_bytes = 0;
+	uint64_t num_vertices = 0;
+	uint64_t num_indices = 0; //triangles
+	uint64_t num_bones = 0;
+	uint64_t num_submeshes = 0;
+	uint64_t checksum = 0; //of the streams, to discard truncated or corrupted files
+	uint64_t stream_offset[MESH_NUM_STREAMS]; //from the start of the file, 0 if the stream is not stored
+	uint64_t stream_bytes[MESH_NUM_STREAMS];
+	glm::vec3 aabb_min;
+	glm::vec3 aabb_max;
+	glm::vec3 center;
+	glm::vec3 halfsize;
+	float radius = 0.0;
+	glm::mat4 bind_matrix;
+	int32_t vertex_format = 0;
+	glm::vec3 position_offset;
+	glm::vec3 position_scale;
+	char extra[32]; //unused
+};
+
+//64 bits hash with four independent lanes so it runs close to the memory bandwidth
+static uint64_t computeChecksum(const char* data, size_t size)
+{
+	const uint64_t prime = 0x100000001B3ull;
+	uint64_t lanes[4] = { 0xCBF29CE484222325ull, 0x84222325CBF29CE4ull, 0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full };
+	size_t num_blocks = size / 32;
+	for (size_t i = 0; i < num_blocks; ++i)
+	{
+		uint64_t words[4];
+		memcpy(words, data + i * 32, 32);
+		for (int j = 0; j < 4; ++j)
+		{
+			lanes[j] = (lanes[j] ^ words[j]) * prime;
+			lanes[j] ^= lanes[j] >> 29;
+		}
+	}
+
+	uint64_t hash = size;
+	for (int j = 0; j < 4; ++j)
+		hash = (hash ^ lanes[j]) * prime;
+	for (size_t i = num_blocks * 32; i < size; ++i)
+		hash = (hash ^ (uint8_t)data[i]) * prime;
+	return hash ^ (hash >> 32);
+}
+
+static uint64_t combineChecksum(uint64_t checksum, uint64_t stream_checksum)
+{
+	return (checksum ^ stream_checksum) * 0x100000001B3ull + 0x9E3779B97F4A7C15ull;
+}
+
+bool Mesh::readBin(const char* filename)
+{
+	PROFILE_FUNCTION();
+
+	assert(filename);
+
+	MappedFile* file = new MappedFile();
+	if (!file->open(filename))
+	{
+		delete file;
+		return false;
+	}
+
+	//watermark
+	if (file->size < 4 + sizeof(sMeshInfo) || memcmp(file->data, "MBIN", 4) != 0)
 	{
-		indices.resize(info.num_indices);
-		memcpy((void*)&indices[0], pos, sizeof(glm::vec3) * info.num_indices);
-		pos += sizeof(glm::vec3) * info.num_indices;
+		std::cout << "[ERROR] loading BIN: invalid content: " << filename << std::endl;
+		delete file;
+		return false;
 	}
 
-	if (info.streams[5] == 'B')
+	sMeshInfo info;
+	memcpy(&info, file->data + 4, sizeof(sMeshInfo));
+
+	if (info.version != MESH_BIN_VERSION || info.header_bytes != sizeof(sMeshInfo))
 	{
-		bones.resize(info.size);
-		memcpy((void*)&bones[0], pos, sizeof(glm::vec4) * info.size);
-		pos += sizeof(glm::vec4) * info.size;
+		std::cout << "[WARN] loading BIN: old version: " << filename << std::endl;
+		delete file;
+		return false;
 	}
 
-	if (info.streams[6] == 'W')
+	//every stream must be inside the file and have the size its elements need
+	const size_t element_size[MESH_NUM_STREAMS] = { sizeof(glm::vec3), sizeof(glm::vec3), sizeof(glm::vec2), sizeof(glm::vec4), sizeof(glm::uvec3), sizeof(glm::vec4), sizeof(glm::vec4), sizeof(glm::vec2), sizeof(tInterleaved), sizeof(BoneInfo), sizeof(sSubmeshInfo), sizeof(tQuantized), sizeof(glm::u8vec4), sizeof(glm::u8vec4) };
+	uint64_t checksum = 0;
+	for (int i = 0; i < MESH_NUM_STREAMS; ++i)
 	{
-		weights.resize(info.size);
-		memcpy((void*)&weights[0], pos, sizeof(glm::vec4) * info.size);
-		pos += sizeof(glm::vec4) * info.size;
+		uint64_t offset = info.stream_offset[i];
+		uint64_t bytes = info.stream_bytes[i];
+		if (!offset)
+			continue;
+		uint64_t count = i == MESH_STREAM_INDICES ? info.num_indices : i == MESH_STREAM_BONES_INFO ? info.num_bones : i == MESH_STREAM_SUBMESHES ? info.num_submeshes : info.num_vertices;
+		if (offset % MBIN_STREAM_ALIGNMENT || offset > file->size || bytes > file->size - offset || bytes != count * element_size[i])
+		{
+			std::cout << "[ERROR] loading BIN: corrupted streams: " << filename << std::endl;
+			delete file;
+			return false;
+		}
+		checksum = combineChecksum(checksum, computeChecksum(file->data + offset, bytes));
 	}
 
-	if (info.streams[7] == 'u')
+	if (checksum != info.checksum)
 	{
-		uvs1.resize(info.size);
-		memcpy((void*)&uvs1[0], pos, sizeof(glm::vec2) * info.size);
-		pos += sizeof(glm::vec2) * info.size;
+		std::cout << "[ERROR] loading BIN: wrong checksum: " << filename << std::endl;
+		delete file;
+		return false;
 	}
 
+	//small streams are always copied
+	bones_info.resize(info.num_bones);
 	if (info.num_bones)
-	{
-		bones_info.resize(info.num_bones);
-		memcpy((void*)&bones_info[0], pos, sizeof(BoneInfo) * info.num_bones);
-		pos += sizeof(BoneInfo) * info.num_bones;
-	}
+		memcpy((void*)&bones_info[0], file->data + info.stream_offset[MESH_STREAM_BONES_INFO], info.stream_bytes[MESH_STREAM_BONES_INFO]);
+	submeshes.resize(info.num_submeshes);
+	if (info.num_submeshes)
+		memcpy((void*)&submeshes[0], file->data + info.stream_offset[MESH_STREAM_SUBMESHES], info.stream_bytes[MESH_STREAM_SUBMESHES]);
 
 	aabb_max = info.aabb_max;
 	aabb_min = info.aabb_min;
@@ -755,12 +1506,40 @@ bool Mesh::readBin(const char* filename)
 	box.halfsize = info.halfsize;
 	radius = info.radius;
 	bind_matrix = info.bind_matrix;
+	vertex_format = (eVertexFormat)info.vertex_format;
+	position_offset = info.position_offset;
+	position_scale = info.position_scale;
 
-	submeshes.resize(info.num_submeshes);
-	if (info.num_submeshes)
+	if (!keep_in_ram && auto_upload_to_vram)
+	{
+		//the file stays mapped and the streams go from it to the VRAM in uploadToVRAM
+		for (int i = 0; i < MESH_NUM_STREAMS; ++i)
+			mapped_streams[i] = info.stream_offset[i] ? file->data + info.stream_offset[i] : NULL;
+		mapped_file = file;
+		vbo_num_vertices = info.num_vertices;
+		vbo_num_triangles = info.num_indices;
+	}
+	else
 	{
-		memcpy(&submeshes[0], pos, sizeof(sSubmeshInfo) * info.num_submeshes);
-		pos += sizeof(sSubmeshInfo) * info.num_submeshes;
+		auto copyStream = [&](auto& stream, int stream_id) {
+			if (!info.stream_offset[stream_id])
+				return;
+			stream.resize(info.stream_bytes[stream_id] / sizeof(stream[0]));
+			memcpy((void*)&stream[0], file->data + info.stream_offset[stream_id], info.stream_bytes[stream_id]);
+		};
+		copyStream(vertices, MESH_STREAM_VERTICES);
+		copyStream(normals, MESH_STREAM_NORMALS);
+		copyStream(uvs, MESH_STREAM_UVS);
+		copyStream(colors, MESH_STREAM_COLORS);
+		copyStream(indices, MESH_STREAM_INDICES);
+		copyStream(bones, MESH_STREAM_BONES);
+		copyStream(weights, MESH_STREAM_WEIGHTS);
+		copyStream(uvs1, MESH_STREAM_UVS1);
+		copyStream(interleaved, MESH_STREAM_INTERLEAVED);
+		copyStream(quantized, MESH_STREAM_QUANTIZED);
+		copyStream(colors8, MESH_STREAM_COLORS8);
+		copyStream(weights8, MESH_STREAM_WEIGHTS8);
+		delete file;
 	}
 
 	// if the mtl is not specified in the obj but it's needed
@@ -782,25 +1561,26 @@ bool Mesh::readBin(const char* filename)
 
 bool Mesh::writeBin(const char* filename)
 {
-	assert(vertices.size() || interleaved.size());
+	PROFILE_FUNCTION();
+
+	assert(getNumVertices());
 	std::string s_filename = filename;
 	s_filename += ".mbin";
 
-	FILE* f = fopen(s_filename.c_str(), "wb");
+	//written aside and renamed over the old one, meshes still mapping it keep the old file
+	std::string tmp_filename = s_filename + ".tmp";
+	FILE* f = fopen(tmp_filename.c_str(), "wb");
 	if (f == NULL)
 	{
-		std::cout << "[ERROR] cannot write mesh BIN: " << s_filename.c_str() << std::endl;
+		std::cout << "[ERROR] cannot write mesh BIN: " << tmp_filename.c_str() << std::endl;
 		return false;
 	}
 
-	//watermark
-	fwrite("MBIN", sizeof(char), 4, f);
-
 	sMeshInfo info;
 	memset(&info, 0, sizeof(info));
 	info.version = MESH_BIN_VERSION;
 	info.header_bytes = sizeof(sMeshInfo);
-	info.size = interleaved.size() ? interleaved.size() : vertices.size();
+	info.num_vertices = getNumVertices();
 	info.num_indices = indices.size();
 	info.aabb_max = aabb_max;
 	info.aabb_min = aabb_min;
@@ -810,50 +1590,77 @@ bool Mesh::writeBin(const char* filename)
 	info.num_bones = bones_info.size();
 	info.bind_matrix = bind_matrix;
 	info.num_submeshes = submeshes.size();
-
-	info.streams[0] = interleaved.size() ? 'I' : 'V';
-	info.streams[1] = normals.size() ? 'N' : ' ';
-	info.streams[2] = uvs.size() ? 'U' : ' ';
-	info.streams[3] = colors.size() ? 'C' : ' ';
-	info.streams[4] = indices.size() ? 'I' : ' ';
-	info.streams[5] = bones.size() ? 'B' : ' ';
-	info.streams[6] = weights.size() ? 'W' : ' ';
-	info.streams[7] = uvs1.size() ? 'u' : ' ';
-
-	//write info
+	info.vertex_format = vertex_format;
+	info.position_offset = position_offset;
+	info.position_scale = position_scale;
+
+	const void* streams[MESH_NUM_STREAMS] = {};
+	auto addStream = [&](const auto& stream, int stream_id) {
+		if (!stream.size())
+			return;
+		streams[stream_id] = &stream[0];
+		info.stream_bytes[stream_id] = stream.size() * sizeof(stream[0]);
+	};
+	if (quantized.size())
+		addStream(quantized, MESH_STREAM_QUANTIZED);
+	else if (interleaved.size())
+		addStream(interleaved, MESH_STREAM_INTERLEAVED);
+	else
+	{
+		addStream(vertices, MESH_STREAM_VERTICES);
+		addStream(normals, MESH_STREAM_NORMALS);
+		addStream(uvs, MESH_STREAM_UVS);
+	}
+	addStream(colors, MESH_STREAM_COLORS);
+	addStream(colors8, MESH_STREAM_COLORS8);
+	addStream(indices, MESH_STREAM_INDICES);
+	addStream(bones, MESH_STREAM_BONES);
+	addStream(weights, MESH_STREAM_WEIGHTS);
+	addStream(weights8, MESH_STREAM_WEIGHTS8);
+	addStream(uvs1, MESH_STREAM_UVS1);
+	addStream(bones_info, MESH_STREAM_BONES_INFO);
+	addStream(submeshes, MESH_STREAM_SUBMESHES);
+
+	//place the streams after the header, aligned
+	uint64_t offset = 4 + sizeof(sMeshInfo);
+	for (int i = 0; i < MESH_NUM_STREAMS; ++i)
+	{
+		if (!streams[i])
+			continue;
+		offset = (offset + MBIN_STREAM_ALIGNMENT - 1) / MBIN_STREAM_ALIGNMENT * MBIN_STREAM_ALIGNMENT;
+		info.stream_offset[i] = offset;
+		offset += info.stream_bytes[i];
+		info.checksum = combineChecksum(info.checksum, computeChecksum((const char*)streams[i], info.stream_bytes[i]));
+	}
+
+	//watermark and info
+	fwrite("MBIN", sizeof(char), 4, f);
 	fwrite((void*)&info, sizeof(sMeshInfo), 1, f);
 
 	//write streams
-	if (interleaved.size())
-		fwrite((void*)&interleaved[0], interleaved.size() * sizeof(tInterleaved), 1, f);
-	else
+	const char padding[MBIN_STREAM_ALIGNMENT] = {};
+	uint64_t written = 4 + sizeof(sMeshInfo);
+	bool ok = true;
+	for (int i = 0; i < MESH_NUM_STREAMS; ++i)
 	{
-		fwrite((void*)&vertices[0], vertices.size() * sizeof(glm::vec3), 1, f);
-		if (normals.size())
-			fwrite((void*)&normals[0], normals.size() * sizeof(glm::vec3), 1, f);
-		if (uvs.size())
-			fwrite((void*)&uvs[0], uvs.size() * sizeof(glm::vec2), 1, f);
+		if (!streams[i])
+			continue;
+		if (info.stream_offset[i] > written)
+			fwrite(padding, (size_t)(info.stream_offset[i] - written), 1, f);
+		ok = ok && fwrite(streams[i], (size_t)info.stream_bytes[i], 1, f) == 1;
+		written = info.stream_offset[i] + info.stream_bytes[i];
 	}
 
-	if (colors.size())
-		fwrite((void*)&colors[0], colors.size() * sizeof(glm::vec4), 1, f);
-
-	if (indices.size())
-		fwrite((void*)&indices[0], indices.size() * sizeof(glm::vec3), 1, f);
-
-	if (bones.size())
-		fwrite((void*)&bones[0], bones.size() * sizeof(glm::vec4), 1, f);
-	if (weights.size())
-		fwrite((void*)&weights[0], weights.size() * sizeof(glm::vec4), 1, f);
-	if (bones_info.size())
-		fwrite((void*)&bones_info[0], bones_info.size() * sizeof(BoneInfo), 1, f);
-	if (uvs1.size())
-		fwrite((void*)&uvs1[0], uvs1.size() * sizeof(glm::vec2), 1, f);
-
-	if (submeshes.size())
-		fwrite((void*)&submeshes[0], submeshes.size() * sizeof(sSubmeshInfo), 1, f);
-
-	fclose(f);
+	ok = fclose(f) == 0 && ok;
+	std::error_code error;
+	if (ok)
+		std::filesystem::rename(tmp_filename, s_filename, error);
+	if (!ok || error)
+	{
+		std::cout << "[ERROR] cannot write mesh BIN: " << s_filename.c_str() << std::endl;
+		std::remove(tmp_filename.c_str());
+		return false;
+	}
 	return true;
 }
 
@@ -932,221 +1739,361 @@ bool Mesh::parseMTL(const char* filename)
 	return true;
 }
 
-void parseFromText(glm::vec3& v, const char* text, const char separator)
+//OBJ parsing: the file is split in chunks (aligned to lines) that are parsed in parallel and merged in order
+#define OBJ_MIN_CHUNK_SIZE (1 << 20) //smaller files are parsed in one chunk
+
+struct sOBJCorner
 {
-	int pos = 0;
-	char num[255];
-	const char* start = text;
-	const char* current = text;
+	int index[3]; //position, uv, normal as written in the file (1-based, 0 if missing)
+	uint8_t relative; //bit per index, negative indices are stored relative to the chunk start
+};
 
-	while (1)
-	{
-		if (*current == separator || (*current == '\0' && current != text))
-		{
-			strncpy(num, start, current - start);
-			num[current - start] = '\0';
-			start = current + 1;
-			if (num[0] != 'x')
-				switch (pos)
-				{
-				case 0: v.x = (float)atof(num); break;
-				case 1: v.y = (float)atof(num); break;
-				case 2: v.z = (float)atof(num); break;
-				default: return; break;
-				}
+struct sOBJEvent
+{
+	enum { MTLLIB, OBJECT, USEMTL } type;
+	size_t triangle; //triangles of the chunk before this line
+	std::string_view name;
+};
 
-			++pos;
-			if (*current == '\0')
-				break;
-		}
+struct sOBJChunk
+{
+	std::string_view text;
 
-		++current;
-	}
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec4> colors;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	std::vector<sOBJCorner> corners; //3 per triangle
+	std::vector<sOBJEvent> events; //lines that change the submeshes, replayed when merging
+
+	//triangles parsed before the first color/uv/normal of the chunk, faces only get the attributes already seen
+	size_t first_triangle[3] = { SIZE_MAX, SIZE_MAX, SIZE_MAX };
+
+	glm::vec3 aabb_min;
+	glm::vec3 aabb_max;
 };
 
-bool Mesh::loadOBJ(const char* filename)
+//splits by spaces (like tokenize) without allocating, tokens point to the file data
+static void tokenizeOBJLine(std::string_view line, std::vector<std::string_view>& tokens)
 {
-	struct stat stbuffer;
-
-	FILE* f = fopen(filename, "rb");
-	if (f == NULL)
+	tokens.clear();
+	size_t pos = 0;
+	while (pos < line.size())
 	{
-		std::cerr << "File not found: " << filename << std::endl;
-		return false;
+		while (pos < line.size() && line[pos] == ' ') pos++;
+		size_t end = pos;
+		while (end < line.size() && line[end] != ' ') end++;
+		if (end > pos)
+			tokens.push_back(line.substr(pos, end - pos));
+		pos = end;
 	}
+}
 
-	stat(filename, &stbuffer);
-
-	unsigned int size = stbuffer.st_size;
-	char* data = new char[size + 1];
-	fread(data, size, 1, f);
-	fclose(f);
-	data[size] = 0;
-
-	char* pos = data;
-	char line[255];
-	int i = 0;
+//same result as (float)atof, parsed as double first to get the same rounding
+static float parseOBJFloat(std::string_view token)
+{
+	const char* first = token.data();
+	const char* last = first + token.size();
+	while (first < last && isspace((unsigned char)*first)) first++;
+	if (first < last && *first == '+') first++;
+	double value = 0.0;
+	std::from_chars(first, last, value);
+	return (float)value;
+}
 
-	std::vector<glm::vec3> indexed_positions;
-	std::vector<glm::vec4> indexed_colors;
-	std::vector<glm::vec3> indexed_normals;
-	std::vector<glm::vec2> indexed_uvs;
+//parses "p/t/n", missing or invalid fields are 0
+static void parseOBJCorner(std::string_view token, sOBJCorner& corner)
+{
+	corner.index[0] = corner.index[1] = corner.index[2] = 0;
+	corner.relative = 0;
+	for (int i = 0; i < 3 && token.size(); ++i)
+	{
+		size_t slash = token.find('/');
+		std::string_view field = token.substr(0, slash);
+		int value = 0;
+		std::from_chars(field.data(), field.data() + field.size(), value);
+		corner.index[i] = value;
+		if (slash == std::string_view::npos)
+			break;
+		token.remove_prefix(slash + 1);
+	}
+}
 
+static void parseOBJChunk(sOBJChunk& chunk)
+{
 	const float max_float = 10000000;
 	const float min_float = -10000000;
-	aabb_min = glm::vec3(max_float, max_float, max_float);
-	aabb_max = glm::vec3(min_float, min_float, min_float);
-
-	unsigned int vertex_i = 0;
-	unsigned int submesh_draw_calls = 0;
-
-	sSubmeshInfo submesh_info;
-	memset(&submesh_info, 0, sizeof(submesh_info));
+	chunk.aabb_min = glm::vec3(max_float, max_float, max_float);
+	chunk.aabb_max = glm::vec3(min_float, min_float, min_float);
 
-	sSubmeshDrawCallInfo submesh_dc_info;
-	memset(&submesh_dc_info, 0, sizeof(submesh_dc_info));
-	submesh_dc_info.start = 0;
-	size_t last_submesh_vertex = 0;
+	std::vector<std::string_view> tokens;
+	std::string_view text = chunk.text;
+	size_t pos = 0;
 
-	//parse file
-	while (*pos != 0)
+	while (pos < text.size())
 	{
-		if (*pos == '\n') pos++;
-		if (*pos == '\r') pos++;
-
-		//read one line
-		i = 0;
-		while (i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
-		memcpy(line, pos, i);
-		line[i] = 0;
-		pos = pos + i;
-
-		//std::cout << "Line: \"" << line << "\"" << std::endl;
-		if (*line == '#' || *line == 0) continue; //comment
+		size_t end = text.find_first_of("\r\n", pos);
+		if (end == std::string_view::npos)
+			end = text.size();
+		std::string_view line = text.substr(pos, end - pos);
+		pos = end + 1;
 
-		//tokenize line
-		std::vector<std::string> tokens = tokenize(line, " ");
+		if (line.empty() || line[0] == '#') continue; //comment
 
+		tokenizeOBJLine(line, tokens);
 		if (tokens.empty()) continue;
 
-		if (tokens[0] == "mtllib") //material file
-		{
-			std::string mesh_path = filename;
-			size_t lastPath = mesh_path.find_last_of('/');
-			std::string path = mesh_path.substr(0, lastPath) + '/' + tokens[1];
-			if (!parseMTL(path.c_str()))
-				std::cerr << "MTL file not found: " << path.c_str() << std::endl;
-		}
-		else if (tokens[0] == "v")
-		{
-			glm::vec3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()));
-			indexed_positions.push_back(v);
+		std::string_view type = tokens[0];
+		size_t num_triangles = chunk.corners.size() / 3;
 
-			//aabb_min.setMin(v);
-			if (v.x < aabb_min.x) aabb_min.x = v.x;
-			if (v.y < aabb_min.y) aabb_min.y = v.y;
-			if (v.z < aabb_min.z) aabb_min.z = v.z;
+		if (type == "v")
+		{
+			glm::vec3 v(tokens.size() > 1 ? parseOBJFloat(tokens[1]) : 0.0f, tokens.size() > 2 ? parseOBJFloat(tokens[2]) : 0.0f, tokens.size() > 3 ? parseOBJFloat(tokens[3]) : 0.0f);
+			chunk.positions.push_back(v);
 
-			//aabb_max.setMax(v);
-			if (v.x > aabb_max.x) aabb_max.x = v.x;
-			if (v.y > aabb_max.y) aabb_max.y = v.y;
-			if (v.z > aabb_max.z) aabb_max.z = v.z;
+			if (v.x < chunk.aabb_min.x) chunk.aabb_min.x = v.x;
+			if (v.y < chunk.aabb_min.y) chunk.aabb_min.y = v.y;
+			if (v.z < chunk.aabb_min.z) chunk.aabb_min.z = v.z;
+			if (v.x > chunk.aabb_max.x) chunk.aabb_max.x = v.x;
+			if (v.y > chunk.aabb_max.y) chunk.aabb_max.y = v.y;
+			if (v.z > chunk.aabb_max.z) chunk.aabb_max.z = v.z;
 
 			if (tokens.size() > 4) {
-				glm::vec4 color((float)atof(tokens[4].c_str()), (float)atof(tokens[5].c_str()), (float)atof(tokens[6].c_str()), 1.0);
-				indexed_colors.push_back(color);
+				glm::vec4 color(parseOBJFloat(tokens[4]), tokens.size() > 5 ? parseOBJFloat(tokens[5]) : 0.0f, tokens.size() > 6 ? parseOBJFloat(tokens[6]) : 0.0f, 1.0);
+				if (chunk.colors.empty())
+					chunk.first_triangle[0] = num_triangles;
+				chunk.colors.push_back(color);
 			}
 		}
-		else if (tokens[0] == "vt" && tokens.size() >= 3)
+		else if (type == "vt" && tokens.size() >= 3)
 		{
-			glm::vec2 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()));
-			indexed_uvs.push_back(v);
+			if (chunk.uvs.empty())
+				chunk.first_triangle[1] = num_triangles;
+			chunk.uvs.push_back(glm::vec2(parseOBJFloat(tokens[1]), parseOBJFloat(tokens[2])));
 		}
-		else if (tokens[0] == "vn" && tokens.size() == 4)
+		else if (type == "vn" && tokens.size() == 4)
 		{
-			glm::vec3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()));
-			indexed_normals.push_back(v);
+			if (chunk.normals.empty())
+				chunk.first_triangle[2] = num_triangles;
+			chunk.normals.push_back(glm::vec3(parseOBJFloat(tokens[1]), parseOBJFloat(tokens[2]), parseOBJFloat(tokens[3])));
 		}
-		else if (tokens[0] == "o") // submesh
+		else if (type == "f" && tokens.size() >= 4)
 		{
-			if (submesh_draw_calls > 0)
+			//local counts to resolve negative indices, the chunk offsets are added when merging
+			const size_t counts[3] = { chunk.positions.size(), chunk.uvs.size(), chunk.normals.size() };
+			sOBJCorner face[3];
+			for (size_t i = 1; i < tokens.size(); ++i)
 			{
-				// Store last submesh drawcall
-				submesh_dc_info.length = vertices.size() - submesh_dc_info.start;
-				last_submesh_vertex = vertices.size();
-				submesh_info.draw_calls[submesh_draw_calls] = submesh_dc_info;
-				submesh_dc_info.start = last_submesh_vertex;
-
-				// Store submesh
-				submesh_info.num_draw_calls = submesh_draw_calls + 1;
-				submeshes.push_back(submesh_info);
-
-				// New submesh
-				memset(&submesh_info, 0, sizeof(submesh_info));
-				strcpy(submesh_info.name, tokens[1].c_str());
-				submesh_draw_calls = 0;
+				sOBJCorner& corner = face[i == 1 ? 0 : 2];
+				if (i > 2)
+					face[1] = face[2];
+				parseOBJCorner(tokens[i], corner);
+				for (int k = 0; k < 3; ++k)
+					if (corner.index[k] < 0)
+					{
+						corner.index[k] += (int)counts[k] + 1;
+						corner.relative |= 1 << k;
+					}
+				if (i > 2)
+					chunk.corners.insert(chunk.corners.end(), face, face + 3);
 			}
-			else
-				strcpy(submesh_info.name, tokens[1].c_str());
 		}
-		else if (tokens[0] == "usemtl") //surface? it appears one time before the faces
+		else if (type == "mtllib" || type == "o" || type == "usemtl")
 		{
-			if (last_submesh_vertex != vertices.size())
-			{
-				// Store draw call
-				submesh_dc_info.length = vertices.size() - submesh_dc_info.start;
-				last_submesh_vertex = vertices.size();
-				submesh_info.draw_calls[submesh_draw_calls] = submesh_dc_info;
-				submesh_draw_calls++;
-
-				// New draw call
-				memset(&submesh_dc_info, 0, sizeof(submesh_dc_info));
-				strcpy(submesh_dc_info.material, tokens[1].c_str());
-				submesh_dc_info.start = last_submesh_vertex;
-			}
-			else
-				strcpy(submesh_dc_info.material, tokens[1].c_str());
+			sOBJEvent event;
+			event.type = type == "mtllib" ? sOBJEvent::MTLLIB : (type == "o" ? sOBJEvent::OBJECT : sOBJEvent::USEMTL);
+			event.triangle = num_triangles;
+			event.name = tokens.size() > 1 ? tokens[1] : std::string_view();
+			chunk.events.push_back(event);
 		}
-		else if (tokens[0] == "g") //surface? it appears one time before the faces
-		{
+	}
+}
 
-		}
-		else if (tokens[0] == "f" && tokens.size() >= 4)
+template<typename T> static T fetchOBJAttribute(const std::vector<T>& values, int index)
+{
+	return index > 0 && index <= (int)values.size() ? values[index - 1] : T(0.0f);
+}
+
+static void copyOBJName(char* dest, std::string_view name)
+{
+	size_t length = std::min(name.size(), (size_t)31);
+	memcpy(dest, name.data(), length);
+	dest[length] = 0;
+}
+
+bool Mesh::loadOBJ(const char* filename)
+{
+	PROFILE_FUNCTION();
+
+	std::string content;
+	if (!readFile(filename, content))
+	{
+		std::cerr << "File not found: " << filename << std::endl;
+		return false;
+	}
+
+	//split in chunks that end after a line break
+	std::string_view text = content;
+	int num_chunks = std::max(1, std::min(WorkQueue::getNumThreads() + 1, (int)(text.size() / OBJ_MIN_CHUNK_SIZE)));
+	std::vector<sOBJChunk> chunks(num_chunks);
+	size_t start = 0;
+	for (int i = 0; i < num_chunks; ++i)
+	{
+		size_t end = (i == num_chunks - 1) ? text.size() : std::max(start, text.size() * (i + 1) / num_chunks);
+		end = text.find('\n', end);
+		end = (end == std::string_view::npos) ? text.size() : end + 1;
+		chunks[i].text = text.substr(start, end - start);
+		start = end;
+	}
+
+	{
+		PROFILE_SCOPE("parseOBJChunks");
+		WorkQueue::parallelFor(num_chunks, [&](int i) { parseOBJChunk(chunks[i]); });
+	}
+
+	//offsets of every chunk in the whole file
+	std::vector<size_t> position_offset(num_chunks), uv_offset(num_chunks), normal_offset(num_chunks), color_offset(num_chunks);
+	std::vector<size_t> vertex_offset(num_chunks), out_offset[3], out_start[3]; //out: color, uv, normal
+	for (int k = 0; k < 3; ++k)
+	{
+		out_offset[k].resize(num_chunks);
+		out_start[k].resize(num_chunks);
+	}
+
+	std::vector<glm::vec3> indexed_positions;
+	std::vector<glm::vec4> indexed_colors;
+	std::vector<glm::vec3> indexed_normals;
+	std::vector<glm::vec2> indexed_uvs;
+
+	const float max_float = 10000000;
+	const float min_float = -10000000;
+	aabb_min = glm::vec3(max_float, max_float, max_float);
+	aabb_max = glm::vec3(min_float, min_float, min_float);
+
+	size_t num_vertices = 0;
+	size_t num_out[3] = { 0, 0, 0 };
+	for (int i = 0; i < num_chunks; ++i)
+	{
+		sOBJChunk& chunk = chunks[i];
+		position_offset[i] = indexed_positions.size();
+		uv_offset[i] = indexed_uvs.size();
+		normal_offset[i] = indexed_normals.size();
+		color_offset[i] = indexed_colors.size();
+		vertex_offset[i] = num_vertices;
+
+		//faces only get colors/uvs/normals once some of them have been read
+		size_t num_triangles = chunk.corners.size() / 3;
+		const size_t counts_before[3] = { indexed_colors.size(), indexed_uvs.size(), indexed_normals.size() };
+		for (int k = 0; k < 3; ++k)
 		{
-			glm::vec3 v1, v2, v3;
-			parseFromText(v1, tokens[1].c_str(), '/');
+			out_start[k][i] = counts_before[k] ? 0 : std::min(chunk.first_triangle[k], num_triangles);
+			out_offset[k][i] = num_out[k];
+			num_out[k] += (num_triangles - out_start[k][i]) * 3;
+		}
+		num_vertices += chunk.corners.size();
+
+		indexed_positions.insert(indexed_positions.end(), chunk.positions.begin(), chunk.positions.end());
+		indexed_colors.insert(indexed_colors.end(), chunk.colors.begin(), chunk.colors.end());
+		indexed_uvs.insert(indexed_uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+		indexed_normals.insert(indexed_normals.end(), chunk.normals.begin(), chunk.normals.end());
+
+		aabb_min = glm::min(aabb_min, chunk.aabb_min);
+		aabb_max = glm::max(aabb_max, chunk.aabb_max);
+	}
+
+	vertices.resize(num_vertices);
+	colors.resize(num_out[0]);
+	uvs.resize(num_out[1]);
+	normals.resize(num_out[2]);
 
-			for (unsigned int iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
+	{
+		PROFILE_SCOPE("buildOBJVertices");
+		WorkQueue::parallelFor(num_chunks, [&](int i) {
+			const sOBJChunk& chunk = chunks[i];
+			const size_t offsets[3] = { position_offset[i], uv_offset[i], normal_offset[i] };
+			for (size_t j = 0; j < chunk.corners.size(); ++j)
 			{
-				parseFromText(v2, tokens[iPoly].c_str(), '/');
-				parseFromText(v3, tokens[iPoly + 1].c_str(), '/');
+				sOBJCorner corner = chunk.corners[j];
+				for (int k = 0; k < 3; ++k)
+					if (corner.relative & (1 << k))
+						corner.index[k] += (int)offsets[k];
+
+				size_t triangle = j / 3;
+				vertices[vertex_offset[i] + j] = fetchOBJAttribute(indexed_positions, corner.index[0]);
+				if (triangle >= out_start[0][i])
+					colors[out_offset[0][i] + j - out_start[0][i] * 3] = fetchOBJAttribute(indexed_colors, corner.index[0]);
+				if (triangle >= out_start[1][i])
+					uvs[out_offset[1][i] + j - out_start[1][i] * 3] = fetchOBJAttribute(indexed_uvs, corner.index[1]);
+				if (triangle >= out_start[2][i])
+					normals[out_offset[2][i] + j - out_start[2][i] * 3] = fetchOBJAttribute(indexed_normals, corner.index[2]);
+			}
+		});
+	}
 
-				vertices.push_back(indexed_positions[(unsigned int)(v1.x) - 1]);
-				vertices.push_back(indexed_positions[(unsigned int)(v2.x) - 1]);
-				vertices.push_back(indexed_positions[(unsigned int)(v3.x) - 1]);
+	//replay the submesh and material lines in order, num_vertices is the vertices emitted before each one
+	unsigned int submesh_draw_calls = 0;
 
-				if (!indexed_colors.empty()) {
-					colors.push_back(indexed_colors[(unsigned int)(v1.x) - 1]);
-					colors.push_back(indexed_colors[(unsigned int)(v2.x) - 1]);
-					colors.push_back(indexed_colors[(unsigned int)(v3.x) - 1]);
-				}
+	sSubmeshInfo submesh_info;
+	memset(&submesh_info, 0, sizeof(submesh_info));
+
+	sSubmeshDrawCallInfo submesh_dc_info;
+	memset(&submesh_dc_info, 0, sizeof(submesh_dc_info));
+	submesh_dc_info.start = 0;
+	size_t last_submesh_vertex = 0;
 
-				//triangles.push_back( VECTOR_INDICES_TYPE(vertex_i, vertex_i+1, vertex_i+2) ); //not needed
-				vertex_i += 3;
+	for (int i = 0; i < num_chunks; ++i)
+	{
+		for (const sOBJEvent& event : chunks[i].events)
+		{
+			num_vertices = vertex_offset[i] + event.triangle * 3;
 
-				if (indexed_uvs.size() > 0)
+			if (event.type == sOBJEvent::MTLLIB) //material file
+			{
+				std::string mesh_path = filename;
+				size_t lastPath = mesh_path.find_last_of('/');
+				std::string path = mesh_path.substr(0, lastPath) + '/' + std::string(event.name);
+				if (!parseMTL(path.c_str()))
+					std::cerr << "MTL file not found: " << path.c_str() << std::endl;
+			}
+			else if (event.type == sOBJEvent::OBJECT) // submesh
+			{
+				if (submesh_draw_calls > 0)
 				{
-					uvs.push_back(indexed_uvs[(unsigned int)(v1.y) - 1]);
-					uvs.push_back(indexed_uvs[(unsigned int)(v2.y) - 1]);
-					uvs.push_back(indexed_uvs[(unsigned int)(v3.y) - 1]);
+					// Store last submesh drawcall
+					submesh_dc_info.length = num_vertices - submesh_dc_info.start;
+					last_submesh_vertex = num_vertices;
+					submesh_info.draw_calls[submesh_draw_calls] = submesh_dc_info;
+					submesh_dc_info.start = last_submesh_vertex;
+
+					// Store submesh
+					submesh_info.num_draw_calls = submesh_draw_calls + 1;
+					submeshes.push_back(submesh_info);
+
+					// New submesh
+					memset(&submesh_info, 0, sizeof(submesh_info));
+					copyOBJName(submesh_info.name, event.name);
+					submesh_draw_calls = 0;
 				}
-
-				if (indexed_normals.size() > 0)
+				else
+					copyOBJName(submesh_info.name, event.name);
+			}
+			else if (event.type == sOBJEvent::USEMTL) //surface? it appears one time before the faces
+			{
+				if (last_submesh_vertex != num_vertices)
 				{
-					normals.push_back(indexed_normals[(unsigned int)(v1.z) - 1]);
-					normals.push_back(indexed_normals[(unsigned int)(v2.z) - 1]);
-					normals.push_back(indexed_normals[(unsigned int)(v3.z) - 1]);
+					// Store draw call
+					submesh_dc_info.length = num_vertices - submesh_dc_info.start;
+					last_submesh_vertex = num_vertices;
+					submesh_info.draw_calls[submesh_draw_calls] = submesh_dc_info;
+					submesh_draw_calls++;
+
+					// New draw call
+					memset(&submesh_dc_info, 0, sizeof(submesh_dc_info));
+					copyOBJName(submesh_dc_info.material, event.name);
+					submesh_dc_info.start = last_submesh_vertex;
 				}
+				else
+					copyOBJName(submesh_dc_info.material, event.name);
 			}
 		}
 	}
@@ -1521,14 +2468,21 @@ Mesh* Mesh::getQuad()
 	return quad;
 }
 
-Mesh* Mesh::Get(const char* filename)
+//the binary is only valid if it was written after the last change of the source file
+static bool isBinaryUpToDate(const std::string& binfilename, const std::string& filename)
 {
-	assert(filename);
-	std::map<std::string, Mesh*>::iterator it = sMeshesLoaded.find(filename);
-	if (it != sMeshesLoaded.end())
-		return it->second;
+	std::error_code error;
+	std::filesystem::file_time_type source_time = std::filesystem::last_write_time(filename, error);
+	if (error)
+		return true; //only the binary is available
+	std::filesystem::file_time_type bin_time = std::filesystem::last_write_time(binfilename, error);
+	return !error && bin_time >= source_time;
+}
+
+bool Mesh::load(const std::string& filename)
+{
+	PROFILE_FUNCTION();
 
-	Mesh* m = new Mesh();
 	std::string name = filename;
 
 	//detect format
@@ -1545,7 +2499,7 @@ Mesh* Mesh::Get(const char* filename)
 	else
 	{
 		std::cerr << "Unknown mesh format: " << filename << std::endl;
-		return NULL;
+		return false;
 	}
 
 	//stats
@@ -1557,69 +2511,239 @@ Mesh* Mesh::Get(const char* filename)
 		binfilename = binfilename + ".mbin";
 
 	//try loading the binary version
-	if (use_binary && m->readBin(binfilename.c_str()))
+	if (use_binary && (file_format == FORMAT_MBIN || isBinaryUpToDate(binfilename, filename)) && readBin(binfilename.c_str()))
 	{
-		if (interleave_meshes && m->interleaved.size() == 0)
+		if (interleave_meshes && interleaved.size() == 0 && vertex_format == VERTEX_FORMAT_FLOAT && !mapped_file)
 		{
 			std::cout << "[INTERL] ";
-			m->interleaveBuffers();
+			interleaveBuffers();
 		}
 
-		if (auto_upload_to_vram)
-		{
-			std::cout << "[VRAM] ";
-			m->uploadToVRAM();
-		}
+		if (quantize_meshes && vertex_format == VERTEX_FORMAT_FLOAT && !mapped_file && quantizeBuffers())
+			std::cout << "[QUANT] ";
 
-		std::cout << "[OK BIN]  Faces: " << (m->interleaved.size() ? m->interleaved.size() : m->vertices.size()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-		m->registerMesh(filename);
-		return m;
+		std::cout << "[OK BIN]  Faces: " << getNumTriangles() << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		return true;
 	}
 
 	//load the ascii version
 	bool loaded = false;
 	if (file_format == FORMAT_OBJ)
-		loaded = m->loadOBJ(filename);
+		loaded = loadOBJ(filename.c_str());
 	/*else if (file_format == FORMAT_ASE)
-		loaded = m->loadASE(filename);*/
+		loaded = loadASE(filename.c_str());*/
 	else if (file_format == FORMAT_MESH)
-		loaded = m->loadMESH(filename);
+		loaded = loadMESH(filename.c_str());
 
 	if (!loaded)
 	{
-		delete m;
 		std::cout << "[ERROR]: Mesh not found" << std::endl;
-		return NULL;
+		return false;
 	}
 
+	//share the repeated vertices of the triangle soups
+	if (index_meshes && !indices.size() && createIndices())
+		std::cout << "[INDEXED] ";
+
 	//to optimize, interleave the meshes
 	if (interleave_meshes)
 	{
 		std::cout << "[INTERL] ";
-		m->interleaveBuffers();
+		interleaveBuffers();
+	}
+
+	//and use the compact vertex format
+	if (quantize_meshes && quantizeBuffers())
+		std::cout << "[QUANT] ";
+
+	std::cout << "[OK]  Faces: " << getNumTriangles() << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	if (use_binary)
+	{
+		std::cout << "\t\t Writing .BIN ... ";
+		writeBin(filename.c_str());
+		std::cout << "[OK]" << std::endl;
+	}
+
+	return true;
+}
+
+//reload it in a worker when the file changes, the old geometry is used till the new one is ready
+static void watchMeshFile(Mesh* m, const std::string& name)
+{
+	FileWatcher::watch(name, m, [m, name]() {
+		unsigned int version = FileWatcher::getVersion(name, m);
+		WorkQueue::submit([m, name, version]() {
+			Mesh* fresh = new Mesh();
+			if (!fresh->load(name))
+			{
+				delete fresh;
+				return;
+			}
+			WorkQueue::runOnMainThread([m, name, version, fresh]() {
+				//the mesh was destroyed or a newer save is on its way
+				if (FileWatcher::getVersion(name, m) == version)
+					m->swapGeometry(fresh);
+				delete fresh;
+			});
+		});
+	});
+}
+
+Mesh* Mesh::Get(const char* filename)
+{
+	assert(filename);
+	Mesh* m = NULL;
+	{
+		std::lock_guard<std::mutex> lock(s_meshes_mutex);
+		std::map<std::string, Mesh*>::iterator it = sMeshesLoaded.find(filename);
+		if (it != sMeshesLoaded.end())
+			m = it->second;
+	}
+
+	//requested before with GetAsync, wait for it (only the main thread can, it does the upload)
+	if (m)
+	{
+		if (m->loading)
+		{
+			if (!WorkQueue::isMainThread())
+				return NULL;
+			WorkQueue::waitFor([m]() { return !m->loading; });
+		}
+		return m->load_failed ? NULL : m;
+	}
+
+	m = new Mesh();
+	if (!m->load(filename))
+	{
+		delete m;
+		return NULL;
 	}
 
 	//and upload them to VRAM
 	if (auto_upload_to_vram)
-	{
-		std::cout << "[VRAM] ";
 		m->uploadToVRAM();
+
+	m->registerMesh(filename);
+	watchMeshFile(m, filename);
+
+	return m;
+}
+
+Mesh* Mesh::GetAsync(const char* filename, LoadCallback callback)
+{
+	assert(filename);
+	std::string name = filename;
+	Mesh* m = NULL;
+	bool start_load = false;
+	bool loaded = false;
+	{
+		//the same file requested twice shares the mesh and the load
+		std::lock_guard<std::mutex> lock(s_meshes_mutex);
+		std::map<std::string, Mesh*>::iterator it = sMeshesLoaded.find(name);
+		if (it != sMeshesLoaded.end())
+		{
+			m = it->second;
+			if (m->load_failed && !m->loading) //try again, the file may exist now
+			{
+				m->load_failed = false;
+				m->loading = true;
+				start_load = true;
+			}
+			if (m->loading && callback)
+				m->load_callbacks.push_back(callback);
+			loaded = !m->loading;
+		}
+		else
+		{
+			m = new Mesh(); //no GL calls until it is uploaded
+			m->name = name;
+			m->loading = true;
+			if (callback)
+				m->load_callbacks.push_back(callback);
+			sMeshesLoaded[name] = m;
+			start_load = true;
+		}
 	}
 
-	std::cout << "[OK]  Faces: " << m->vertices.size() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-	if (use_binary)
+	if (loaded)
 	{
-		std::cout << "\t\t Writing .BIN ... ";
-		m->writeBin(filename);
-		std::cout << "[OK]" << std::endl;
+		if (callback)
+			WorkQueue::runOnMainThread([m, callback]() { callback(m); });
+		return m;
 	}
+	if (!start_load)
+		return m; //already in flight
+
+	//parse and index it in a worker, upload it in the main thread
+	WorkQueue::submit([m, name]() {
+		Mesh* fresh = new Mesh();
+		if (!fresh->load(name))
+		{
+			delete fresh;
+			fresh = NULL;
+		}
+		WorkQueue::runOnMainThread([m, fresh, name]() {
+			if (fresh)
+			{
+				m->swapGeometry(fresh);
+				delete fresh;
+				watchMeshFile(m, name);
+			}
+
+			std::vector<LoadCallback> callbacks;
+			{
+				std::lock_guard<std::mutex> lock(s_meshes_mutex);
+				m->load_failed = !fresh;
+				m->loading = false;
+				callbacks.swap(m->load_callbacks);
+			}
+			for (LoadCallback& callback : callbacks)
+				callback(fresh ? m : NULL);
+		});
+	});
 
-	m->registerMesh(name);
 	return m;
 }
 
+void Mesh::swapGeometry(Mesh* other)
+{
+	clear();
+
+	submeshes.swap(other->submeshes);
+	materials.swap(other->materials);
+	vertices.swap(other->vertices);
+	normals.swap(other->normals);
+	uvs.swap(other->uvs);
+	uvs1.swap(other->uvs1);
+	colors.swap(other->colors);
+	interleaved.swap(other->interleaved);
+	indices.swap(other->indices);
+	bones.swap(other->bones);
+	weights.swap(other->weights);
+	bones_info.swap(other->bones_info);
+	quantized.swap(other->quantized);
+	colors8.swap(other->colors8);
+	weights8.swap(other->weights8);
+	vertex_format = other->vertex_format;
+	position_offset = other->position_offset;
+	position_scale = other->position_scale;
+	std::swap(mapped_file, other->mapped_file);
+	memcpy(mapped_streams, other->mapped_streams, sizeof(mapped_streams));
+	vbo_num_vertices = other->vbo_num_vertices;
+	vbo_num_triangles = other->vbo_num_triangles;
+	bind_matrix = other->bind_matrix;
+	aabb_min = other->aabb_min;
+	aabb_max = other->aabb_max;
+	box = other->box;
+	radius = other->radius;
+
+	if (auto_upload_to_vram)
+		uploadToVRAM();
+}
+
 void Mesh::registerMesh(std::string name)
 {
 	this->name = name;
+	std::lock_guard<std::mutex> lock(s_meshes_mutex);
 	sMeshesLoaded[name] = this;
 }
\ No newline at end of file
@@ -3,34 +3,63 @@
 #include <vector>
 #include <map>
 #include <string>
+#include <cstdint>
+#include <functional>
+#include <atomic>
 
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 #include <glm/matrix.hpp>
 #include <glm/gtx/transform.hpp>
+#include <glm/gtc/type_precision.hpp>
 
 class Shader; //for binding
 class Image; //for displace
 class Skeleton; //for skinned meshes
+class MappedFile; //for binary meshes
 
 //version from 21/01/2024
-#define MESH_BIN_VERSION 12 //this is used to regenerate bins if the format changes
+#define MESH_BIN_VERSION 15 //this is used to regenerate bins if the format changes
 
 #define MAX_SUBMESH_DRAW_CALLS 16
 
+//streams stored in a MBIN file
+enum eMeshStream {
+	MESH_STREAM_VERTICES,
+	MESH_STREAM_NORMALS,
+	MESH_STREAM_UVS,
+	MESH_STREAM_COLORS,
+	MESH_STREAM_INDICES,
+	MESH_STREAM_BONES,
+	MESH_STREAM_WEIGHTS,
+	MESH_STREAM_UVS1,
+	MESH_STREAM_INTERLEAVED,
+	MESH_STREAM_BONES_INFO,
+	MESH_STREAM_SUBMESHES,
+	MESH_STREAM_QUANTIZED,
+	MESH_STREAM_COLORS8,
+	MESH_STREAM_WEIGHTS8,
+	MESH_NUM_STREAMS
+};
+
 class BoundingBox
 {
 public:
 	glm::vec3 center;
 	glm::vec3 halfsize;
-	BoundingBox() {};
+	BoundingBox() : center(0.0f), halfsize(0.0f) {};
 	BoundingBox(glm::vec3 center, glm::vec3 halfsize) { this->center = center; this->halfsize = halfsize; };
 };
 
 //applies a transform to a AABB so it is 
 BoundingBox transformBoundingBox(const glm::mat4 m, const BoundingBox& box);
 
+enum eVertexFormat {
+	VERTEX_FORMAT_FLOAT,		//full floats
+	VERTEX_FORMAT_QUANTIZED		//16 bits positions inside the bounding box, octahedral normals, half float uvs, 8 bits colors and weights
+};
+
 struct BoneInfo
 {
 	char name[32]; //max 32 chars per bone name
@@ -41,7 +70,7 @@ struct sSubmeshDrawCallInfo
 {
 
 	char material[32];
-	size_t start;//in primitive
+	size_t start;//in primitive (triangles if the mesh is indexed, vertices if not)
 	size_t length;//in primitive
 };
 
@@ -62,15 +91,26 @@ struct sMaterialInfo
 class Mesh
 {
 public:
-	static std::map<std::string, Mesh*> sMeshesLoaded;
+	typedef std::function<void(Mesh*)> LoadCallback; //receives NULL if the load failed
+
+	static std::map<std::string, Mesh*> sMeshesLoaded; //guarded by a mutex in Get, GetAsync and registerMesh
 	static bool use_binary; //always load the binary version of a mesh when possible
 	static bool interleave_meshes; //loaded meshes will me automatically interleaved
 	static bool auto_upload_to_vram; //loaded meshes will be stored in the VRAM
+	static bool index_meshes; //loaded triangle soups will be converted to indexed meshes
+	static bool keep_in_ram; //binary meshes copy their streams to RAM, otherwise they go from the file to the VRAM
+	static bool quantize_meshes; //loaded meshes will use the compact vertex format
 	static long num_meshes_rendered;
 	static long num_triangles_rendered;
 
 	std::string name;
 
+	//meshes from GetAsync are empty (and not rendered) until their geometry is uploaded
+	//the manager keeps owning them if the load fails, they are not rendered and GetAsync tries again with the same mesh
+	std::atomic<bool> loading;
+	bool load_failed = false; //set before loading is cleared
+	std::vector<LoadCallback> load_callbacks; //called in the main thread when it finishes
+
 	std::vector<sSubmeshInfo> submeshes; //contains info about every submesh
 	std::map<std::string, sMaterialInfo> materials; //contains info about every material
 
@@ -88,7 +128,21 @@ public:
 
 	std::vector< tInterleaved > interleaved; //to render interleaved
 
-	std::vector< glm::vec3 > indices; //for indexed meshes
+	//compact interleaved vertex, 16 bytes (see quantizeBuffers)
+	struct tQuantized {
+		uint16_t position[4]; //unorm, from position_offset to position_offset + position_scale, w unused
+		int16_t normal[2]; //snorm, octahedral encoding
+		uint16_t uv[2]; //half floats
+	};
+
+	eVertexFormat vertex_format;
+	std::vector< tQuantized > quantized; //replaces the interleaved or separated streams
+	std::vector< glm::u8vec4 > colors8; //replaces colors
+	std::vector< glm::u8vec4 > weights8; //replaces weights
+	glm::vec3 position_offset; //to decode the positions in the shader (u_position_offset)
+	glm::vec3 position_scale; //(u_position_scale)
+
+	std::vector< glm::uvec3 > indices; //for indexed meshes, one per triangle
 
 	//for animated meshes
 	std::vector< glm::vec4 > bones; //tells which bones afect the vertex (4 max)
@@ -108,18 +162,34 @@ public:
 	unsigned int colors_vbo_id;
 
 	unsigned int indices_vbo_id;
+	unsigned int index_type; //of the uploaded indices, GL_UNSIGNED_SHORT when the vertices fit
 	unsigned int interleaved_vbo_id;
 	unsigned int bones_vbo_id;
 	unsigned int weights_vbo_id;
 	unsigned int uvs1_vbo_id;
 
+	//sizes of the buffers in VRAM (or of the mapped streams waiting to be uploaded), used when the streams in RAM are empty
+	size_t vbo_num_vertices;
+	size_t vbo_num_triangles;
+
+	//binary file whose streams were not copied to RAM, it is kept mapped until they are uploaded
+	MappedFile* mapped_file;
+	const char* mapped_streams[MESH_NUM_STREAMS]; //inside the mapped file, NULL if not stored
+
+	//one vertex array object per shader that rendered this mesh, rebuilt when the program changes
+	struct sVertexArrayInfo {
+		unsigned int vao_id = 0;
+		unsigned int program_version = 0;
+	};
+	std::map<Shader*, sVertexArrayInfo> vertex_arrays;
+
 	Mesh();
 	~Mesh();
 
 	void clear();
 
 	void render(unsigned int primitive, int submesh_id = -1, int num_instances = 0);
-	void renderInstanced(unsigned int primitive, const glm::mat4* instanced_models, int number);
+	void renderInstanced(unsigned int primitive, const glm::mat4* instanced_models, int number, const glm::vec4* instanced_colors = NULL); //colors go to a_instance_color
 	void renderInstanced(unsigned int primitive, const std::vector<glm::vec3> positions, const char* uniform_name);
 	void renderBounding(const glm::mat4& model, bool world_bounding = true);
 	void renderFixedPipeline(int primitive); //sloooooooow
@@ -129,11 +199,16 @@ public:
 	void drawCall(unsigned int primitive, int submesh_id, int draw_call_id, int num_instances);
 	void disableBuffers(Shader* shader);
 
+	bool bindVertexArray(Shader* shader); //returns false if the mesh is not in VRAM
+	void releaseVertexArrays();
+
 	bool readBin(const char* filename);
 	bool writeBin(const char* filename);
 
 	unsigned int getNumSubmeshes() { return (unsigned int)submeshes.size(); }
-	unsigned int getNumVertices() { return (unsigned int)interleaved.size() ? (unsigned int)interleaved.size() : (unsigned int)vertices.size(); }
+	unsigned int getNumVertices() { return (unsigned int)(interleaved.size() ? interleaved.size() : quantized.size() ? quantized.size() : vertices.size() ? vertices.size() : vbo_num_vertices); }
+	size_t getNumTriangles() { return indices.size() ? indices.size() : vbo_num_triangles ? vbo_num_triangles : getNumVertices() / 3; }
+	bool isIndexed() { return indices.size() || vbo_num_triangles; }
 
 	//collision testing
 	void* collision_model;
@@ -143,8 +218,11 @@ public:
 	//bool testSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3& collision, Vector3& normal);
 
 	//loader
-	static Mesh* Get(const char* filename);
+	static Mesh* Get(const char* filename); //NULL if it failed, or from a worker if GetAsync is still loading it
+	static Mesh* GetAsync(const char* filename, LoadCallback callback = NULL); //returns at once, loads in a worker and uploads in the main thread
+	bool load(const std::string& filename); //only RAM, no GL calls so it can be called from a worker
 	void registerMesh(std::string name);
+	void swapGeometry(Mesh* other); //takes the geometry of other and uploads it, used when reloading
 
 	//create help meshes
 	void createQuad(float center_x, float center_y, float w, float h, bool flip_uvs);
@@ -161,6 +239,8 @@ public:
 	//optimize meshes
 	void uploadToVRAM();
 	bool interleaveBuffers();
+	bool createIndices(); //merges the repeated vertices and sorts the triangles for the vertex cache and overdraw
+	bool quantizeBuffers(); //converts the streams to VERTEX_FORMAT_QUANTIZED, halves the size of the vertices
 
 private:
 	//bool loadASE(const char* filename);
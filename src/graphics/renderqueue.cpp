@@ -0,0 +1,178 @@
+#include "renderqueue.h"
+
+#include <algorithm>
+
+#include "../framework/scenenode.h"
+#include "../framework/gpuprofiler.h"
+#include "../framework/profiler.h"
+#include "material.h"
+
+//bits of every field of the sort key, from the most significant
+#define SORT_PASS_BITS 4
+#define SORT_ID_BITS 12 //shader, texture and mesh
+#define SORT_DEPTH_BITS 24
+
+bool RenderQueue::use_instancing = true;
+bool RenderQueue::use_sorting = true;
+int RenderQueue::min_instances = 2;
+
+bool RenderQueue::sBatchKey::operator<(const sBatchKey& other) const
+{
+	if (mesh != other.mesh) return mesh < other.mesh;
+	if (shader != other.shader) return shader < other.shader;
+	if (texture != other.texture) return texture < other.texture;
+	return material_type->before(*other.material_type);
+}
+
+//opaque: pass | shader | texture | mesh | depth, the state changes are the expensive part
+//volume: pass | inverted depth | shader | texture | mesh, they blend so the order must be back to front
+uint64_t RenderQueue::packSortKey(eRenderPass pass, uint32_t shader, uint32_t texture, uint32_t mesh, float depth)
+{
+	const uint64_t id_mask = (1 << SORT_ID_BITS) - 1;
+	const uint64_t depth_max = (1 << SORT_DEPTH_BITS) - 1;
+	uint64_t quantized_depth = (uint64_t)(std::clamp(depth, 0.0f, 1.0f) * depth_max);
+	uint64_t state = ((shader & id_mask) << (SORT_ID_BITS * 2)) | ((texture & id_mask) << SORT_ID_BITS) | (mesh & id_mask);
+	uint64_t key = (uint64_t)pass << (64 - SORT_PASS_BITS);
+	if (pass == RENDER_PASS_VOLUME)
+		return key | ((depth_max - quantized_depth) << (SORT_ID_BITS * 3)) | state;
+	return key | (state << SORT_DEPTH_BITS) | quantized_depth;
+}
+
+//LSD radix sort of 8 bits per pass, stable so equal keys keep the order they were added in
+static void radixSort(std::vector<RenderQueue::sSortItem>& items, std::vector<RenderQueue::sSortItem>& temp)
+{
+	if (items.size() < 2)
+		return;
+	temp.resize(items.size());
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		size_t offsets[256] = {};
+		for (const RenderQueue::sSortItem& item : items)
+			offsets[(item.key >> shift) & 0xFF]++;
+		if (offsets[(items[0].key >> shift) & 0xFF] == items.size())
+			continue; //all the keys have the same byte here
+
+		size_t sum = 0;
+		for (int i = 0; i < 256; ++i)
+		{
+			size_t count = offsets[i];
+			offsets[i] = sum;
+			sum += count;
+		}
+		for (const RenderQueue::sSortItem& item : items)
+			temp[offsets[(item.key >> shift) & 0xFF]++] = item;
+		items.swap(temp);
+	}
+}
+
+uint32_t RenderQueue::getId(const void* ptr)
+{
+	if (!ptr)
+		return 0;
+	auto it = ids.find(ptr);
+	if (it != ids.end())
+		return it->second;
+	uint32_t id = (uint32_t)ids.size() + 1;
+	ids[ptr] = id;
+	return id;
+}
+
+void RenderQueue::clear()
+{
+	batches.clear();
+	batch_index.clear();
+	ids.clear();
+}
+
+void RenderQueue::add(SceneNode* node)
+{
+	if (!node->visible)
+		return;
+	Material* material = node->material;
+
+	//volumes override render, only the nodes drawn with SceneNode::render can be merged
+	bool instanceable = use_instancing && node->mesh && material && node->type != NODE_VOLUME && material->supportsInstancing();
+	if (instanceable)
+	{
+		sBatchKey key = { node->mesh, material->shader, material->texture, &typeid(*material) };
+		auto it = batch_index.find(key);
+		if (it != batch_index.end())
+		{
+			batches[it->second].nodes.push_back(node);
+			return;
+		}
+		batch_index[key] = (int)batches.size();
+	}
+
+	sBatch batch;
+	batch.nodes.push_back(node);
+	batch.instanced = instanceable;
+	batch.pass = node->type == NODE_VOLUME ? RENDER_PASS_VOLUME : RENDER_PASS_OPAQUE;
+	batch.shader_id = getId(material ? material->shader : NULL);
+	batch.texture_id = getId(material ? material->texture : NULL);
+	batch.mesh_id = getId(node->mesh);
+	batches.push_back(batch);
+}
+
+void RenderQueue::render(Camera* camera)
+{
+	PROFILE_FUNCTION();
+
+	num_draws = 0;
+	num_instanced_nodes = 0;
+
+	//the depth of a group is the one of its closest node
+	sorted.resize(batches.size());
+	for (size_t i = 0; i < batches.size(); ++i)
+	{
+		sBatch& batch = batches[i];
+		float min_distance = camera->far_plane;
+		for (SceneNode* node : batch.nodes)
+			min_distance = std::min(min_distance, glm::distance(camera->eye, glm::vec3(node->getModel()[3])));
+		sorted[i].key = use_sorting ? packSortKey(batch.pass, batch.shader_id, batch.texture_id, batch.mesh_id, min_distance / camera->far_plane) : 0;
+		sorted[i].index = (int)i;
+	}
+	radixSort(sorted, sort_temp);
+
+	std::vector<glm::mat4> models;
+	std::vector<glm::vec4> colors;
+
+	for (const sSortItem& item : sorted)
+	{
+		sBatch& batch = batches[item.index];
+		if (!batch.instanced || (int)batch.nodes.size() < min_instances)
+		{
+			for (SceneNode* node : batch.nodes)
+			{
+				GPU_PROFILE_SCOPE(node->name);
+				node->render(camera);
+				num_draws++;
+			}
+			continue;
+		}
+
+		//the first node material draws the whole group, every node keeps its model and color
+		SceneNode* first = batch.nodes[0];
+		GPU_PROFILE_SCOPE(first->name + " x" + std::to_string(batch.nodes.size()));
+
+		models.clear();
+		colors.clear();
+		for (SceneNode* node : batch.nodes)
+		{
+			models.push_back(node->getModel());
+			colors.push_back(node->material->color);
+		}
+		first->material->renderInstanced(first->mesh, models, colors, camera);
+
+		num_draws++;
+		num_instanced_nodes += (int)batch.nodes.size();
+	}
+}
+
+void RenderQueue::renderInMenu()
+{
+	ImGui::Checkbox("Instancing", &use_instancing);
+	ImGui::Checkbox("Sort draws", &use_sorting);
+	ImGui::SliderInt("Min instances", &min_instances, 1, 64);
+	ImGui::Text("%d draws, %d nodes instanced", num_draws, num_instanced_nodes);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <typeinfo>
+#include <cstdint>
+
+#include <glm/matrix.hpp>
+
+class SceneNode;
+class Camera;
+class Mesh;
+class Shader;
+class Texture;
+
+enum eRenderPass { RENDER_PASS_OPAQUE, RENDER_PASS_VOLUME }; //volumes go after the opaques, back to front
+
+//collects the nodes of a frame and draws the ones that share mesh, shader and material parameters
+//with a single instanced draw call. The draws are sorted by a 64 bit key so the ones that share
+//shader, texture and mesh go together (see packSortKey), and within them front to back
+class RenderQueue
+{
+public:
+	static bool use_instancing;
+	static bool use_sorting;
+	static int min_instances; //smaller groups are not worth the instance upload
+
+	struct sBatchKey
+	{
+		Mesh* mesh;
+		Shader* shader;
+		Texture* texture;
+		const std::type_info* material_type;
+
+		bool operator<(const sBatchKey& other) const;
+	};
+
+	struct sBatch
+	{
+		std::vector<SceneNode*> nodes;
+		bool instanced;
+		eRenderPass pass;
+		uint32_t shader_id; //dense ids of this frame, they fit in the sort key
+		uint32_t texture_id;
+		uint32_t mesh_id;
+	};
+
+	struct sSortItem
+	{
+		uint64_t key;
+		int index;
+	};
+
+	std::vector<sBatch> batches;
+	std::map<sBatchKey, int> batch_index; //only for the groups that can be instanced
+	std::unordered_map<const void*, uint32_t> ids;
+	std::vector<sSortItem> sorted;
+	std::vector<sSortItem> sort_temp;
+
+	//stats of the last render
+	int num_draws = 0;
+	int num_instanced_nodes = 0;
+
+	void clear();
+	void add(SceneNode* node);
+	void render(Camera* camera);
+	void renderInMenu();
+
+	static uint64_t packSortKey(eRenderPass pass, uint32_t shader, uint32_t texture, uint32_t mesh, float depth);
+
+private:
+	uint32_t getId(const void* ptr);
+};
@@ -3,16 +3,45 @@
 #include <cassert>
 #include <iostream>
 #include "../framework/utils.h"
+#include "../framework/filewatcher.h"
+#include "../framework/profiler.h"
 #include <algorithm> 
 #include <functional> 
 #include <cctype>
 #include <locale>
+#include <filesystem>
 
 #include "texture.h"
+#include "glstate.h"
 
 std::string Shader::s_shader_atlas_filename;
 std::map<std::string, std::string> Shader::s_shaders_atlas;
 
+bool Shader::use_binary_cache = true;
+std::string Shader::s_binary_cache_path = "cache/shaders/";
+
+#define SHADER_BIN_VERSION 1 //change it to discard all the cached programs
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+typedef void (APIENTRY* MAXSHADERCOMPILERTHREADSPROC)(GLuint count);
+
+bool Shader::use_async_compile = true;
+bool Shader::s_parallel_compile = false;
+std::vector<Shader*> Shader::s_pending;
+Shader* Shader::s_fallback = NULL;
+
+struct sProgramBinaryHeader
+{
+	char magic[4]; //"SBIN"
+	uint32_t version;
+	uint64_t key;
+	uint32_t format;
+	uint32_t length;
+};
+
 
 //typedef unsigned int GLhandle;
 
@@ -56,6 +85,7 @@ REGISTER_GLEXT(void, glUniformMatrix4fv, GLint location, GLsizei count, GLboolea
 
 std::map<std::string, Shader*> Shader::s_Shaders;
 bool Shader::s_ready = false;
+unsigned int Shader::s_program_counter = 0;
 Shader* Shader::current = NULL;
 
 Shader::Shader()
@@ -64,10 +94,20 @@ Shader::Shader()
 		Shader::init();
 	compiled = false;
 	from_atlas = false;
+	vs = fs = program = 0;
+	pending_vs = pending_fs = pending_program = 0;
+	pending = false;
+	link_failed = false;
+	pending_binary_cache = false;
+	pending_cache_key = 0;
+	program_version = 0;
 }
 
 Shader::~Shader()
 {
+	s_pending.erase(std::remove(s_pending.begin(), s_pending.end(), this), s_pending.end());
+	FileWatcher::unwatch(this);
+	cancelCompilation();
 	release();
 }
 
@@ -77,10 +117,23 @@ void Shader::setFilenames(const std::string& vsf, const std::string& psf)
 	ps_filename = psf;
 }
 
+//the macros go after the #version line, it must be the first thing in the source
+static std::string insertMacros(const std::string& code, const std::string& macros)
+{
+	size_t pos = 0;
+	if (code.compare(0, 8, "#version") == 0)
+	{
+		pos = code.find('\n');
+		pos = pos == std::string::npos ? code.size() : pos + 1;
+	}
+	return code.substr(0, pos) + macros + "\n" + code.substr(pos);
+}
+
 bool Shader::load(const std::string& vsf, const std::string& psf, const char* macros)
 {
-	assert(compiled == false);
-	assert(glGetError() == GL_NO_ERROR);
+	PROFILE_FUNCTION();
+
+	assert(checkGLErrors());
 
 	vs_filename = vsf;
 	ps_filename = psf;
@@ -93,19 +146,33 @@ bool Shader::load(const std::string& vsf, const std::string& psf, const char* ma
 	if (!readFile(vsf, vsm) || !readFile(psf, psm))
 		return false;
 
+	//only the shaders that use the modified file are recompiled
+	FileWatcher::watch(vsf, this, [this]() { recompile(); });
+	FileWatcher::watch(psf, this, [this]() { recompile(); });
+
 	//printf("Vertex shader from memory:\n%s\n", vsm.c_str());
 	//printf("Fragment shader from memory:\n%s\n", psm.c_str());
 	if (macros)
 	{
-		vsm = macros + vsm;
-		psm = macros + psm;
+		vsm = insertMacros(vsm, macros);
+		psm = insertMacros(psm, macros);
 		this->macros = macros;
 	}
 
+	if (use_async_compile)
+	{
+		//the driver links it while we keep going, UpdatePending installs it once it is ready
+		if (!submitCompilation(vsm, psm))
+			return false;
+		if (pending && std::find(s_pending.begin(), s_pending.end(), this) == s_pending.end())
+			s_pending.push_back(this);
+		return true;
+	}
+
 	if (!compileFromMemory(vsm, psm))
 		return false;
 
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 
 	return true;
 }
@@ -120,7 +187,7 @@ Shader* Shader::Get(const char* vsf, const char* psf, const char* macros)
 		name = vsf;
 	std::map<std::string, Shader*>::iterator it = s_Shaders.find(name);
 	if (it != s_Shaders.end())
-		return it->second;
+		return it->second->link_failed && !it->second->compiled ? NULL : it->second; //it stays registered so a fixed source relinks it
 
 	if (!psf)
 		return NULL;
@@ -132,6 +199,14 @@ Shader* Shader::Get(const char* vsf, const char* psf, const char* macros)
 	return sh;
 }
 
+Shader* Shader::getVariant(const char* extra_macros)
+{
+	if (from_atlas || !vs_filename.size() || !ps_filename.size())
+		return NULL;
+	std::string variant_macros = macros + extra_macros;
+	return Get(vs_filename.c_str(), ps_filename.c_str(), variant_macros.c_str());
+}
+
 void Shader::ReloadAll()
 {
 	for (std::map<std::string, Shader*>::iterator it = s_Shaders.begin(); it != s_Shaders.end(); it++)
@@ -239,8 +314,8 @@ bool Shader::LoadAtlas(const char* filename)
 			continue;
 		}
 
-		vs_code = macros + "\n" + vs_code;
-		fs_code = macros + "\n" + fs_code;
+		vs_code = insertMacros(vs_code, macros);
+		fs_code = insertMacros(fs_code, macros);
 
 		Shader* shader = NULL;
 		auto it = s_Shaders.find(name);
@@ -279,7 +354,7 @@ bool Shader::recompile()
 {
 	if (from_atlas || !vs_filename.size() || !ps_filename.size()) //shaders compiled from memory cannot be recompiled
 		return false;
-	release(); //remove old shader
+	//the old program is kept until the new one is linked
 	return load(vs_filename, ps_filename, macros.size() ? macros.c_str() : NULL);
 }
 
@@ -295,61 +370,287 @@ bool Shader::hasInfoLog() const
 
 // ******************************************
 
-bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
+//FNV-1a, enough to tell apart different sources
+static uint64_t hashString(const std::string& str, uint64_t hash = 14695981039346656037ULL)
 {
-	if (glCreateProgram == 0)
+	for (size_t i = 0; i < str.size(); ++i)
 	{
-		std::cout << "Error: your graphics cards dont support shaders. Sorry." << std::endl;
-		exit(0);
+		hash ^= (uint8_t)str[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static uint64_t getProgramKey(const std::string& vsm, const std::string& psm)
+{
+	//a driver update invalidates the binaries, so the driver is part of the key
+	static std::string driver;
+	if (driver.empty())
+	{
+		const char* vendor = (const char*)glGetString(GL_VENDOR);
+		const char* renderer = (const char*)glGetString(GL_RENDERER);
+		const char* version = (const char*)glGetString(GL_VERSION);
+		driver = std::string(vendor ? vendor : "") + "|" + (renderer ? renderer : "") + "|" + (version ? version : "");
 	}
 
-	program = glCreateProgram();
-	assert(glGetError() == GL_NO_ERROR);
+	//macros are already prepended to the sources
+	uint64_t hash = hashString(vsm);
+	hash = hashString(std::string(1, '\0') + psm, hash);
+	hash = hashString(std::string(1, '\0') + driver, hash);
+	return hash;
+}
 
-	if (!createVertexShaderObject(vsm))
+static bool isProgramBinarySupported()
+{
+	static int supported = -1;
+	if (supported == -1)
 	{
-		printf("Vertex shader compilation failed\n");
-		return false;
+		GLint num_formats = 0;
+		if (glGetProgramBinary != 0 && glProgramBinary != 0)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+		supported = num_formats > 0 ? 1 : 0;
 	}
+	return supported == 1;
+}
+
+std::string Shader::getBinaryCacheFilename(uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.sbin", (unsigned long long)key);
+	return s_binary_cache_path + name;
+}
 
-	if (!createFragmentShaderObject(psm))
+GLuint Shader::loadProgramBinary(uint64_t key)
+{
+	std::string filename = getBinaryCacheFilename(key);
+	if (!std::filesystem::exists(filename))
+		return 0;
+
+	std::string content;
+	if (!readFile(filename, content) || content.size() < sizeof(sProgramBinaryHeader))
+		return 0;
+
+	sProgramBinaryHeader header;
+	memcpy(&header, &content[0], sizeof(header));
+	if (memcmp(header.magic, "SBIN", 4) != 0 || header.version != SHADER_BIN_VERSION ||
+		header.key != key || content.size() != sizeof(header) + header.length)
 	{
-		printf("Fragment shader compilation failed\n");
-		return false;
+		std::remove(filename.c_str());
+		return 0;
 	}
 
-	glLinkProgram(program);
-	assert(glGetError() == GL_NO_ERROR);
+	GLuint obj = glCreateProgram();
+	glProgramBinary(obj, header.format, &content[sizeof(header)], header.length);
 
+	//the driver rejects binaries from other versions or hardware, in that case we compile from source
 	GLint linked = 0;
+	glGetProgramiv(obj, GL_LINK_STATUS, &linked);
+	if (!linked)
+	{
+		glGetError(); //a rejected binary raises GL_INVALID_ENUM, clear it so the compile below does not report it
+		glDeleteProgram(obj);
+		std::remove(filename.c_str());
+		return 0;
+	}
 
-	glGetProgramiv(program, GL_LINK_STATUS, &linked);
-	assert(glGetError() == GL_NO_ERROR);
+	return obj;
+}
 
-	if (!linked)
+bool Shader::saveProgramBinary(GLuint obj, uint64_t key)
+{
+	GLint length = 0;
+	glGetProgramiv(obj, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return false;
+
+	std::vector<char> data(length);
+	GLenum format = 0;
+	GLsizei written = 0;
+	glGetProgramBinary(obj, length, &written, &format, &data[0]);
+	if (written <= 0)
+		return false;
+
+	std::error_code error;
+	std::filesystem::create_directories(s_binary_cache_path, error);
+
+	std::string filename = getBinaryCacheFilename(key);
+	FILE* f = fopen(filename.c_str(), "wb");
+	if (f == NULL)
 	{
-		saveProgramInfoLog(program);
-		release();
+		std::cout << "[WARN] cannot write shader binary: " << filename << std::endl;
 		return false;
 	}
 
+	sProgramBinaryHeader header;
+	memcpy(header.magic, "SBIN", 4);
+	header.version = SHADER_BIN_VERSION;
+	header.key = key;
+	header.format = format;
+	header.length = written;
+
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(&data[0], written, 1, f);
+	fclose(f);
+	return true;
+}
+
+bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
+{
+	if (!submitCompilation(vsm, psm))
+		return false;
+	return finishCompilation();
+}
+
+bool Shader::submitCompilation(const std::string& vsm, const std::string& psm)
+{
+	PROFILE_FUNCTION();
+
+	if (glCreateProgram == 0)
+	{
+		std::cout << "Error: your graphics cards dont support shaders. Sorry." << std::endl;
+		exit(0);
+	}
+
+	cancelCompilation(); //newer sources replace the ones being linked
+
+	//try the binary cache first, it skips the GLSL compilation completely
+	pending_binary_cache = use_binary_cache && isProgramBinarySupported();
+	if (pending_binary_cache)
+	{
+		pending_cache_key = getProgramKey(vsm, psm);
+		GLuint obj = loadProgramBinary(pending_cache_key);
+		if (obj)
+		{
+			setProgram(0, 0, obj);
+			return true;
+		}
+	}
+
+	pending_program = glCreateProgram();
+	assert(checkGLErrors());
+
+	if (pending_binary_cache)
+		glProgramParameteri(pending_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+	//no status is queried here, that would wait for the driver to finish
+	createVertexShaderObject(vsm);
+	createFragmentShaderObject(psm);
+
+	glLinkProgram(pending_program);
+	assert(checkGLErrors());
+
+	pending = true;
+	return true;
+}
+
+bool Shader::isLinkDone()
+{
+	if (!pending)
+		return true;
+	if (!s_parallel_compile)
+		return false; //no way to know without blocking
+
+	GLint done = 0;
+	glGetProgramiv(pending_program, GL_COMPLETION_STATUS_KHR, &done);
+	return done != 0;
+}
+
+bool Shader::finishCompilation()
+{
+	PROFILE_FUNCTION();
+
+	if (!pending)
+		return compiled;
+	pending = false;
+
+	if (!checkShaderObject(pending_vs))
+		printf("Vertex shader compilation failed\n");
+	else if (!checkShaderObject(pending_fs))
+		printf("Fragment shader compilation failed\n");
+	else
+	{
+		GLint linked = 0;
+		glGetProgramiv(pending_program, GL_LINK_STATUS, &linked);
+		assert(checkGLErrors());
+
+		if (linked)
+		{
+			if (pending_binary_cache)
+				saveProgramBinary(pending_program, pending_cache_key);
+
+			setProgram(pending_vs, pending_fs, pending_program);
+			pending_vs = pending_fs = pending_program = 0;
 #ifdef _DEBUG
-	validate();
+			validate();
 #endif
+			return true;
+		}
+		saveProgramInfoLog(pending_program);
+	}
+
+	//the previous program (if any) is still valid, keep using it
+	std::cout << "[ERROR] Shader not linked: " << vs_filename << ", " << ps_filename << std::endl;
+	link_failed = true;
+	cancelCompilation();
+	return false;
+}
 
+void Shader::cancelCompilation()
+{
+	if (pending_vs)
+		glDeleteShader(pending_vs);
+	if (pending_fs)
+		glDeleteShader(pending_fs);
+	if (pending_program)
+		glDeleteProgram(pending_program);
+	pending_vs = pending_fs = pending_program = 0;
+	pending = false;
+}
+
+void Shader::setProgram(GLuint new_vs, GLuint new_fs, GLuint new_program)
+{
+	release();
+
+	vs = new_vs;
+	fs = new_fs;
+	program = new_program;
 	compiled = true;
+	link_failed = false;
+	program_version = ++s_program_counter;
 
-	return true;
+	if (current == this)
+		GLState::useProgram(program);
+}
+
+void Shader::UpdatePending()
+{
+	//without the extension we cannot poll, so one shader per frame is finished (it blocks)
+	bool blocked = false;
+	for (size_t i = 0; i < s_pending.size();)
+	{
+		Shader* sh = s_pending[i];
+		bool done = sh->isLinkDone();
+		if (!done && !s_parallel_compile && !blocked)
+			done = blocked = true;
+
+		if (!done)
+		{
+			++i;
+			continue;
+		}
+		sh->finishCompilation();
+		s_pending.erase(s_pending.begin() + i);
+	}
 }
 
 bool Shader::validate()
 {
 	glValidateProgram(program);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 
 	GLint validated = 0;
 	glGetProgramiv(program, GL_LINK_STATUS, &validated);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 
 	if (!validated)
 	{
@@ -363,37 +664,51 @@ bool Shader::validate()
 
 bool Shader::createVertexShaderObject(const std::string& shader)
 {
-	return createShaderObject(GL_VERTEX_SHADER, vs, shader);
+	return createShaderObject(GL_VERTEX_SHADER, pending_vs, shader);
 }
 
 bool Shader::createFragmentShaderObject(const std::string& shader)
 {
-	return createShaderObject(GL_FRAGMENT_SHADER, fs, shader);
+	return createShaderObject(GL_FRAGMENT_SHADER, pending_fs, shader);
 }
 
 bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::string& code)
 {
 	handle = glCreateShader(type);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 
 	std::string prefix = "";//"#define DESKTOP\n";
 
 	std::string fullcode = prefix + code;
 	const char* ptr = fullcode.c_str();
 	glShaderSource(handle, 1, &ptr, NULL);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 
 	glCompileShader(handle);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
+
+	glAttachShader(pending_program, handle);
+	assert(checkGLErrors());
+
+	return true;
+}
 
+bool Shader::checkShaderObject(GLuint handle)
+{
 	GLint compile = 0;
 	glGetShaderiv(handle, GL_COMPILE_STATUS, &compile);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 
 	//we want to see the compile log if we are in debug (to check warnings)
 	if (!compile)
 	{
 		saveShaderInfoLog(handle);
+
+		GLint len = 0;
+		glGetShaderiv(handle, GL_SHADER_SOURCE_LENGTH, &len);
+		std::string fullcode(len > 0 ? len : 1, '\0');
+		glGetShaderSource(handle, len, NULL, &fullcode[0]);
+
 		std::cout << "Shader code:\n " << std::endl;
 		std::vector<std::string> lines = split(fullcode, '\n');
 		for (size_t i = 0; i < lines.size(); ++i)
@@ -402,9 +717,6 @@ bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::st
 		return false;
 	}
 
-	glAttachShader(program, handle);
-	assert(glGetError() == GL_NO_ERROR);
-
 	return true;
 }
 
@@ -414,25 +726,26 @@ void Shader::release()
 	if (vs)
 	{
 		glDeleteShader(vs);
-		assert(glGetError() == GL_NO_ERROR);
+		assert(checkGLErrors());
 		vs = 0;
 	}
 
 	if (fs)
 	{
 		glDeleteShader(fs);
-		assert(glGetError() == GL_NO_ERROR);
+		assert(checkGLErrors());
 		fs = 0;
 	}
 
 	if (program)
 	{
 		glDeleteProgram(program);
-		assert(glGetError() == GL_NO_ERROR);
+		assert(checkGLErrors());
 		program = 0;
 	}
 
 	locations.clear();
+	attrib_locations.clear();
 
 	compiled = false;
 }
@@ -445,9 +758,15 @@ void Shader::enable()
 
 	current = this;
 
-	glUseProgram(program);
-	GLuint err = glGetError();
-	assert(err == GL_NO_ERROR);
+	//not linked yet, the fallback is used instead (uniforms and attributes go to it too)
+	if (!compiled && s_fallback)
+	{
+		GLState::useProgram(s_fallback->program);
+		glUniform4f(s_fallback->getUniformLocation("u_color"), 0.5f, 0.5f, 0.5f, 1.0f);
+	}
+	else
+		GLState::useProgram(program);
+	assert(checkGLErrors());
 
 	last_slot = 0;
 }
@@ -457,23 +776,24 @@ void Shader::disable()
 {
 	current = NULL;
 
-	glUseProgram(0);
+	//the program stays bound, if the next draw uses the same one GLState skips the glUseProgram
 	//glActiveTexture(GL_TEXTURE0);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::disableShaders()
 {
-	glUseProgram(0);
-	assert(glGetError() == GL_NO_ERROR);
+	current = NULL;
+	GLState::useProgram(0);
+	assert(checkGLErrors());
 }
 
 void Shader::saveShaderInfoLog(GLuint obj)
 {
 	int len = 0;
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 	glGetShaderiv(obj, GL_INFO_LOG_LENGTH, &len);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 
 	if (len > 0)
 	{
@@ -481,7 +801,7 @@ void Shader::saveShaderInfoLog(GLuint obj)
 		GLsizei written = 0;
 		glGetShaderInfoLog(obj, len, &written, ptr);
 		ptr[written - 1] = '\0';
-		assert(glGetError() == GL_NO_ERROR);
+		assert(checkGLErrors());
 		log.append(ptr);
 		delete[] ptr;
 
@@ -493,9 +813,9 @@ void Shader::saveShaderInfoLog(GLuint obj)
 void Shader::saveProgramInfoLog(GLuint obj)
 {
 	int len = 0;
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 	glGetProgramiv(obj, GL_INFO_LOG_LENGTH, &len);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 
 	if (len > 0)
 	{
@@ -503,7 +823,7 @@ void Shader::saveProgramInfoLog(GLuint obj)
 		GLsizei written = 0;
 		glGetProgramInfoLog(obj, len, &written, ptr);
 		ptr[written - 1] = '\0';
-		assert(glGetError() == GL_NO_ERROR);
+		assert(checkGLErrors());
 		log.append(ptr);
 		delete[] ptr;
 
@@ -516,6 +836,9 @@ GLint Shader::getLocation(const char* varname, loctable* table)
 	if (varname == 0 || table == 0)
 		return 0;
 
+	if (!compiled && s_fallback && s_fallback != this)
+		return s_fallback->getLocation(varname, &s_fallback->locations);
+
 	GLint loc = 0;
 	loctable* locs = table;
 
@@ -541,14 +864,54 @@ GLint Shader::getLocation(const char* varname, loctable* table)
 
 int Shader::getAttribLocation(const char* varname)
 {
+	if (!compiled && s_fallback && s_fallback != this)
+		return s_fallback->getAttribLocation(varname);
+
+	//cached, meshes ask for the same attributes every time they build a VAO
+	loctable::iterator cur = attrib_locations.find(varname);
+	if (cur != attrib_locations.end())
+		return cur->second;
+
 	int loc = glGetAttribLocation(program, varname);
-	if (loc == -1)
+	assert(checkGLErrors());
+
+	attrib_locations.insert(loctable::value_type(varname, loc));
+	return loc;
+}
+
+void Shader::setVertexDecode(const glm::vec3& position_offset, const glm::vec3& position_scale, bool octahedral_normals)
+{
+	//not linked yet, the fallback is bound and keeps its own cache
+	if (!compiled && s_fallback && s_fallback != this)
 	{
-		return loc;
+		s_fallback->setVertexDecode(position_offset, position_scale, octahedral_normals);
+		return;
 	}
-	assert(glGetError() == GL_NO_ERROR);
 
-	return loc;
+	sVertexDecode& decode = this->vertex_decode;
+	if (!decode.valid || decode.program_version != program_version)
+	{
+		decode.valid = false;
+		decode.program_version = program_version;
+		decode.offset_location = glGetUniformLocation(program, "u_position_offset");
+		decode.scale_location = glGetUniformLocation(program, "u_position_scale");
+		decode.octahedral_location = glGetUniformLocation(program, "u_octahedral_normals");
+	}
+	else if (decode.position_offset == position_offset && decode.position_scale == position_scale && decode.octahedral_normals == octahedral_normals)
+		return;
+
+	if (decode.offset_location != -1)
+		glUniform3f(decode.offset_location, position_offset.x, position_offset.y, position_offset.z);
+	if (decode.scale_location != -1)
+		glUniform3f(decode.scale_location, position_scale.x, position_scale.y, position_scale.z);
+	if (decode.octahedral_location != -1)
+		glUniform1i(decode.octahedral_location, octahedral_normals);
+	assert(checkGLErrors());
+
+	decode.valid = true;
+	decode.position_offset = position_offset;
+	decode.position_scale = position_scale;
+	decode.octahedral_normals = octahedral_normals;
 }
 
 int Shader::getUniformLocation(const char* varname)
@@ -558,14 +921,13 @@ int Shader::getUniformLocation(const char* varname)
 	{
 		return loc;
 	}
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 	return loc;
 }
 
 void Shader::setTexture(const char* varname, Texture* tex, int slot)
 {
-	glBindTexture(tex->texture_type, tex->texture_id);
-	glActiveTexture(GL_TEXTURE0 + slot);
+	GLState::bindTexture(slot, tex->texture_type, tex->texture_id);
 	setUniform1(varname, slot);
 }
 
@@ -585,7 +947,7 @@ void Shader::setUniform1(const char* varname, bool input1)
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform1i(loc, input1);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setUniform1(const char* varname, int input1)
@@ -593,7 +955,7 @@ void Shader::setUniform1(const char* varname, int input1)
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform1i(loc, input1);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setUniform2(const char* varname, int input1, int input2)
@@ -601,7 +963,7 @@ void Shader::setUniform2(const char* varname, int input1, int input2)
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform2i(loc, input1, input2);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setUniform3(const char* varname, int input1, int input2, int input3)
@@ -609,7 +971,7 @@ void Shader::setUniform3(const char* varname, int input1, int input2, int input3
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform3i(loc, input1, input2, input3);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setUniform4(const char* varname, const int input1, const int input2, const int input3, const int input4)
@@ -617,7 +979,7 @@ void Shader::setUniform4(const char* varname, const int input1, const int input2
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform4i(loc, input1, input2, input3, input4);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setUniform1Array(const char* varname, const int* input, const int count)
@@ -625,7 +987,7 @@ void Shader::setUniform1Array(const char* varname, const int* input, const int c
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform1iv(loc, count, input);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setUniform2Array(const char* varname, const int* input, const int count)
@@ -633,7 +995,7 @@ void Shader::setUniform2Array(const char* varname, const int* input, const int c
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform2iv(loc, count, input);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setUniform3Array(const char* varname, const int* input, const int count)
@@ -641,7 +1003,7 @@ void Shader::setUniform3Array(const char* varname, const int* input, const int c
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform3iv(loc, count, input);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setUniform4Array(const char* varname, const int* input, const int count)
@@ -649,7 +1011,7 @@ void Shader::setUniform4Array(const char* varname, const int* input, const int c
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform4iv(loc, count, input);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setUniform1(const char* varname, const float input1)
@@ -657,7 +1019,7 @@ void Shader::setUniform1(const char* varname, const float input1)
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform1f(loc, input1);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setUniform2(const char* varname, const float input1, const float input2)
@@ -665,7 +1027,7 @@ void Shader::setUniform2(const char* varname, const float input1, const float in
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform2f(loc, input1, input2);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setUniform3(const char* varname, const float input1, const float input2, const float input3)
@@ -673,7 +1035,7 @@ void Shader::setUniform3(const char* varname, const float input1, const float in
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform3f(loc, input1, input2, input3);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setUniform4(const char* varname, const float input1, const float input2, const float input3, const float input4)
@@ -689,7 +1051,7 @@ void Shader::setUniform1Array(const char* varname, const float* input, const int
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform1fv(loc, count, input);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setUniform2Array(const char* varname, const float* input, const int count)
@@ -697,7 +1059,7 @@ void Shader::setUniform2Array(const char* varname, const float* input, const int
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform2fv(loc, count, input);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setUniform3Array(const char* varname, const float* input, const int count)
@@ -705,7 +1067,7 @@ void Shader::setUniform3Array(const char* varname, const float* input, const int
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform3fv(loc, count, input);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setUniform4Array(const char* varname, const float* input, const int count)
@@ -713,7 +1075,7 @@ void Shader::setUniform4Array(const char* varname, const float* input, const int
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniform4fv(loc, count, input);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setMatrix44(const char* varname, const float* m)
@@ -721,7 +1083,7 @@ void Shader::setMatrix44(const char* varname, const float* m)
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniformMatrix4fv(loc, 1, GL_FALSE, m);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setMatrix44(const char* varname, const glm::mat4& m)
@@ -729,7 +1091,7 @@ void Shader::setMatrix44(const char* varname, const glm::mat4& m)
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(m));
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::setMatrix44Array(const char* varname, glm::mat4* m_array, int num)
@@ -737,7 +1099,7 @@ void Shader::setMatrix44Array(const char* varname, glm::mat4* m_array, int num)
 	GLint loc = getLocation(varname, &locations);
 	CHECK_SHADER_VAR(loc, varname);
 	glUniformMatrix4fv(loc, num, GL_FALSE, (GLfloat*)m_array);
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 }
 
 void Shader::init()
@@ -780,6 +1142,20 @@ void Shader::init()
 		IMPORT_GLEXT(glUniform4fv);
 		IMPORT_GLEXT(glUniformMatrix4fv);
 #endif
+
+		//let the driver compile and link in its own threads, GL_COMPLETION_STATUS_KHR tells when a program is ready
+		if (glfwExtensionSupported("GL_KHR_parallel_shader_compile") || glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+		{
+			MAXSHADERCOMPILERTHREADSPROC maxShaderCompilerThreads = (MAXSHADERCOMPILERTHREADSPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+			if (!maxShaderCompilerThreads)
+				maxShaderCompilerThreads = (MAXSHADERCOMPILERTHREADSPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+			if (maxShaderCompilerThreads)
+				maxShaderCompilerThreads(0xFFFFFFFF); //as many as the driver wants
+			s_parallel_compile = true;
+		}
+
+		//used by the shaders still being linked, it is always compiled synchronously
+		s_fallback = getDefaultShader("flat");
 	}
 
 	firsttime = false;
@@ -797,6 +1173,8 @@ Shader* Shader::getDefaultShader(std::string name)
 	vs = "attribute vec3 a_vertex; attribute vec3 a_normal; attribute vec2 a_uv; attribute vec4 a_color; \
 	uniform mat4 u_model;\n\
 	uniform mat4 u_viewprojection;\n\
+	uniform vec3 u_position_offset;\n\
+	uniform vec3 u_position_scale;\n\
 	varying vec3 v_position;\n\
 	varying vec3 v_world_position;\n\
 	varying vec4 v_color;\n\
@@ -805,9 +1183,9 @@ Shader* Shader::getDefaultShader(std::string name)
 	void main()\n\
 	{\n\
 		v_normal = (u_model * vec4(a_normal, 0.0)).xyz;\n\
-		v_position = a_vertex;\n\
+		v_position = u_position_offset + a_vertex * u_position_scale;\n\
 		v_color = a_color;\n\
-		v_world_position = (u_model * vec4(a_vertex, 1.0)).xyz;\n\
+		v_world_position = (u_model * vec4(v_position, 1.0)).xyz;\n\
 		v_uv = a_uv;\n\
 		gl_Position = u_viewprojection * vec4(v_world_position, 1.0);\n\
 	}";
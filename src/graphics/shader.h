@@ -9,6 +9,7 @@
 #include <vector>
 #include <map>
 #include <cassert>
+#include <cstdint>
 
 #include <glm/vec3.hpp>
 #include <glm/matrix.hpp>
@@ -28,10 +29,13 @@ class Shader
 	int last_slot;
 
 	static bool s_ready; //used to initialize shader vars
+	static unsigned int s_program_counter; //used to give every linked program an unique version
 
 public:
 	static Shader* current;
 
+	unsigned int program_version; //changes every time the program is linked again (meshes use it to rebuild VAOs)
+
 	Shader();
 	virtual ~Shader();
 
@@ -39,10 +43,14 @@ public:
 	virtual bool compile();
 	virtual bool recompile();
 
-	virtual bool load(const std::string& vsf, const std::string& psf, const char* macros);
+	virtual bool load(const std::string& vsf, const std::string& psf, const char* macros); //with async compile true only means submitted, see link_failed
 
 	//internal functions
-	virtual bool compileFromMemory(const std::string& vsm, const std::string& psm);
+	virtual bool compileFromMemory(const std::string& vsm, const std::string& psm); //blocks until linked
+	bool submitCompilation(const std::string& vsm, const std::string& psm);
+	bool isLinkDone(); //never blocks
+	bool finishCompilation();
+	void cancelCompilation();
 	virtual void release();
 	virtual void enable();
 	virtual void disable();
@@ -64,6 +72,9 @@ public:
 	void setUniform(const char* varname, const glm::mat4& input) { assert(current == this); setMatrix44(varname, input); }
 	void setUniform(const char* varname, std::vector<glm::mat4>& m_vector) { assert(current == this && m_vector.size()); setMatrix44Array(varname, &m_vector[0], static_cast<int>(m_vector.size())); }
 
+	//decode of the compact vertex format (see Mesh::render), the locations are cached and it is only uploaded when it changes
+	void setVertexDecode(const glm::vec3& position_offset, const glm::vec3& position_scale, bool octahedral_normals);
+
 	//for textures you must specify an slot (a number from 0 to 16) where this texture is stored in the shader
 	void setUniform(const char* varname, Texture* texture, int slot) { assert(current == this); setTexture(varname, texture, slot); }
 
@@ -108,13 +119,28 @@ public:
 	std::string getInfoLog() const;
 	bool hasInfoLog() const;
 	bool compiled;
+	bool pending; //submitted to the driver but not linked yet
+	bool link_failed; //the last sources didnt link, with async compile it is only known once UpdatePending finishes them
 
 	void setMacros(const char* macros);
 
+	//with async compile a new shader is returned before it links, if it fails UpdatePending logs it and marks it (link_failed) and Get returns NULL from then on
 	static Shader* Get(const char* vsf, const char* psf = NULL, const char* macros = NULL);
+	Shader* getVariant(const char* extra_macros); //same files with more macros (e.g. "#define USE_INSTANCING\n")
 	static void ReloadAll();
 	static std::map<std::string, Shader*> s_Shaders;
 
+	//linked programs are stored on disk and reused if the sources and the driver didnt change
+	static bool use_binary_cache;
+	static std::string s_binary_cache_path;
+
+	//shaders loaded from files are linked in the background, the fallback is used meanwhile
+	static bool use_async_compile;
+	static bool s_parallel_compile; //GL_KHR_parallel_shader_compile available
+	static std::vector<Shader*> s_pending;
+	static Shader* s_fallback;
+	static void UpdatePending(); //call once per frame
+
 	//this is a way to load a single file that contains all the shaders 
 	//to know more about the file format, it is based in this https://github.com/jagenjo/rendeer.js/tree/master/guides#the-shaders but with tiny differences
 	static bool LoadAtlas(const char* filename);
@@ -134,9 +160,15 @@ protected:
 	bool createVertexShaderObject(const std::string& shader);
 	bool createFragmentShaderObject(const std::string& shader);
 	bool createShaderObject(unsigned int type, GLuint& handle, const std::string& shader);
+	bool checkShaderObject(GLuint handle);
+	void setProgram(GLuint new_vs, GLuint new_fs, GLuint new_program);
 	void saveShaderInfoLog(GLuint obj);
 	void saveProgramInfoLog(GLuint obj);
 
+	static std::string getBinaryCacheFilename(uint64_t key);
+	GLuint loadProgramBinary(uint64_t key);
+	bool saveProgramBinary(GLuint obj, uint64_t key);
+
 	bool validate();
 
 	GLuint vs;
@@ -144,6 +176,25 @@ protected:
 	GLuint program;
 	std::string log;
 
+	GLuint pending_vs;
+	GLuint pending_fs;
+	GLuint pending_program;
+	bool pending_binary_cache;
+	uint64_t pending_cache_key;
+
+	struct sVertexDecode
+	{
+		bool valid = false; //the values below are the ones in the program
+		unsigned int program_version = 0; //of the cached locations
+		GLint offset_location = -1;
+		GLint scale_location = -1;
+		GLint octahedral_location = -1;
+		glm::vec3 position_offset;
+		glm::vec3 position_scale;
+		bool octahedral_normals = false;
+	};
+	sVertexDecode vertex_decode;
+
 	//this is a hack to speed up shader usage (save info locally)
 private:
 
@@ -159,4 +210,5 @@ private:
 public:
 	GLint getLocation(const char* varname, loctable* table);
 	loctable locations;
+	loctable attrib_locations;
 };
\ No newline at end of file
@@ -0,0 +1,181 @@
+#include "streambuffer.h"
+
+#include <cstring>
+
+#include "../framework/includes.h"
+#include "../framework/profiler.h"
+
+#define STREAM_BUFFER_FRAMES 3 //frames in flight, one region each
+
+bool StreamBuffer::enabled = true;
+size_t StreamBuffer::size = 48 * 1024 * 1024;
+
+static int s_supported = -1;
+static bool s_persistent = false; //GL_ARB_buffer_storage, otherwise every upload maps its range
+static GLuint s_buffer_id = 0;
+static char* s_mapped = NULL;
+static size_t s_region_size = 0;
+static int s_region = 0; //region being written
+static size_t s_head = 0; //bytes used in the current region
+static GLsync s_fences[STREAM_BUFFER_FRAMES] = {};
+
+//stats of the last frame
+static size_t s_frame_bytes = 0;
+static size_t s_last_frame_bytes = 0;
+static int s_stalls = 0;
+
+static bool isSupported()
+{
+	if (s_supported == -1)
+	{
+		s_supported = glfwExtensionSupported("GL_ARB_sync") && glFenceSync != 0 ? 1 : 0;
+		if (!s_supported)
+			std::cout << "[WARN] GL_ARB_sync not supported, stream buffer disabled" << std::endl;
+		s_persistent = glfwExtensionSupported("GL_ARB_buffer_storage") && glBufferStorage != 0;
+	}
+	return s_supported == 1;
+}
+
+static bool createBuffer()
+{
+	s_region_size = (StreamBuffer::size / STREAM_BUFFER_FRAMES) & ~(size_t)255;
+	size_t total = s_region_size * STREAM_BUFFER_FRAMES;
+
+	glGenBuffers(1, &s_buffer_id);
+	glBindBuffer(GL_ARRAY_BUFFER, s_buffer_id);
+	if (s_persistent)
+	{
+		//mapped once for the whole life of the buffer, coherent so no flushes are needed
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, total, NULL, flags);
+		s_mapped = (char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, total, flags);
+		if (!s_mapped)
+		{
+			std::cout << "[WARN] Persistent mapping failed, stream buffer uses mapped ranges" << std::endl;
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			glDeleteBuffers(1, &s_buffer_id);
+			glGenBuffers(1, &s_buffer_id);
+			glBindBuffer(GL_ARRAY_BUFFER, s_buffer_id);
+			s_persistent = false;
+		}
+	}
+	if (!s_persistent)
+		glBufferData(GL_ARRAY_BUFFER, total, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	std::cout << "[INFO] Stream buffer: " << STREAM_BUFFER_FRAMES << " x " << (s_region_size >> 20) << "MB" << (s_persistent ? " persistent" : " mapped ranges") << std::endl;
+	return true;
+}
+
+//waits until the GPU has finished the commands that read from this region
+static void waitRegion(int region)
+{
+	GLsync& fence = s_fences[region];
+	if (!fence)
+		return;
+
+	GLenum result = glClientWaitSync(fence, 0, 0);
+	if (result == GL_TIMEOUT_EXPIRED)
+	{
+		PROFILE_SCOPE("StreamBuffer wait");
+		s_stalls++;
+		do
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); //1ms
+		while (result == GL_TIMEOUT_EXPIRED);
+	}
+	glDeleteSync(fence);
+	fence = NULL;
+}
+
+static void nextRegion()
+{
+	if (s_fences[s_region])
+		glDeleteSync(s_fences[s_region]);
+	s_fences[s_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	s_region = (s_region + 1) % STREAM_BUFFER_FRAMES;
+	s_head = 0;
+	waitRegion(s_region);
+}
+
+bool StreamBuffer::upload(const void* data, size_t bytes, size_t& offset, size_t alignment)
+{
+	if (!enabled || !bytes || !isSupported())
+		return false;
+	if (!s_buffer_id && !createBuffer())
+		return false;
+	if (bytes > s_region_size)
+		return false; //would never fit
+
+	size_t start = (s_head + alignment - 1) / alignment * alignment;
+	if (start + bytes > s_region_size)
+	{
+		//this frame filled its region, continue in the next one
+		nextRegion();
+		start = 0;
+	}
+	s_head = start + bytes;
+	s_frame_bytes += bytes;
+	offset = s_region * s_region_size + start;
+
+	if (s_persistent)
+	{
+		memcpy(s_mapped + offset, data, bytes);
+		return true;
+	}
+
+	//the fences already protect the range, the driver doesnt need to synchronize the map
+	glBindBuffer(GL_ARRAY_BUFFER, s_buffer_id);
+	void* ptr = glMapBufferRange(GL_ARRAY_BUFFER, offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (ptr)
+	{
+		memcpy(ptr, data, bytes);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return ptr != NULL;
+}
+
+unsigned int StreamBuffer::getBufferId()
+{
+	return s_buffer_id;
+}
+
+void StreamBuffer::endFrame()
+{
+	s_last_frame_bytes = s_frame_bytes;
+	s_frame_bytes = 0;
+	if (s_buffer_id)
+		nextRegion();
+}
+
+void StreamBuffer::release()
+{
+	for (int i = 0; i < STREAM_BUFFER_FRAMES; ++i)
+	{
+		if (s_fences[i])
+			glDeleteSync(s_fences[i]);
+		s_fences[i] = NULL;
+	}
+	if (s_buffer_id)
+	{
+		if (s_mapped)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, s_buffer_id);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &s_buffer_id);
+	}
+	s_buffer_id = 0;
+	s_mapped = NULL;
+	s_region = 0;
+	s_head = 0;
+}
+
+void StreamBuffer::renderInMenu()
+{
+	ImGui::Checkbox("Stream buffer", &enabled);
+	if (!s_buffer_id)
+		return;
+	ImGui::Text("%.2f MB/frame of %.2f MB, %d stalls", s_last_frame_bytes / (1024.0f * 1024.0f), s_region_size / (1024.0f * 1024.0f), s_stalls);
+}
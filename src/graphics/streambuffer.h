@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+//a big GPU buffer that stays mapped and is used as a ring for the data that changes every frame
+//(instance transforms, vertices of meshes not in VRAM, pixels of texture uploads) so nothing is allocated per draw
+//it is split in one region per frame in flight, a fence protects every region until the GPU is done with it
+class StreamBuffer
+{
+public:
+	static bool enabled;
+	static size_t size; //bytes of the whole ring, change it before the first upload
+
+	//copies the data to the ring and returns its offset inside the buffer (getBufferId)
+	//returns false if it is not supported or it is bigger than a region, use a regular buffer then
+	static bool upload(const void* data, size_t bytes, size_t& offset, size_t alignment = 16);
+	static unsigned int getBufferId();
+
+	static void endFrame(); //after the swap, the next frame writes in the next region
+	static void release();
+
+	static void renderInMenu();
+};
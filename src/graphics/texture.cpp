@@ -8,7 +8,12 @@
 
 #include "mesh.h"
 #include "shader.h"
+#include "streambuffer.h"
+#include "glstate.h"
+#include "../framework/profiler.h"
+#include "../framework/workqueue.h"
 #include <cassert>
+#include <mutex>
 
 //bilinear interpolation
 glm::vec4 Image::getPixelInterpolated(float x, float y, bool repeat) {
@@ -40,6 +45,45 @@ glm::vec4 Image::getPixelInterpolatedHigh(float x, float y, bool repeat) {
 };
 
 std::map<std::string, Texture*> Texture::sTexturesLoaded;
+
+//bytes that glTexImage reads from the pixels pointer, rows are padded to GL_UNPACK_ALIGNMENT
+static size_t getPixelsSize(unsigned int format, unsigned int type, int width, int height, int depth)
+{
+	int channels = 4;
+	switch (format)
+	{
+		case GL_RED: case GL_RED_INTEGER: case GL_ALPHA: case GL_LUMINANCE: case GL_DEPTH_COMPONENT: channels = 1; break;
+		case GL_RG: case GL_RG_INTEGER: case GL_LUMINANCE_ALPHA: channels = 2; break;
+		case GL_RGB: case GL_RGB_INTEGER: case GL_BGR: channels = 3; break;
+	}
+	int type_size = 0;
+	switch (type)
+	{
+		case GL_UNSIGNED_BYTE: case GL_BYTE: type_size = 1; break;
+		case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: type_size = 2; break;
+		case GL_UNSIGNED_INT: case GL_INT: case GL_FLOAT: type_size = 4; break;
+		default: return 0; //packed types, not worth it
+	}
+	GLint alignment = 4;
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+	size_t row = (size_t)width * channels * type_size;
+	size_t padded_row = (row + alignment - 1) / alignment * alignment;
+	return padded_row * ((size_t)height * depth - 1) + row;
+}
+
+//the pixels are copied to the ring buffer and the texture reads them from there (PBO),
+//the driver can transfer them later instead of copying them before returning
+//unbind GL_PIXEL_UNPACK_BUFFER after the glTexImage
+static const void* streamPixels(const void* data, unsigned int format, unsigned int type, int width, int height, int depth = 1)
+{
+	size_t bytes = data ? getPixelsSize(format, type, width, height, depth) : 0;
+	size_t offset = 0;
+	if (!bytes || !StreamBuffer::upload(data, bytes, offset))
+		return data;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, StreamBuffer::getBufferId());
+	return (const void*)offset;
+}
+static std::mutex s_textures_mutex; //GetAsync may be called from the workers
 int Texture::default_mag_filter = GL_LINEAR;
 int Texture::default_min_filter = GL_LINEAR_MIPMAP_LINEAR;
 FBO* Texture::global_fbo = NULL;
@@ -79,7 +123,7 @@ Texture::~Texture()
 void Texture::clear()
 {
 	glDeleteTextures(1, &texture_id);
-	glBindTexture(this->texture_type, 0);
+	GLState::bindTexture(this->texture_type, 0);
 	texture_id = 0;
 }
 
@@ -164,7 +208,7 @@ void Texture::upload3D(float* data, unsigned int mag_filter, unsigned int min_fi
 	assert(this->texture_id && "Must create texture before uploading data.");
 	assert(this->texture_type == GL_TEXTURE_3D && "Texture type does not match.");
 
-	glBindTexture(this->texture_type, this->texture_id); //we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture(this->texture_type, this->texture_id); //we activate this id to tell opengl we are going to use this texture
 
 	// specify parameters
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, min_filter);	//set the min filter
@@ -173,11 +217,13 @@ void Texture::upload3D(float* data, unsigned int mag_filter, unsigned int min_fi
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, wrap);
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_R, wrap);
 
-	glTexImage3D(this->texture_type, 0, this->internal_format, this->width, this->height, this->depth, 0, this->format, this->type, data);
+	const void* pixels = streamPixels(data, this->format, this->type, (int)this->width, (int)this->height, (int)this->depth);
+	glTexImage3D(this->texture_type, 0, this->internal_format, this->width, this->height, this->depth, 0, this->format, this->type, pixels);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
 	if (data && this->mipmaps) glGenerateMipmap(texture_type);
 
-	glBindTexture(this->texture_type, 0);
+	GLState::bindTexture(this->texture_type, 0);
 	assert(checkGLErrors() && "Error uploading texture");
 }
 
@@ -200,7 +246,7 @@ void Texture::createCubemap(unsigned int width, unsigned int height, uint8_t** d
 	if (texture_id == 0)
 		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
 
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 	uploadCubemap(format, type, mipmaps, data, internal_format);
 }
 
@@ -209,12 +255,28 @@ Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap)
 	assert(filename);
 
 	//check if loaded
-	auto it = sTexturesLoaded.find(filename);
-	if (it != sTexturesLoaded.end())
-		return it->second;
+	Texture* texture = NULL;
+	{
+		std::lock_guard<std::mutex> lock(s_textures_mutex);
+		auto it = sTexturesLoaded.find(filename);
+		if (it != sTexturesLoaded.end())
+			texture = it->second;
+	}
+
+	//requested before with GetAsync, wait for it (only the main thread can, it does the upload)
+	if (texture)
+	{
+		if (texture->loading)
+		{
+			if (!WorkQueue::isMainThread())
+				return NULL;
+			WorkQueue::waitFor([texture]() { return !texture->loading; });
+		}
+		return texture->load_failed ? NULL : texture;
+	}
 
 	//load it
-	Texture* texture = new Texture();
+	texture = new Texture();
 	if (!texture->load(filename, mipmaps, wrap))
 	{
 		delete texture;
@@ -224,43 +286,134 @@ Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap)
 	return texture;
 }
 
+Texture* Texture::GetAsync(const char* filename, bool mipmaps, bool wrap, LoadCallback callback)
+{
+	assert(filename);
+	std::string name = filename;
+	Texture* texture = NULL;
+	bool start_load = false;
+	bool loaded = false;
+	{
+		//the same file requested twice shares the texture and the load
+		std::lock_guard<std::mutex> lock(s_textures_mutex);
+		auto it = sTexturesLoaded.find(name);
+		if (it != sTexturesLoaded.end())
+		{
+			texture = it->second;
+			if (texture->load_failed && !texture->loading) //try again, the file may exist now
+			{
+				texture->load_failed = false;
+				texture->loading = true;
+				start_load = true;
+			}
+			if (texture->loading && callback)
+				texture->load_callbacks.push_back(callback);
+			loaded = !texture->loading;
+		}
+		else
+		{
+			texture = new Texture(); //no GL calls until it is uploaded
+			texture->loading = true;
+			if (callback)
+				texture->load_callbacks.push_back(callback);
+			sTexturesLoaded[name] = texture;
+			start_load = true;
+		}
+	}
+
+	if (loaded)
+	{
+		if (callback)
+			WorkQueue::runOnMainThread([texture, callback]() { callback(texture); });
+		return texture;
+	}
+	if (!start_load)
+		return texture; //already in flight
+
+	//decode it in a worker, upload it in the main thread
+	long time = getTime();
+	WorkQueue::submit([texture, name, mipmaps, wrap, time]() {
+		bool found = texture->loadImage(name.c_str());
+		WorkQueue::runOnMainThread([texture, name, mipmaps, wrap, time, found]() {
+			if (found)
+			{
+				texture->uploadImage(mipmaps, wrap);
+				std::cout << " + Texture loaded: " << name << " Size: " << texture->width << "x" << texture->height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+			}
+
+			std::vector<LoadCallback> callbacks;
+			{
+				std::lock_guard<std::mutex> lock(s_textures_mutex);
+				texture->load_failed = !found;
+				texture->loading = false;
+				callbacks.swap(texture->load_callbacks);
+			}
+			for (LoadCallback& callback : callbacks)
+				callback(found ? texture : NULL);
+		});
+	});
+
+	return texture;
+}
+
+void Texture::setName(const char* name)
+{
+	std::lock_guard<std::mutex> lock(s_textures_mutex);
+	sTexturesLoaded[name] = this;
+}
+
 bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int type)
 {
-	std::string str = filename;
-	std::string ext = str.substr(str.size() - 4, 4);
-	Image* image = NULL;
+	PROFILE_FUNCTION();
+
 	long time = getTime();
 
 	std::cout << " + Texture loading: " << filename << " ... ";
 
-	image = new Image();
+	if (!loadImage(filename))
+		return false;
+
+	//upload to VRAM
+	uploadImage(mipmaps, wrap, type);
+
+	std::cout << "[OK] Size: " << width << "x" << height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	setName(filename);
+	return true;
+}
+
+bool Texture::loadImage(const char* filename)
+{
+	PROFILE_FUNCTION();
+
+	std::string str = filename;
+	std::string ext = str.substr(str.size() - 4, 4);
 	bool found = false;
 
 	if (ext == ".tga" || ext == ".TGA")
-		found = image->loadTGA(filename);
+		found = image.loadTGA(filename);
 	else if (ext == ".png" || ext == ".PNG")
-		found = image->loadPNG(filename);
+		found = image.loadPNG(filename);
 	else
 	{
-		std::cout << "[ERROR]: unsupported format" << std::endl;
+		std::cout << "[ERROR]: unsupported format: " << filename << std::endl;
 		return false; //unsupported file type
 	}
 
 	if (!found) //file not found
 	{
-		std::cout << " [ERROR]: Texture not found " << std::endl;
+		std::cout << " [ERROR]: Texture not found: " << filename << std::endl;
 		return false;
 	}
 
 	this->filename = filename;
+	return true;
+}
 
-	unsigned int internal_format = 0;
-
-	if (type == GL_FLOAT)
-		internal_format = (image->bytes_per_pixel == 3 ? GL_RGB32F : GL_RGBA32F);
+void Texture::uploadImage(bool mipmaps, bool wrap, unsigned int type)
+{
+	assert(image.data && "call loadImage first");
 
-	//upload to VRAM
-	create(image->width, image->height, (image->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA), type, mipmaps, image->data, 0);
+	create(image.width, image.height, (image.bytes_per_pixel == 3 ? GL_RGB : GL_RGBA), type, mipmaps, image.data, 0);
 
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, this->mipmaps && wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->mipmaps && wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
@@ -268,9 +421,6 @@ bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int t
 		generateMipmaps();
 
 	this->image.clear();
-	std::cout << "[OK] Size: " << width << "x" << height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-	setName(filename);
-	return true;
 }
 
 void Texture::upload(Image* img)
@@ -284,9 +434,11 @@ void Texture::upload(unsigned int format, unsigned int type, bool mipmaps, uint8
 	assert(texture_id && "Must create texture before uploading data.");
 	assert(texture_type == GL_TEXTURE_2D && "Texture type does not match.");
 
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
-	glTexImage2D(this->texture_type, 0, internal_format == 0 ? format : internal_format, width, height, 0, format, type, data);
+	const void* pixels = streamPixels(data, format, type, (int)width, (int)height);
+	glTexImage2D(this->texture_type, 0, internal_format == 0 ? format : internal_format, width, height, 0, format, type, pixels);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
 	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);	//set the min filter
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);   //set the mag filter
@@ -297,7 +449,7 @@ void Texture::upload(unsigned int format, unsigned int type, bool mipmaps, uint8
 	if (data && this->mipmaps)
 		generateMipmaps(); //glGenerateMipmapEXT(GL_TEXTURE_2D); 
 
-	glBindTexture(this->texture_type, 0);
+	GLState::bindTexture(this->texture_type, 0);
 	assert(checkGLErrors() && "Error uploading texture");
 }
 
@@ -305,9 +457,11 @@ void Texture::upload3D(unsigned int format, unsigned int type, bool mipmaps, uin
 	assert(texture_id && "Must create texture before uploading data.");
 	assert(texture_type == GL_TEXTURE_3D && "Texture type does not match.");
 
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
-	glTexImage3D(this->texture_type, 0, internal_format == 0 ? format : internal_format, width, height, depth, 0, format, type, data);
+	const void* pixels = streamPixels(data, format, type, (int)width, (int)height, (int)depth);
+	glTexImage3D(this->texture_type, 0, internal_format == 0 ? format : internal_format, width, height, depth, 0, format, type, pixels);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
 	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);	//set the min filter
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);   //set the mag filter
@@ -318,7 +472,7 @@ void Texture::upload3D(unsigned int format, unsigned int type, bool mipmaps, uin
 	if (data && this->mipmaps)
 		generateMipmaps(); //glGenerateMipmapEXT(GL_TEXTURE_2D); 
 
-	glBindTexture(this->texture_type, 0);
+	GLState::bindTexture(this->texture_type, 0);
 	assert(checkGLErrors() && "Error uploading texture");
 }
 
@@ -327,10 +481,14 @@ void Texture::uploadCubemap(unsigned int format, unsigned int type, bool mipmaps
 	assert(texture_id && "Must create texture before uploading data.");
 	assert(texture_type == GL_TEXTURE_CUBE_MAP && "Texture type does not match.");
 
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
 	for (int i = 0; i < 6; i++)
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, internal_format == 0 ? format : internal_format, width, height, 0, format, type, data ? data[i] : NULL);
+	{
+		const void* pixels = streamPixels(data ? data[i] : NULL, format, type, (int)width, (int)height);
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, internal_format == 0 ? format : internal_format, width, height, 0, format, type, pixels);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
 
 	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);	//set the min filter
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);   //set the mag filter
@@ -340,8 +498,8 @@ void Texture::uploadCubemap(unsigned int format, unsigned int type, bool mipmaps
 	if (data && this->mipmaps)
 		generateMipmaps();
 
-	glBindTexture(this->texture_type, 0);
-	assert(glGetError() == GL_NO_ERROR && "Error creating texture");
+	GLState::bindTexture(this->texture_type, 0);
+	assert(checkGLErrors() && "Error creating texture");
 }
 
 //special function to upload texture arrays, a special type of texture that has layers
@@ -394,22 +552,24 @@ void Texture::uploadAsArray(unsigned int texture_size, bool mipmaps)
 		data = image.data;
 
 	//How to store a texture in VRAM
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 	if (texture_id == 0)
 		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
-	glTexImage3D(this->texture_type, 0, format, width, height, num_textures, 0, dataFormat, type, data);
-	assert(glGetError() == GL_NO_ERROR);
+	GLState::bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	const void* pixels = streamPixels(data, dataFormat, type, width, height, num_textures);
+	glTexImage3D(this->texture_type, 0, format, width, height, num_textures, 0, dataFormat, type, pixels);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	assert(checkGLErrors());
 
 	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);	//set the min filter
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR); //set the mag filter
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
 	glTexParameterf(this->texture_type, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4); //better quality but takes more resources
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 	if (mipmaps)
 		generateMipmaps();
-	assert(glGetError() == GL_NO_ERROR);
+	assert(checkGLErrors());
 
 	if (num_columns > 1)
 		delete[] data;
@@ -418,13 +578,13 @@ void Texture::uploadAsArray(unsigned int texture_size, bool mipmaps)
 void Texture::bind()
 {
 	//glEnable(this->texture_type); //enable the textures 
-	glBindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
+	GLState::bindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
 }
 
 void Texture::unbind()
 {
 	//glDisable(this->texture_type); //disable the textures 
-	glBindTexture(this->texture_type, 0);	//disable the id of the texture we are going to use
+	GLState::bindTexture(this->texture_type, 0);	//disable the id of the texture we are going to use
 }
 
 void Texture::UnbindAll()
@@ -432,9 +592,9 @@ void Texture::UnbindAll()
 	glDisable(GL_TEXTURE_CUBE_MAP);
 	glDisable(GL_TEXTURE_2D);
 	glDisable(GL_TEXTURE_3D);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-	glBindTexture(GL_TEXTURE_3D, 0);
+	GLState::bindTexture(GL_TEXTURE_2D, 0);
+	GLState::bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	GLState::bindTexture(GL_TEXTURE_3D, 0);
 }
 
 void Texture::generateMipmaps()
@@ -442,7 +602,7 @@ void Texture::generateMipmaps()
 	if (!glGenerateMipmapEXT)
 		return;
 
-	glBindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
+	GLState::bindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, Texture::default_min_filter); //set the mag filter
 	glGenerateMipmapEXT(this->texture_type);
 }
@@ -481,13 +641,14 @@ Texture* Texture::getWhiteTexture()
 
 void Image::fromScreen(int width, int height)
 {
-	if (data && (width != this->width || height != this->height))
+	if (data && (width != this->width || height != this->height || bytes_per_pixel != 4))
 		clear();
 
 	if (!data)
 	{
 		this->width = width;
 		this->height = height;
+		this->bytes_per_pixel = 4;
 		data = new uint8_t[width * height * 4];
 	}
 
@@ -7,6 +7,9 @@
 #include "../framework/includes.h"
 #include <map>
 #include <string>
+#include <vector>
+#include <functional>
+#include <atomic>
 #include <cassert>
 
 #include <glm/vec4.hpp>
@@ -66,8 +69,10 @@ public:
 
 	//a general struct to store all the information about a TGA file
 
+	typedef std::function<void(Texture*)> LoadCallback; //receives NULL if the load failed
+
 	//textures manager
-	static std::map<std::string, Texture*> sTexturesLoaded;
+	static std::map<std::string, Texture*> sTexturesLoaded; //guarded by a mutex in Get, GetAsync and setName
 
 	GLuint texture_id; // GL id to identify the texture in opengl, every texture must have its own id
 	float width;
@@ -87,6 +92,12 @@ public:
 	//original data info
 	Image image;
 
+	//textures from GetAsync have no texture_id until their image is uploaded
+	//the manager keeps owning them if the load fails, they stay without texture_id and GetAsync tries again with the same texture
+	std::atomic<bool> loading = false;
+	bool load_failed = false; //set before loading is cleared
+	std::vector<LoadCallback> load_callbacks; //called in the main thread when it finishes
+
 	Texture();
 	Texture(unsigned int width, unsigned int height, unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, uint8_t* data = NULL, unsigned int internal_format = 0);
 	Texture(Image* img);
@@ -115,10 +126,13 @@ public:
 
 	//load without using the manager
 	bool load(const char* filename, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE);
+	bool loadImage(const char* filename); //only decodes it into image, no GL calls so it can be called from a worker
+	void uploadImage(bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE); //uploads image and frees it
 
 	//load using the manager (caching loaded ones to avoid reloading them)
-	static Texture* Get(const char* filename, bool mipmaps = true, bool wrap = true);
-	void setName(const char* name) { sTexturesLoaded[name] = this; }
+	static Texture* Get(const char* filename, bool mipmaps = true, bool wrap = true); //NULL if it failed, or from a worker if GetAsync is still loading it
+	static Texture* GetAsync(const char* filename, bool mipmaps = true, bool wrap = true, LoadCallback callback = NULL); //returns at once, decodes in a worker and uploads in the main thread
+	void setName(const char* name);
 
 	void generateMipmaps();
 
@@ -0,0 +1,142 @@
+#include "volumeproxy.h"
+
+#include <vector>
+#include <algorithm>
+
+#include "mesh.h"
+#include "../framework/workqueue.h"
+#include "../framework/profiler.h"
+
+bool VolumeProxy::multithread = true;
+
+bool VolumeProxy::build(const float* density, int resolution, float min_density, Mesh* mesh, int cell_size)
+{
+	PROFILE_FUNCTION();
+
+	int r = resolution;
+	int n = (r + cell_size - 1) / cell_size; //macrocells per axis
+	std::vector<unsigned char> occupied((size_t)n * n * n, 0);
+
+	//the trilinear filter reads one sample more at each side of the cell
+	auto occupy = [&](int cz) {
+		int z0 = std::max(cz * cell_size - 1, 0), z1 = std::min((cz + 1) * cell_size, r - 1);
+		for (int cy = 0; cy < n; ++cy)
+		{
+			int y0 = std::max(cy * cell_size - 1, 0), y1 = std::min((cy + 1) * cell_size, r - 1);
+			for (int cx = 0; cx < n; ++cx)
+			{
+				int x0 = std::max(cx * cell_size - 1, 0), x1 = std::min((cx + 1) * cell_size, r - 1);
+				bool found = false;
+				for (int z = z0; z <= z1 && !found; ++z)
+					for (int y = y0; y <= y1 && !found; ++y)
+					{
+						const float* row = density + ((size_t)z * r + y) * r;
+						for (int x = x0; x <= x1; ++x)
+							if (row[x] > min_density)
+							{
+								found = true;
+								break;
+							}
+					}
+				occupied[((size_t)cz * n + cy) * n + cx] = found;
+			}
+		}
+	};
+
+	if (VolumeProxy::multithread)
+		WorkQueue::parallelFor(n, occupy);
+	else
+		for (int cz = 0; cz < n; ++cz)
+			occupy(cz);
+
+	mesh->clear();
+	if (std::find(occupied.begin(), occupied.end(), 1) == occupied.end())
+		return false;
+
+	auto isOccupied = [&](int x, int y, int z) {
+		return x >= 0 && y >= 0 && z >= 0 && x < n && y < n && z < n && occupied[((size_t)z * n + y) * n + x];
+	};
+
+	//border of a macrocell in local coordinates, the last one can be smaller
+	auto edge = [&](int c) { return -1.f + 2.f * std::min(c * cell_size, r) / r; };
+
+	//for every axis and every plane between cells, 1 where the face looks towards +axis, -1 towards -axis
+	std::vector<signed char> mask((size_t)n * n);
+	for (int d = 0; d < 3; ++d)
+	{
+		int u = (d + 1) % 3, v = (d + 2) % 3;
+		for (int s = 0; s <= n; ++s)
+		{
+			for (int j = 0; j < n; ++j)
+				for (int i = 0; i < n; ++i)
+				{
+					int a[3], b[3];
+					a[d] = s - 1; a[u] = i; a[v] = j;
+					b[d] = s; b[u] = i; b[v] = j;
+					bool inside_a = isOccupied(a[0], a[1], a[2]);
+					bool inside_b = isOccupied(b[0], b[1], b[2]);
+					mask[j * n + i] = inside_a == inside_b ? 0 : inside_a ? 1 : -1;
+				}
+
+			//merge the faces with the same orientation in rectangles, first along u and then along v
+			for (int j = 0; j < n; ++j)
+				for (int i = 0; i < n; )
+				{
+					signed char m = mask[j * n + i];
+					if (!m)
+					{
+						++i;
+						continue;
+					}
+					int w = 1;
+					while (i + w < n && mask[j * n + i + w] == m)
+						++w;
+					int h = 1;
+					for (; j + h < n; ++h)
+					{
+						bool row = true;
+						for (int k = 0; k < w && row; ++k)
+							row = mask[(j + h) * n + i + k] == m;
+						if (!row)
+							break;
+					}
+					for (int l = 0; l < h; ++l)
+						std::fill(mask.begin() + (j + l) * n + i, mask.begin() + (j + l) * n + i + w, 0);
+
+					//counter clockwise seen from the empty side
+					glm::vec3 corners[4];
+					float uv[4][2] = { { edge(i), edge(j) }, { edge(i + w), edge(j) }, { edge(i + w), edge(j + h) }, { edge(i), edge(j + h) } };
+					for (int k = 0; k < 4; ++k)
+					{
+						corners[k][d] = edge(s);
+						corners[k][u] = uv[k][0];
+						corners[k][v] = uv[k][1];
+					}
+					glm::vec3 normal(0.f);
+					normal[d] = (float)m;
+
+					unsigned int base = (unsigned int)mesh->vertices.size();
+					for (int k = 0; k < 4; ++k)
+					{
+						mesh->vertices.push_back(corners[k]);
+						mesh->normals.push_back(normal);
+					}
+					if (m > 0)
+					{
+						mesh->indices.push_back(glm::uvec3(base, base + 1, base + 2));
+						mesh->indices.push_back(glm::uvec3(base, base + 2, base + 3));
+					}
+					else
+					{
+						mesh->indices.push_back(glm::uvec3(base, base + 2, base + 1));
+						mesh->indices.push_back(glm::uvec3(base, base + 3, base + 2));
+					}
+					i += w;
+				}
+		}
+	}
+
+	mesh->updateBoundingBox();
+	mesh->uploadToVRAM();
+	return true;
+}
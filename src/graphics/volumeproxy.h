@@ -0,0 +1,16 @@
+#pragma once
+
+class Mesh;
+
+//low poly hull around the occupied cells of a density grid, rendered instead of the bounding box of a volume
+//so the rays start marching where the data starts. The grid is split in macrocells of cell_size^3 samples,
+//a macrocell is occupied if any sample that can be interpolated inside it is over min_density, and the
+//faces between occupied and empty macrocells are merged into rectangles (greedy meshing)
+class VolumeProxy
+{
+public:
+	static bool multithread;
+
+	//the hull covers [-1,1] like the density texture, returns false (and an empty mesh) if nothing is occupied
+	static bool build(const float* density, int resolution, float min_density, Mesh* mesh, int cell_size = 8);
+};
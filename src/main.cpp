@@ -1,6 +1,8 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <iostream> // to output
+#include <algorithm>
+#include <cstdlib>
 
 // IMGUI
 #include "imgui.h"
@@ -9,11 +11,30 @@
 #include "ImGuizmo.h"
 
 #include "application.h"
+#include "framework/workqueue.h"
+#include "framework/filewatcher.h"
+#include "framework/gldebug.h"
+#include "framework/gpuprofiler.h"
+#include "framework/profiler.h"
+#include "framework/benchmark.h"
+#include "framework/golden.h"
+#include "graphics/streambuffer.h"
+#include "graphics/lightclusters.h"
 
 // Globals
 Application* app;
 Application* Application::instance = new Application();
 
+// --trace <file>: captures the startup and the first frames with the CPU profiler
+#define TRACE_FRAMES 300
+const char* trace_filename = NULL;
+
+// --bench [--bench-frames N] [--bench-out file]: renders offscreen without window nor vsync and saves the timings
+// --golden [--golden-folder dir] [--golden-update]: compares the volume shaders output with the reference images in res/golden
+// --golden-update stores the current output as the references, run it once to bootstrap them on a new driver or after an intended change
+bool bench = false;
+bool golden = false;
+
 void renderGUI(GLFWwindow* window, Application* app) 
 {
 	ImGuiIO& io = ImGui::GetIO(); (void)io;
@@ -35,6 +56,22 @@ void renderGUI(GLFWwindow* window, Application* app)
 				ImGui::Text("Mouse pos: <INVALID>");
 			ImGui::Text("Mouse down:");
 			for (int i = 0; i < IM_ARRAYSIZE(io.MouseDown); i++) if (ImGui::IsMouseDown(i)) { ImGui::SameLine(); ImGui::Text("b%d (%.02f secs)", i, io.MouseDownDuration[i]); }
+			if (ImGui::TreeNode("CPU profiler")) {
+				Profiler::renderInMenu();
+				ImGui::TreePop();
+			}
+			if (ImGui::TreeNode("GPU profiler")) {
+				GPUProfiler::renderInMenu();
+				ImGui::TreePop();
+			}
+			if (ImGui::TreeNode("GL messages")) {
+				GLDebug::renderInMenu();
+				ImGui::TreePop();
+			}
+			if (ImGui::TreeNode("Streaming")) {
+				StreamBuffer::renderInMenu();
+				ImGui::TreePop();
+			}
 			ImGui::TreePop();
 		}
 
@@ -131,10 +168,13 @@ void mainLoop(GLFWwindow* window)
 	glfwGetFramebufferSize(window, &width, &height);
 	double prev_frame_time = 0.0;
 	double xpos, ypos; // mouse position vars
+	int frame = 0;
 
 	/* Loop until the user closes the window */
 	while (!glfwWindowShouldClose(window))
 	{
+		PROFILE_SCOPE("Frame");
+
 		glfwGetFramebufferSize(window, &width, &height);
 		glViewport(0, 0, width, height);
 
@@ -149,6 +189,13 @@ void mainLoop(GLFWwindow* window)
 		prev_frame_time = curr_time;
 		app->update(delta_time);
 
+		// Reload the assets modified in disk and finish the work the workers left for the main thread
+		FileWatcher::update();
+		WorkQueue::flushMainThread();
+
+		// Install the shaders the driver finished linking
+		Shader::UpdatePending();
+
 		if (app->close) break;
 
 		// Start the Dear ImGui frame
@@ -161,19 +208,67 @@ void mainLoop(GLFWwindow* window)
 
 		//ImGui::ShowDemoWindow();
 
+		GPUProfiler::beginFrame();
+
 		app->render();
 
-		renderGUI(window, app);
+		{
+			GPU_PROFILE_SCOPE("GUI");
+			renderGUI(window, app);
+		}
+
+		GPUProfiler::endFrame();
 		
 		/* Swap front and back buffers */
-		glfwSwapBuffers(window);
+		{
+			PROFILE_SCOPE("SwapBuffers");
+			glfwSwapBuffers(window);
+		}
+
+		// The per frame data of the next frame goes to another region of the ring
+		StreamBuffer::endFrame();
+
+		GLDebug::newFrame();
+
+		if (trace_filename && ++frame == TRACE_FRAMES)
+			Profiler::endCapture(trace_filename);
 
 		ImGui::EndFrame();
 	}
 }
 
-int main(void) 
+int main(int argc, char** argv) 
 {
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--trace" && i + 1 < argc)
+			trace_filename = argv[++i];
+		else if (arg == "--bench")
+			bench = true;
+		else if (arg == "--bench-frames" && i + 1 < argc)
+			Benchmark::num_frames = std::max(1, atoi(argv[++i]));
+		else if (arg == "--bench-out" && i + 1 < argc)
+			Benchmark::output_filename = argv[++i];
+		else if (arg == "--golden")
+			golden = true;
+		else if (arg == "--golden-folder" && i + 1 < argc)
+			Golden::folder = argv[++i];
+		else if (arg == "--golden-update")
+			golden = Golden::update_references = true;
+	}
+	bool offscreen = bench || golden;
+
+	if (trace_filename)
+		Profiler::beginCapture();
+
+#if defined(GLFW_PLATFORM_NULL) && !defined(_WIN32)
+	// Without a display the offscreen modes use a surfaceless EGL context (works with Mesa llvmpipe)
+	bool headless = offscreen && !getenv("DISPLAY") && !getenv("WAYLAND_DISPLAY");
+	if (headless)
+		glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
+
 	/* Glfw (Window API) */
 	if (!glfwInit())
 		return -1;
@@ -181,8 +276,19 @@ int main(void)
 	/* Create a windowed mode window and its OpenGL context */
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+#ifdef _DEBUG
+	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE); // Drivers only report everything to debug contexts
+#endif
+	if (offscreen) {
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE); // Offscreen modes render to an FBO, the window only holds the context
+#if defined(GLFW_PLATFORM_NULL) && !defined(_WIN32)
+		if (headless)
+			glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+#endif
+	}
 
-	GLFWwindow* window = glfwCreateWindow(1600, 900, "VDB Viewer", nullptr, nullptr); // 1600, 900 or 1280, 720
+	GLFWwindow* window = offscreen ? glfwCreateWindow(bench ? Benchmark::width : Golden::width, bench ? Benchmark::height : Golden::height, "VDB Viewer", nullptr, nullptr)
+		: glfwCreateWindow(1600, 900, "VDB Viewer", nullptr, nullptr); // 1600, 900 or 1280, 720
 	if (!window)
 	{
 		glfwTerminate();
@@ -191,7 +297,7 @@ int main(void)
 
 	/* Make the window's context current */
 	glfwMakeContextCurrent(window);
-	glfwSwapInterval(1); // Enable vsync
+	glfwSwapInterval(offscreen ? 0 : 1); // Enable vsync
 
 	/* Glew (OpenGL API) */
 	if (glewInit() != GLEW_OK)
@@ -205,6 +311,13 @@ int main(void)
 	printf("\n[INFO] OpenGL version supported %s\n\n", version);
 	fflush(stdout);
 
+	// Errors reported by the driver, sync in debug so the callstack points to the failing call
+#ifdef _DEBUG
+	GLDebug::init(GLDEBUG_SYNC);
+#else
+	GLDebug::init(GLDEBUG_ASYNC);
+#endif
+
 	// Bind event callbacks
 	glfwSetKeyCallback(window, onKeyEvent);
 	glfwSetMouseButtonCallback(window, onMouseEvent);
@@ -225,14 +338,38 @@ int main(void)
 	ImGui_ImplGlfw_InitForOpenGL(window, true);
 	ImGui_ImplOpenGL3_Init(glsl_version);
 
+	WorkQueue::init();
+
+	// Measure the final shaders and assets, not the fallbacks nor reloads
+	if (offscreen) {
+		Shader::use_async_compile = false;
+		FileWatcher::enabled = false;
+	}
+
 	app = new Application();
 	app->init(window);
 
-	// Main loop, application gets inside here till user closes it
-	mainLoop(window);
+	int result = 0;
+	if (offscreen) {
+		if (bench && !Benchmark::run(app))
+			result = 1;
+		if (golden && !Golden::run(app))
+			result = 1;
+		if (trace_filename)
+			Profiler::endCapture(trace_filename);
+	}
+	else {
+		// Main loop, application gets inside here till user closes it
+		mainLoop(window);
+	}
+
+	// Stop the workers before freeing what they could be using
+	WorkQueue::shutdown();
 
 	// Free memory
 	delete app;
+	LightClusters::release();
+	StreamBuffer::release();
 
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
@@ -241,5 +378,5 @@ int main(void)
 	glfwDestroyWindow(window);
 	glfwTerminate();
 
-	return 0;
+	return result;
 }
\ No newline at end of file